@@ -0,0 +1,270 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <benchmark/benchmark.h>
+
+#include <taily.hpp>
+#include <taily/fast_gamma.hpp>
+#include <taily/shard_block.hpp>
+#include <taily/thread_pool.hpp>
+
+#include "synthetic_stats.hpp"
+
+namespace {
+
+using namespace taily;
+
+constexpr std::int64_t shard_size = 1'000'000;
+constexpr std::int64_t collection_size = 1'000'000'000;
+constexpr int ntop = 1000;
+
+void query_lengths(benchmark::internal::Benchmark* bench)
+{
+    bench->RangeMultiplier(2)->Range(1, 32);
+}
+
+void shards_and_query_lengths(benchmark::internal::Benchmark* bench)
+{
+    for (std::int64_t shard_count = 10; shard_count <= 100'000; shard_count *= 10) {
+        for (std::int64_t term_count : {1, 2, 4, 8, 16, 32}) {
+            bench->Args({shard_count, term_count});
+        }
+    }
+    bench->ArgNames({"shards", "terms"})->Unit(benchmark::kMicrosecond);
+}
+
+void BM_any(benchmark::State& state)
+{
+    bench::Synthetic_Stats generator;
+    auto stats = generator.global_stats(state.range(0), collection_size);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(any(stats));
+    }
+}
+BENCHMARK(BM_any)->Apply(query_lengths);
+
+void BM_all(benchmark::State& state)
+{
+    bench::Synthetic_Stats generator;
+    auto stats = generator.global_stats(state.range(0), collection_size);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(all(stats));
+    }
+}
+BENCHMARK(BM_all)->Apply(query_lengths);
+
+void BM_fit_distribution(benchmark::State& state)
+{
+    bench::Synthetic_Stats generator;
+    auto stats = generator.global_stats(state.range(0), collection_size);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(fit_distribution(stats.term_stats));
+    }
+}
+BENCHMARK(BM_fit_distribution)->Apply(query_lengths);
+
+template<typename Gamma>
+void BM_estimate_cutoff(benchmark::State& state)
+{
+    bench::Synthetic_Stats generator;
+    auto stats = generator.global_stats(state.range(0), collection_size);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(estimate_cutoff<Gamma>(stats, ntop));
+    }
+}
+BENCHMARK_TEMPLATE(BM_estimate_cutoff, Exact_Gamma)->Apply(query_lengths);
+BENCHMARK_TEMPLATE(BM_estimate_cutoff, Fast_Gamma)->Apply(query_lengths);
+
+template<typename Gamma>
+void BM_calculate_cdf(benchmark::State& state)
+{
+    bench::Synthetic_Stats generator;
+    auto global = generator.global_stats(state.range(0), collection_size);
+    auto shard = generator.global_stats(state.range(0), shard_size);
+    double const cutoff = estimate_cutoff(global, ntop);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(calculate_cdf<Gamma>(cutoff, shard));
+    }
+}
+BENCHMARK_TEMPLATE(BM_calculate_cdf, Exact_Gamma)->Apply(query_lengths);
+BENCHMARK_TEMPLATE(BM_calculate_cdf, Fast_Gamma)->Apply(query_lengths);
+
+template<typename Gamma>
+void BM_score_shards(benchmark::State& state)
+{
+    bench::Synthetic_Stats generator(17, bench::Synthetic_Stats::miss_rate_for(state.range(1)));
+    auto global = generator.global_stats(state.range(1), collection_size);
+    auto shards = generator.shard_stats(state.range(0), state.range(1), shard_size);
+    std::vector<double> scores(shards.size());
+    for (auto _ : state) {
+        score_shards<Gamma>(global, shards, ntop, scores.data());
+        benchmark::DoNotOptimize(scores.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_score_shards, Exact_Gamma)->Apply(shards_and_query_lengths);
+BENCHMARK_TEMPLATE(BM_score_shards, Fast_Gamma)->Apply(shards_and_query_lengths);
+
+auto shard_distributions(std::int64_t shard_count, std::int64_t term_count)
+    -> std::vector<Gamma_Parameters>
+{
+    bench::Synthetic_Stats generator(17, bench::Synthetic_Stats::miss_rate_for(term_count));
+    std::vector<Gamma_Parameters> dists;
+    for (auto const& stats : generator.shard_stats(shard_count, term_count, shard_size)) {
+        auto sum = std::accumulate(
+            stats.term_stats.begin(), stats.term_stats.end(), Feature_Statistics{0, 0, 0});
+        if (sum.expected_value > 0 && sum.variance > 0) {
+            dists.push_back(fit_gamma(sum));
+        }
+    }
+    return dists;
+}
+
+template<typename Gamma>
+void BM_complement_cdf(benchmark::State& state)
+{
+    auto dists = shard_distributions(state.range(0), state.range(1));
+    std::vector<double> result(dists.size());
+    double const cutoff = 20.0 * state.range(1);
+    for (auto _ : state) {
+        std::transform(dists.begin(), dists.end(), result.begin(), [cutoff](auto const& dist) {
+            return Gamma::complement_cdf(dist, cutoff);
+        });
+        benchmark::DoNotOptimize(result.data());
+    }
+    state.SetItemsProcessed(state.iterations() * dists.size());
+}
+BENCHMARK_TEMPLATE(BM_complement_cdf, Exact_Gamma)->Apply(shards_and_query_lengths);
+BENCHMARK_TEMPLATE(BM_complement_cdf, Fast_Gamma)->Apply(shards_and_query_lengths);
+
+void BM_complement_cdf_batch(benchmark::State& state)
+{
+    auto dists = shard_distributions(state.range(0), state.range(1));
+    std::vector<double> result(dists.size());
+    double const cutoff = 20.0 * state.range(1);
+    for (auto _ : state) {
+        complement_cdf<Fast_Gamma>(dists.data(), dists.size(), cutoff, result.data());
+        benchmark::DoNotOptimize(result.data());
+    }
+    state.SetItemsProcessed(state.iterations() * dists.size());
+}
+BENCHMARK(BM_complement_cdf_batch)->Apply(shards_and_query_lengths);
+
+void BM_select_shards(benchmark::State& state)
+{
+    bench::Synthetic_Stats generator(17, bench::Synthetic_Stats::miss_rate_for(state.range(1)));
+    auto global = generator.global_stats(state.range(1), collection_size);
+    auto shards = generator.shard_stats(state.range(0), state.range(1), shard_size);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(select_shards(global, shards, ntop, 10));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_select_shards)->Apply(shards_and_query_lengths);
+
+void BM_score_shards_thread_pool(benchmark::State& state)
+{
+    bench::Synthetic_Stats generator(17, bench::Synthetic_Stats::miss_rate_for(state.range(1)));
+    auto global = generator.global_stats(state.range(1), collection_size);
+    auto shards = generator.shard_stats(state.range(0), state.range(1), shard_size);
+    std::vector<double> scores(shards.size());
+    Thread_Pool pool;
+    for (auto _ : state) {
+        score_shards(pool, global, shards, ntop, scores.data());
+        benchmark::DoNotOptimize(scores.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_score_shards_thread_pool)->Apply(shards_and_query_lengths)->UseRealTime();
+
+void BM_all_shards(benchmark::State& state)
+{
+    bench::Synthetic_Stats generator(17, bench::Synthetic_Stats::miss_rate_for(state.range(1)));
+    auto shards = generator.shard_stats(state.range(0), state.range(1), shard_size);
+    std::vector<double> result(shards.size());
+    for (auto _ : state) {
+        std::transform(shards.begin(), shards.end(), result.begin(), [](auto const& stats) {
+            return all(stats);
+        });
+        benchmark::DoNotOptimize(result.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_all_shards)->Apply(shards_and_query_lengths);
+
+void BM_all_shard_block(benchmark::State& state)
+{
+    bench::Synthetic_Stats generator(17, bench::Synthetic_Stats::miss_rate_for(state.range(1)));
+    auto shards = generator.shard_stats(state.range(0), state.range(1), shard_size);
+    Shard_Block block;
+    block.assign(shards);
+    std::vector<double> result(shards.size());
+    for (auto _ : state) {
+        all(block, result.data());
+        benchmark::DoNotOptimize(result.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_all_shard_block)->Apply(shards_and_query_lengths);
+
+void BM_log_all_shard_block(benchmark::State& state)
+{
+    bench::Synthetic_Stats generator(17, bench::Synthetic_Stats::miss_rate_for(state.range(1)));
+    auto shards = generator.shard_stats(state.range(0), state.range(1), shard_size);
+    Shard_Block block;
+    block.assign(shards);
+    std::vector<double> result(shards.size());
+    for (auto _ : state) {
+        log_all(block, result.data());
+        benchmark::DoNotOptimize(result.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_log_all_shard_block)->Apply(shards_and_query_lengths);
+
+template<typename Gamma, Domain domain = Domain::linear>
+void BM_score_shard_block(benchmark::State& state)
+{
+    bench::Synthetic_Stats generator(17, bench::Synthetic_Stats::miss_rate_for(state.range(1)));
+    auto global = generator.global_stats(state.range(1), collection_size);
+    auto shards = generator.shard_stats(state.range(0), state.range(1), shard_size);
+    Shard_Block block;
+    block.assign(shards);
+    std::vector<double> scores(shards.size());
+    Arena arena;
+    for (auto _ : state) {
+        arena.reset();
+        score_shards<Gamma>(global, block, ntop, scores.data(), arena, domain);
+        benchmark::DoNotOptimize(scores.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_score_shard_block, Exact_Gamma)->Apply(shards_and_query_lengths);
+BENCHMARK_TEMPLATE(BM_score_shard_block, Fast_Gamma)->Apply(shards_and_query_lengths);
+BENCHMARK_TEMPLATE(BM_score_shard_block, Fast_Gamma, Domain::log)
+    ->Apply(shards_and_query_lengths);
+
+}  // namespace
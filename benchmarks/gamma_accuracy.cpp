@@ -0,0 +1,92 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <taily.hpp>
+#include <taily/fast_gamma.hpp>
+
+// Reports the error of `Fast_Gamma`, including its batch `complement_cdf`, with
+// respect to `Exact_Gamma` over a grid of distribution shapes and tail probabilities.
+int main()
+{
+    std::vector<double> const shapes = {0.05,
+                                        0.1,
+                                        0.5,
+                                        1.0,
+                                        2.0,
+                                        5.0,
+                                        10.0,
+                                        20.0,
+                                        50.0,
+                                        100.0,
+                                        500.0,
+                                        999.0,
+                                        1001.0,
+                                        5000.0,
+                                        1e4,
+                                        1e5,
+                                        1e7,
+                                        1e10};
+    std::vector<double> const probabilities = {
+        0.9, 0.5, 0.1, 1e-2, 1e-3, 1e-4, 1e-5, 1e-6, 1e-8, 1e-10};
+
+    std::cout << std::setw(10) << "shape" << std::setw(18) << "max cdf rel err" << std::setw(18)
+              << "max quant rel err" << std::setw(18) << "max batch rel err" << '\n';
+    double overall_cdf_error = 0.0;
+    double overall_quantile_error = 0.0;
+    double overall_batch_error = 0.0;
+    for (double shape : shapes) {
+        taily::Gamma_Parameters const dist{shape, 2.5};
+        double cdf_error = 0.0;
+        double quantile_error = 0.0;
+        double batch_error = 0.0;
+        for (double p : probabilities) {
+            double const exact_x = taily::Exact_Gamma::complement_quantile(dist, p);
+            double const fast_x = taily::Fast_Gamma::complement_quantile(dist, p);
+            quantile_error = std::max(quantile_error, std::abs(fast_x - exact_x) / exact_x);
+
+            double const exact_p = taily::Exact_Gamma::complement_cdf(dist, exact_x);
+            double const fast_p = taily::Fast_Gamma::complement_cdf(dist, exact_x);
+            cdf_error = std::max(cdf_error, std::abs(fast_p - exact_p) / exact_p);
+
+            double batch_p = 0.0;
+            taily::complement_cdf<taily::Fast_Gamma>(&dist, 1, exact_x, &batch_p);
+            batch_error = std::max(batch_error, std::abs(batch_p - exact_p) / exact_p);
+        }
+        overall_cdf_error = std::max(overall_cdf_error, cdf_error);
+        overall_quantile_error = std::max(overall_quantile_error, quantile_error);
+        overall_batch_error = std::max(overall_batch_error, batch_error);
+        std::cout << std::setw(10) << shape << std::setw(18) << cdf_error << std::setw(18)
+                  << quantile_error << std::setw(18) << batch_error << '\n';
+    }
+    std::cout << std::setw(10) << "overall" << std::setw(18) << overall_cdf_error
+              << std::setw(18) << overall_quantile_error << std::setw(18) << overall_batch_error
+              << '\n';
+}
@@ -0,0 +1,119 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <taily.hpp>
+
+namespace taily::bench {
+
+/// Generates random but plausible statistics for benchmarking.
+///
+/// Frequencies are drawn from a log-uniform distribution between 1% and 50%
+/// of the collection size, so that even long queries have a non-trivial
+/// cutoff, and a term is absent from a shard with probability `miss_rate`,
+/// which mimics the sparsity of real shard statistics.
+///
+/// A fixed miss rate leaves almost no shard with all terms of a long query,
+/// which makes `all` zero nearly everywhere; `miss_rate_for` keeps that
+/// fraction constant across query lengths instead.
+class Synthetic_Stats {
+public:
+    explicit Synthetic_Stats(std::uint32_t seed = 17, double miss_rate = 0.3)
+        : m_gen(seed), m_miss(miss_rate)
+    {}
+
+    /// Returns the miss rate at which a shard contains all of `term_count`
+    /// terms with probability `match_rate`.
+    [[nodiscard]] static auto miss_rate_for(std::size_t term_count, double match_rate = 0.7)
+        -> double
+    {
+        return 1.0 - std::pow(match_rate, 1.0 / static_cast<double>(term_count));
+    }
+
+    [[nodiscard]] auto feature_stats(std::int64_t collection_size) -> Feature_Statistics
+    {
+        if (m_miss(m_gen)) {
+            return Feature_Statistics{0, 0, 0};
+        }
+        std::uniform_real_distribution<double> log_frequency(
+            std::log(static_cast<double>(collection_size) / 100),
+            std::log(static_cast<double>(collection_size) / 2));
+        std::uniform_real_distribution<double> mean(1.0, 30.0);
+        std::uniform_real_distribution<double> relative_variance(0.1, 4.0);
+        double const expected_value = mean(m_gen);
+        return Feature_Statistics{expected_value,
+                                  expected_value * relative_variance(m_gen),
+                                  static_cast<std::int64_t>(std::exp(log_frequency(m_gen)))};
+    }
+
+    [[nodiscard]] auto query_stats(std::size_t term_count, std::int64_t collection_size)
+        -> Query_Statistics
+    {
+        Query_Statistics stats{{}, collection_size};
+        for (std::size_t term = 0; term < term_count; term++) {
+            stats.term_stats.push_back(feature_stats(collection_size));
+        }
+        return stats;
+    }
+
+    /// Returns global statistics of a query, in which every term occurs.
+    [[nodiscard]] auto global_stats(std::size_t term_count, std::int64_t collection_size)
+        -> Query_Statistics
+    {
+        auto stats = query_stats(term_count, collection_size);
+        for (auto& term_stats : stats.term_stats) {
+            while (term_stats.frequency == 0) {
+                term_stats = feature_stats(collection_size);
+            }
+        }
+        return stats;
+    }
+
+    [[nodiscard]] auto shard_stats(std::size_t shard_count,
+                                   std::size_t term_count,
+                                   std::int64_t shard_size) -> std::vector<Query_Statistics>
+    {
+        std::vector<Query_Statistics> stats;
+        stats.reserve(shard_count);
+        for (std::size_t shard = 0; shard < shard_count; shard++) {
+            stats.push_back(query_stats(term_count, shard_size));
+        }
+        return stats;
+    }
+
+private:
+    std::mt19937 m_gen;
+    std::bernoulli_distribution m_miss;
+};
+
+}  // namespace taily::bench
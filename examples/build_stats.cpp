@@ -0,0 +1,65 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <taily/stats_builder.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Builds a sharded stats file from a PISA-style collection of documents and scores.
+//
+// The shard file is a text file containing the shard ID of each document, one per line.
+int main(int argc, char** argv)
+{
+    if (argc < 5 || argc > 6) {
+        std::cerr << "usage: " << argv[0]
+                  << " <documents> <scores> <document-shards> <output> [threads]\n";
+        return 1;
+    }
+    std::size_t const threads = argc == 6 ? std::stoul(argv[5])
+                                          : std::thread::hardware_concurrency();
+
+    std::vector<std::uint32_t> document_shards;
+    std::ifstream shard_input(argv[3]);
+    for (std::uint32_t shard; shard_input >> shard;) {
+        document_shards.push_back(shard);
+    }
+    std::size_t const shard_count =
+        document_shards.empty()
+        ? 0
+        : *std::max_element(document_shards.begin(), document_shards.end()) + 1;
+
+    taily::Scored_Posting_Collection collection(argv[1], argv[2]);
+    taily::Thread_Pool pool(threads);
+    std::ofstream output(argv[4], std::ios::binary);
+    taily::build_sharded_stats(collection, document_shards, shard_count, output, pool);
+    std::cerr << "Wrote statistics of " << collection.term_count() << " terms in "
+              << shard_count << " shards to " << argv[4] << '\n';
+}
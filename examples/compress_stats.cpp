@@ -0,0 +1,125 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <taily/compressed_store.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Compresses a sharded stats file and reports the size of the result and the
+// deviation of shard scores of random queries from the exact store.
+//
+// Shard sizes are read from the header of the stats file.
+int main(int argc, char** argv)
+{
+    if (argc < 3 || argc > 5) {
+        std::cerr << "usage: " << argv[0] << " <input> <output> [float32|log16] [query-count]\n";
+        return 1;
+    }
+    std::string const encoding_name = argc > 3 ? argv[3] : "float32";
+    if (encoding_name != "float32" && encoding_name != "log16") {
+        std::cerr << "unknown encoding: " << encoding_name << '\n';
+        return 1;
+    }
+    auto const encoding = encoding_name == "float32" ? taily::Moment_Encoding::float32
+                                                     : taily::Moment_Encoding::log16;
+    int const query_count = argc > 4 ? std::stoi(argv[4]) : 1000;
+    int const ntop = 1000;
+
+    taily::Sharded_Stats_Store exact(argv[1]);
+    std::vector<std::int64_t> const& shard_sizes = exact.shard_sizes();
+    std::int64_t const collection_size = exact.collection_size();
+    if (collection_size == 0) {
+        std::cerr << argv[1] << " does not store shard sizes\n";
+        return 1;
+    }
+    {
+        std::ofstream output(argv[2], std::ios::binary);
+        taily::write_compressed_stats(exact, output, encoding);
+    }
+    taily::Compressed_Stats_Store compressed(argv[2]);
+
+    auto const input_size = std::ifstream(argv[1], std::ios::binary | std::ios::ate).tellg();
+    auto const output_size = std::ifstream(argv[2], std::ios::binary | std::ios::ate).tellg();
+    auto const stats_count = exact.term_count() * (exact.shard_count() + 1);
+    std::cout << "Exact size:      " << input_size << " bytes\n"
+              << "Compressed size: " << output_size << " bytes ("
+              << static_cast<double>(output_size) / std::max<std::size_t>(stats_count, 1)
+              << " bytes per statistic, ratio "
+              << static_cast<double>(input_size) / std::max<std::int64_t>(output_size, 1)
+              << ")\n";
+    if (exact.term_count() == 0) {
+        return 0;
+    }
+
+    std::mt19937 gen(97);
+    std::uniform_int_distribution<std::size_t> term_dist(0, exact.term_count() - 1);
+    std::uniform_int_distribution<std::size_t> length_dist(1, 4);
+    taily::Scoring_Workspace workspace;
+    std::vector<double> exact_scores(exact.shard_count());
+    std::vector<double> compressed_scores(exact.shard_count());
+    double max_error = 0.0;
+    double total_error = 0.0;
+    double max_relative_error = 0.0;
+    for (int query = 0; query < query_count; query++) {
+        std::vector<std::size_t> terms(length_dist(gen));
+        std::generate(terms.begin(), terms.end(), [&] { return term_dist(gen); });
+        taily::score_shards(exact,
+                            nullptr,
+                            terms,
+                            collection_size,
+                            shard_sizes,
+                            ntop,
+                            exact_scores.data(),
+                            workspace);
+        taily::score_shards(compressed,
+                            terms,
+                            collection_size,
+                            shard_sizes,
+                            ntop,
+                            compressed_scores.data(),
+                            workspace);
+        for (std::size_t shard = 0; shard < exact.shard_count(); shard++) {
+            double const error = std::abs(compressed_scores[shard] - exact_scores[shard]);
+            max_error = std::max(max_error, error);
+            total_error += error;
+            if (exact_scores[shard] >= 1.0) {
+                max_relative_error = std::max(max_relative_error, error / exact_scores[shard]);
+            }
+        }
+    }
+    std::cout << "Score deviation over " << query_count << " queries with ntop = " << ntop
+              << ":\n"
+              << "  max absolute:          " << max_error << '\n'
+              << "  mean absolute:         "
+              << total_error / (static_cast<double>(query_count) * exact.shard_count()) << '\n'
+              << "  max relative (>= 1.0): " << max_relative_error << '\n';
+}
@@ -25,38 +25,38 @@
 /// \copyright MIT License
 
 #include <taily.hpp>
+#include <taily/lexicon.hpp>
+#include <taily/stats_store.hpp>
 
 #include <fstream>
 #include <random>
+#include <string>
 #include <vector>
 
-std::vector<std::vector<double>> full_index = {{7, 2, 6, 11, 1, 1, 1, 3, 8, 15},
-                                               {9, 2},
-                                               {11, 7, 14, 15, 12, 2, 11, 5, 5, 15, 4, 10, 4, 10},
-                                               {6, 8, 1, 4, 6},
-                                               {1, 12, 15, 9, 8, 8, 2}};
-
 std::vector<std::vector<std::vector<double>>> shards = {
     {{7, 2, 6}, {9}, {11, 7, 14, 15}, {6}, {}},
     {{11, 1, 1, 1}, {2}, {12, 2, 11, 5, 5, 15, 4, 10}, {8, 1, 4}, {}},
     {{3, 8, 15}, {}, {4, 10}, {6}, {1, 12, 15, 9, 8, 8, 2}}};
 
-void write_stats_for_index(std::vector<std::vector<double>> const& scores,
-                           std::string const& filename)
-{
-    std::ofstream ofs(filename);
-    for (const std::vector<double>& term_scores : scores) {
-        auto term_stats = taily::Feature_Statistics::from_features(term_scores);
-        term_stats.to_stream(ofs);
-    }
-}
+/* Term strings, indexed by term ID */
+std::vector<std::string> terms = {"tail", "shard", "score", "gamma", "query"};
 
 int main(int argc, char** argv)
 {
-    int term_count = full_index.size();
+    int term_count = shards.front().size();
     int shard_count = shards.size();
-    write_stats_for_index(full_index, "full_index.stats");
-    for (int shard = 0; shard < shard_count; shard++) {
-        write_stats_for_index(shards[shard], std::to_string(shard) + ".stats");
+    /* All shards the same size */
+    std::vector<std::int64_t> shard_sizes(shard_count, 10);
+    std::ofstream ofs("index.stats");
+    taily::Sharded_Stats_Writer writer(ofs, term_count, shard_sizes);
+    std::vector<taily::Feature_Statistics> shard_stats(shard_count);
+    for (int term = 0; term < term_count; term++) {
+        for (int shard = 0; shard < shard_count; shard++) {
+            shard_stats[shard] = taily::Feature_Statistics::from_features(shards[shard][term]);
+        }
+        // Global statistics are merged from shards without scanning the full index.
+        writer.write_term(shard_stats);
     }
+    std::ofstream lexicon("index.lexicon");
+    taily::write_lexicon(terms, lexicon);
 }
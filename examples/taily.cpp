@@ -25,60 +25,61 @@
 /// \copyright MIT License
 
 #include <taily.hpp>
+#include <taily/lexicon.hpp>
+#include <taily/scoring_workspace.hpp>
+#include <taily/stats_store.hpp>
 
-#include <fstream>
 #include <iostream>
 #include <random>
+#include <string>
 #include <vector>
 #include <algorithm>
 
 using namespace taily;
 
-[[nodiscard]] auto read_stats(std::vector<int> const& terms, std::string const& file)
-    -> std::vector<Feature_Statistics>
-{
-    std::ifstream ifs(file);
-    std::vector<Feature_Statistics> stats;
-    for (int term : terms) {
-        ifs.seekg(term * Feature_Statistics::struct_size);
-        stats.push_back(Feature_Statistics::from_stream(ifs));
-    }
-    return stats;
-}
-
 int main(int argc, char** argv)
 {
-    int const term_count = 5;
-    int const shard_count = 3;
-    /* All shards the same size */
-    int const shard_size = 10;
-    int const full_size = shard_size * shard_count;
     int const ntop = 50;
     int const query_count = 10;
 
     std::mt19937 gen(97);
     std::uniform_int_distribution<> query_len_dist(1, 3);
+
+    Sharded_Stats_Store store("index.stats");
+    Term_Lexicon lexicon("index.lexicon");
+    /* Collection and shard sizes are stored in the header of the stats file */
+    std::vector<std::int64_t> const& shard_sizes = store.shard_sizes();
+    Scoring_Workspace workspace;
+    std::vector<double> scored_shards(store.shard_count());
+    std::vector<std::size_t> term_ids;
     for (int query = 0; query < query_count; query++) {
-        /* Generate query */
-        std::vector<int> terms = {0, 1, 2, 3, 4};
+        /* Generate query; one of the words is not in the lexicon */
+        std::vector<std::string> terms = {"tail", "shard", "score", "gamma", "query", "unknown"};
 
         std::random_device rd;
         std::mt19937 g(rd());
         std::shuffle(terms.begin(), terms.end(), g);
         terms.resize(query_len_dist(gen));
         std::cout << "Query " << query << " with terms:";
-        for (int term : terms) {
+        for (auto const& term : terms) {
             std::cout << " " << term;
         }
         std::cout << '\n';
 
-        Query_Statistics full_stats{read_stats(terms, "full_index.stats"), full_size};
-        std::vector<Query_Statistics> shard_stats;
-        for (int shard = 0; shard < shard_count; shard++) {
-            Query_Statistics stats{read_stats(terms, std::to_string(shard) + ".stats"), shard_size};
-            shard_stats.push_back(std::move(stats));
-        }
-        auto scored_shards = score_shards(full_stats, shard_stats, ntop);
+        /* Look up term IDs and skip unknown terms */
+        term_ids.resize(terms.size());
+        lexicon.find(terms, term_ids.data());
+        term_ids.erase(std::remove(term_ids.begin(), term_ids.end(), Term_Lexicon::not_found),
+                       term_ids.end());
+
+        score_shards(store,
+                     nullptr,
+                     term_ids,
+                     store.collection_size(),
+                     shard_sizes,
+                     ntop,
+                     scored_shards.data(),
+                     workspace);
         std::cout << "Scores: ";
         for (double score : scored_shards) {
             std::cout << score << " ";
@@ -32,6 +32,9 @@
 #include <functional>
 #include <limits>
 #include <numeric>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <boost/math/distributions/gamma.hpp>
@@ -44,6 +47,11 @@ struct Feature_Statistics {
     double variance;
     std::int64_t frequency;
 
+    /// Sums statistics of different terms, which are assumed independent.
+    ///
+    /// This is how term statistics are combined into query statistics.
+    /// To combine statistics of the same term computed over disjoint parts of
+    /// a collection, such as shards, use `merge_statistics` instead.
     [[nodiscard]] constexpr auto
     operator+(Feature_Statistics const& other) const -> Feature_Statistics
     {
@@ -99,15 +107,180 @@ struct Feature_Statistics {
     }
 };
 
+/// Accumulates feature statistics in a single pass.
+///
+/// Features are added one at a time with Welford's algorithm, so they never
+/// need to be materialized in memory. Accumulators of disjoint sets of
+/// features, e.g., computed by different threads, can be merged exactly
+/// with the parallel formula of Chan et al.
+class Feature_Accumulator {
+public:
+    constexpr Feature_Accumulator() = default;
+
+    /// Constructs an accumulator holding features summarized by `stats`.
+    [[nodiscard]] static constexpr auto from_stats(Feature_Statistics const& stats)
+        -> Feature_Accumulator
+    {
+        Feature_Accumulator accumulator;
+        if (stats.frequency > 0) {
+            accumulator.m_count = stats.frequency;
+            accumulator.m_mean = stats.expected_value;
+            accumulator.m_m2 = stats.variance * stats.frequency;
+        }
+        return accumulator;
+    }
+
+    /// Adds a single feature value.
+    constexpr void add(double feature)
+    {
+        m_count += 1;
+        double const delta = feature - m_mean;
+        m_mean += delta / m_count;
+        m_m2 += delta * (feature - m_mean);
+    }
+
+    /// Adds all features in `[first, last)`.
+    template<typename Input_Iterator>
+    constexpr void add(Input_Iterator first, Input_Iterator last)
+    {
+        for (; first != last; ++first) {
+            add(*first);
+        }
+    }
+
+    /// Merges the features accumulated by `other` into this accumulator.
+    constexpr auto operator+=(Feature_Accumulator const& other) -> Feature_Accumulator&
+    {
+        if (other.m_count == 0) {
+            return *this;
+        }
+        if (m_count == 0) {
+            return *this = other;
+        }
+        std::int64_t const count = m_count + other.m_count;
+        double const delta = other.m_mean - m_mean;
+        m_mean += delta * other.m_count / count;
+        m_m2 += other.m_m2 + delta * delta * m_count / count * other.m_count;
+        m_count = count;
+        return *this;
+    }
+
+    [[nodiscard]] constexpr auto operator+(Feature_Accumulator const& other) const
+        -> Feature_Accumulator
+    {
+        Feature_Accumulator sum = *this;
+        sum += other;
+        return sum;
+    }
+
+    /// Number of accumulated features.
+    [[nodiscard]] constexpr auto count() const -> std::int64_t { return m_count; }
+
+    /// Mean of accumulated features.
+    [[nodiscard]] constexpr auto mean() const -> double { return m_mean; }
+
+    /// Sum of squared differences from the mean.
+    [[nodiscard]] constexpr auto m2() const -> double { return m_m2; }
+
+    /// Returns the statistics of the accumulated features, with the same
+    /// (population) variance as `Feature_Statistics::from_features`.
+    [[nodiscard]] constexpr auto stats() const -> Feature_Statistics
+    {
+        if (m_count == 0) {
+            return Feature_Statistics{0, 0, 0};
+        }
+        return Feature_Statistics{m_mean, m_m2 / m_count, m_count};
+    }
+
+private:
+    std::int64_t m_count = 0;
+    double m_mean = 0.0;
+    double m_m2 = 0.0;
+};
+
+/// Merges statistics of the same term computed over disjoint parts of
+/// a collection, such as shards, into the statistics of the entire collection.
+///
+/// The result is exact: it is equal (up to rounding) to the statistics
+/// computed directly from all features.
+template<typename Input_Iterator>
+[[nodiscard]] constexpr auto merge_statistics(Input_Iterator first, Input_Iterator last)
+    -> Feature_Statistics
+{
+    Feature_Accumulator accumulator;
+    for (; first != last; ++first) {
+        accumulator += Feature_Accumulator::from_stats(*first);
+    }
+    return accumulator.stats();
+}
+
+template<typename Stats_Range>
+[[nodiscard]] constexpr auto merge_statistics(Stats_Range const& stats) -> Feature_Statistics
+{
+    return merge_statistics(std::begin(stats), std::end(stats));
+}
+
 struct Query_Statistics {
     std::vector<Feature_Statistics> term_stats;
     std::int64_t collection_size;
 };
 
+/// Score estimated for a single shard.
+struct Shard_Score {
+    std::size_t shard;
+    double score;
+};
+
+/// Domain in which `any`, `all`, and shard scores are computed.
+enum class Domain {
+    /// Products of probabilities and frequencies, as in the Taily paper. For
+    /// long queries of rare terms, the products underflow to zero.
+    linear,
+    /// Sums of logarithms, which never underflow; shard scores are normalized
+    /// relative to the highest one. Scores that are representable in the
+    /// linear domain agree with it up to rounding.
+    log,
+};
+
+/// Returns the natural logarithm of `any`, computed as a sum of
+/// `log1p(-frequency / collection_size)` over all terms.
+[[nodiscard]] inline auto log_any(Query_Statistics const& stats) -> double
+{
+    double const collection_size = stats.collection_size;
+    double const log_none = std::accumulate(
+        stats.term_stats.begin(),
+        stats.term_stats.end(),
+        0.0,
+        [collection_size](double acc, Feature_Statistics const& stats) {
+            return acc + std::log1p(-double(stats.frequency) / collection_size);
+        });
+    return std::log(collection_size) + std::log(-std::expm1(log_none));
+}
+
+/// Returns the natural logarithm of `all`, computed as a sum of logarithms of
+/// term frequencies; it is negative infinity if `all` is zero.
+[[nodiscard]] inline auto log_all(Query_Statistics const& stats) -> double
+{
+    double const log_any = taily::log_any(stats);
+    if (log_any == -std::numeric_limits<double>::infinity()) {
+        return log_any;
+    }
+    return std::accumulate(stats.term_stats.begin(),
+                           stats.term_stats.end(),
+                           log_any,
+                           [log_any](double acc, Feature_Statistics const& stats) {
+                               return acc + (std::log(double(stats.frequency)) - log_any);
+                           });
+}
+
 /// Estimates the number of documents containing **any** of the terms
 /// represented by `term_stats` in a collection of size `collection_size`.
-[[nodiscard]] inline auto any(Query_Statistics const& stats) -> double
+[[nodiscard]] inline auto any(Query_Statistics const& stats, Domain domain = Domain::linear)
+    -> double
 {
+    if (domain == Domain::log) {
+        return std::exp(log_any(stats));
+    }
     const auto collection_size = stats.collection_size;
     const double any_product = std::accumulate(
         stats.term_stats.begin(),
@@ -121,8 +294,12 @@ struct Query_Statistics {
 
 /// Extimates the number of documents containing **all** of the terms
 /// represented by `term_stats` in a collection of size `collection_size`.
-[[nodiscard]] inline auto all(const Query_Statistics& stats) -> double
+[[nodiscard]] inline auto all(const Query_Statistics& stats, Domain domain = Domain::linear)
+    -> double
 {
+    if (domain == Domain::log) {
+        return std::exp(log_all(stats));
+    }
     double const any = taily::any(stats);
     if (any == 0.0) {
         return 0.0;
@@ -137,14 +314,29 @@ struct Query_Statistics {
     return any * all_product;
 }
 
-/// Returns a gamma distribution fitted to `term_stats`.
-[[nodiscard]] inline auto
-fit_distribution(Feature_Statistics const& query_term_stats) -> boost::math::gamma_distribution<>
+/// Parameters of a gamma distribution.
+struct Gamma_Parameters {
+    double shape;
+    double scale;
+};
+
+/// Returns the parameters of a gamma distribution fitted to `term_stats`
+/// with the method of moments.
+[[nodiscard]] inline auto fit_gamma(Feature_Statistics const& query_term_stats)
+    -> Gamma_Parameters
 {
     double epsilon = std::numeric_limits<double>::epsilon();
     double variance = std::max(epsilon, query_term_stats.variance);
     const double k = std::pow(query_term_stats.expected_value, 2.0) / variance;
     const double theta = variance / query_term_stats.expected_value;
+    return Gamma_Parameters{k, theta};
+}
+
+/// Returns a gamma distribution fitted to `term_stats`.
+[[nodiscard]] inline auto
+fit_distribution(Feature_Statistics const& query_term_stats) -> boost::math::gamma_distribution<>
+{
+    auto const [k, theta] = fit_gamma(query_term_stats);
     return boost::math::gamma_distribution<>(k, theta);
 }
 
@@ -159,22 +351,139 @@ fit_distribution(Feature_Statistics const& query_term_stats) -> boost::math::gam
     return fit_distribution(query_stats);
 }
 
+/// Gamma distribution functions computed with Boost.Math at full precision.
+///
+/// This is the default policy of the functions that evaluate gamma
+/// distributions, such as `estimate_cutoff` and `calculate_cdf`. A policy
+/// must define the static functions below, and may define batch overloads
+/// of `complement_cdf` (see `complement_cdf` below); see `Fast_Gamma` for an
+/// alternative trading precision for speed.
+struct Exact_Gamma {
+    /// Returns the probability that a random variable from `dist` is greater than `x`.
+    [[nodiscard]] static auto complement_cdf(Gamma_Parameters const& dist, double x) -> double
+    {
+        return boost::math::cdf(
+            complement(boost::math::gamma_distribution<>(dist.shape, dist.scale), x));
+    }
+
+    /// Returns `x` such that a random variable from `dist` is greater than `x`
+    /// with probability `p`.
+    [[nodiscard]] static auto complement_quantile(Gamma_Parameters const& dist, double p)
+        -> double
+    {
+        return boost::math::quantile(
+            complement(boost::math::gamma_distribution<>(dist.shape, dist.scale), p));
+    }
+};
+
+namespace detail {
+
+    template<typename Gamma, typename = void>
+    struct has_batch_complement_cdf : std::false_type {
+    };
+
+    template<typename Gamma>
+    struct has_batch_complement_cdf<
+        Gamma,
+        std::void_t<decltype(Gamma::complement_cdf(
+            std::declval<Gamma_Parameters const*>(), std::size_t{}, 0.0, std::declval<double*>()))>>
+        : std::true_type {
+    };
+
+    template<typename Gamma, typename = void>
+    struct has_pointwise_complement_cdf : std::false_type {
+    };
+
+    template<typename Gamma>
+    struct has_pointwise_complement_cdf<
+        Gamma,
+        std::void_t<decltype(Gamma::complement_cdf(std::declval<Gamma_Parameters const*>(),
+                                                   std::size_t{},
+                                                   std::declval<double const*>(),
+                                                   std::declval<double*>()))>>
+        : std::true_type {
+    };
+
+    /// Normalizes shard coefficients given by their logarithms in `scores`
+    /// to sum up to `ntop`, relative to the highest one so that none underflows.
+    inline void normalize_log_scores(double* scores, std::size_t count, int ntop)
+    {
+        double* const last = std::next(scores, count);
+        double const max = count > 0 ? *std::max_element(scores, last)
+                                     : -std::numeric_limits<double>::infinity();
+        if (max == -std::numeric_limits<double>::infinity()) {
+            std::fill(scores, last, 0.0);
+            return;
+        }
+        std::transform(scores, last, scores, [max](double score) { return std::exp(score - max); });
+        double const normalization_factor = std::accumulate(scores, last, 0.0);
+        std::transform(scores, last, scores, [ntop, normalization_factor](double score) {
+            return score * ntop / normalization_factor;
+        });
+    }
+
+}  // namespace detail
+
+/// Computes `Gamma::complement_cdf(dists[i], x)` for `count` distributions
+/// and writes the results to `result`.
+///
+/// If the policy defines a batch overload
+/// `complement_cdf(Gamma_Parameters const*, std::size_t, double, double*)`,
+/// it is used; otherwise, the distributions are evaluated one by one.
+template<typename Gamma = Exact_Gamma>
+void complement_cdf(Gamma_Parameters const* dists, std::size_t count, double x, double* result)
+{
+    if constexpr (detail::has_batch_complement_cdf<Gamma>::value) {
+        Gamma::complement_cdf(dists, count, x, result);
+    } else {
+        for (std::size_t idx = 0; idx < count; idx++) {
+            result[idx] = Gamma::complement_cdf(dists[idx], x);
+        }
+    }
+}
+
+/// Computes `Gamma::complement_cdf(dists[i], x[i])` for `count` distributions,
+/// each at its own point, and writes the results to `result`.
+///
+/// This lets distributions of different queries, with different cutoffs, be
+/// evaluated together. If the policy defines a batch overload
+/// `complement_cdf(Gamma_Parameters const*, std::size_t, double const*, double*)`,
+/// it is used; otherwise, the distributions are evaluated one by one.
+template<typename Gamma = Exact_Gamma>
+void complement_cdf(Gamma_Parameters const* dists,
+                    std::size_t count,
+                    double const* x,
+                    double* result)
+{
+    if constexpr (detail::has_pointwise_complement_cdf<Gamma>::value) {
+        Gamma::complement_cdf(dists, count, x, result);
+    } else {
+        for (std::size_t idx = 0; idx < count; idx++) {
+            result[idx] = Gamma::complement_cdf(dists[idx], x[idx]);
+        }
+    }
+}
+
 /// Estimates the global cutoff score for the entire collection.
-[[nodiscard]] inline auto estimate_cutoff(Query_Statistics const& stats, int ntop) -> double
+template<typename Gamma = Exact_Gamma>
+[[nodiscard]] auto
+estimate_cutoff(Query_Statistics const& stats, int ntop, Domain domain = Domain::linear) -> double
 {
     if (stats.term_stats.empty()) {
         return 0.0;
     }
-    auto const dist = fit_distribution(stats.term_stats);
-    double const all = taily::all(stats);
-    double const p_c = std::min(1.0, ntop / all);
-    return boost::math::quantile(complement(dist, p_c));
+    Feature_Statistics query_stats = std::accumulate(
+        stats.term_stats.begin(), stats.term_stats.end(), Feature_Statistics{0, 0, 0});
+    double const p_c = domain == Domain::linear
+        ? std::min(1.0, ntop / taily::all(stats))
+        : std::min(1.0, std::exp(std::log(double(ntop)) - log_all(stats)));
+    return Gamma::complement_quantile(fit_gamma(query_stats), p_c);
 }
 
 /// Calculates the probability that a document in a shard given by `stats`
 /// has a score higher than `cutoff`.
-[[nodiscard]] inline auto
-calculate_cdf(double const cutoff, Query_Statistics const& stats) -> double
+template<typename Gamma = Exact_Gamma>
+[[nodiscard]] auto calculate_cdf(double const cutoff, Query_Statistics const& stats) -> double
 // [[expects: cutoff >= 0.0]]
 {
     if (cutoff <= 0) {
@@ -185,8 +494,162 @@ calculate_cdf(double const cutoff, Query_Statistics const& stats) -> double
     if (query_stats.expected_value == 0 || query_stats.variance == 0) {
         return 0.0;
     }
-    auto dist = fit_distribution(query_stats);
-    return boost::math::cdf(complement(dist, cutoff));
+    return Gamma::complement_cdf(fit_gamma(query_stats), cutoff);
+}
+
+namespace detail {
+
+    /// Returns the unnormalized score of a shard given by `stats`, or its
+    /// logarithm if `domain` is `Domain::log`.
+    template<typename Gamma>
+    [[nodiscard]] auto
+    shard_coefficient(double const cutoff, Query_Statistics const& stats, Domain domain) -> double
+    {
+        if (domain == Domain::log) {
+            return std::log(calculate_cdf<Gamma>(cutoff, stats)) + taily::log_all(stats);
+        }
+        return calculate_cdf<Gamma>(cutoff, stats) * taily::all(stats);
+    }
+
+    /// Sums up shard coefficients given one at a time, by their logarithms in
+    /// the log domain, and normalizes them to sum up to `ntop`.
+    ///
+    /// In the log domain, the sum is kept relative to the highest coefficient
+    /// seen so far, so that none underflows.
+    class Score_Normalizer {
+    public:
+        Score_Normalizer(Domain domain, int ntop) : m_domain(domain), m_ntop(ntop) {}
+
+        /// Returns true if a shard with coefficient `coef` has a non-zero score.
+        [[nodiscard]] auto nonzero(double coef) const -> bool
+        {
+            return m_domain == Domain::log ? coef > -std::numeric_limits<double>::infinity()
+                                           : coef > 0.0;
+        }
+
+        void add(double coef)
+        {
+            if (m_domain == Domain::linear) {
+                m_sum += coef;
+            } else if (coef > m_max) {
+                m_sum = m_sum * std::exp(m_max - coef) + 1.0;
+                m_max = coef;
+            } else if (nonzero(coef)) {
+                m_sum += std::exp(coef - m_max);
+            }
+        }
+
+        [[nodiscard]] auto nonzero_sum() const -> bool { return m_sum > 0; }
+
+        /// Returns the logarithm of the sum of coefficients added so far.
+        [[nodiscard]] auto log_sum() const -> double
+        {
+            return m_domain == Domain::log ? m_max + std::log(m_sum) : std::log(m_sum);
+        }
+
+        /// Returns the normalized score of a shard with coefficient `coef`.
+        [[nodiscard]] auto operator()(double coef) const -> double
+        {
+            if (!(m_sum > 0)) {
+                return 0.0;
+            }
+            double const linear = m_domain == Domain::log ? std::exp(coef - m_max) : coef;
+            return linear * m_ntop / m_sum;
+        }
+
+    private:
+        Domain m_domain;
+        int m_ntop;
+        double m_sum = 0.0;
+        double m_max = -std::numeric_limits<double>::infinity();
+    };
+
+}  // namespace detail
+
+/// Executor running everything in the calling thread.
+///
+/// An executor must define `for_each_chunk(size, fn)`, which calls
+/// `fn(first, last)` for disjoint chunks covering `[0, size)`, and returns
+/// once all of them are processed. See `Thread_Pool` for a parallel one.
+struct Sequential_Executor {
+    template<typename Fn>
+    void for_each_chunk(std::size_t size, Fn&& fn) const
+    {
+        if (size > 0) {
+            fn(std::size_t{0}, size);
+        }
+    }
+};
+
+/// Scores shards given by `shard_stats` and writes the scores to `scores`,
+/// which must have room for `shard_stats.size()` elements.
+///
+/// Shard coefficients are computed in chunks scheduled by `executor`.
+/// The normalization factor is always summed sequentially in the order of
+/// shards, so the scores are the same regardless of the executor.
+///
+/// \tparam Gamma Policy evaluating gamma distributions, such as `Exact_Gamma`
+/// \param executor Executor running chunks of shards, such as `Thread_Pool`
+/// \param global_stats Term statistics for the entire collection
+/// \param shard_stats Term statistics for individual shards
+/// \param ntop The parameter to Taily algorithm saying how many top results we
+/// are shooting for
+/// \param scores Output shard scores
+/// \param domain Domain of `any` and `all`; `Domain::log` keeps long queries of
+/// rare terms from scoring all shards zero
+template<typename Gamma = Exact_Gamma, typename Executor>
+void score_shards(Executor&& executor,
+                  Query_Statistics const& global_stats,
+                  std::vector<Query_Statistics> const& shard_stats,
+                  int const ntop,
+                  double* scores,
+                  Domain domain = Domain::linear)
+{
+    double const global_cutoff = estimate_cutoff<Gamma>(global_stats, ntop, domain);
+
+    executor.for_each_chunk(shard_stats.size(), [&](std::size_t first, std::size_t last) {
+        std::transform(std::next(std::begin(shard_stats), first),
+                       std::next(std::begin(shard_stats), last),
+                       std::next(scores, first),
+                       [global_cutoff, domain](auto const& shard_stats) {
+                           return detail::shard_coefficient<Gamma>(
+                               global_cutoff, shard_stats, domain);
+                       });
+    });
+
+    if (domain == Domain::log) {
+        detail::normalize_log_scores(scores, shard_stats.size(), ntop);
+        return;
+    }
+    double* const last = std::next(scores, shard_stats.size());
+    double const normalization_factor = std::accumulate(scores, last, 0.0);
+
+    auto normalize = [ntop, normalization_factor](auto const& element) {
+        return normalization_factor > 0 ? element * ntop / normalization_factor : 0.0;
+    };
+    std::transform(scores, last, scores, normalize);
+}
+
+/// Scores shards given by `shard_stats` and writes the scores to `scores`,
+/// which must have room for `shard_stats.size()` elements.
+///
+/// No memory is allocated: the unnormalized shard coefficients are computed
+/// directly in `scores` and then normalized in place.
+///
+/// \param global_stats Term statistics for the entire collection
+/// \param shard_stats Term statistics for individual shards
+/// \param ntop The parameter to Taily algorithm saying how many top results we
+/// are shooting for
+/// \param scores Output shard scores
+/// \param domain Domain of `any` and `all`
+template<typename Gamma = Exact_Gamma>
+void score_shards(Query_Statistics const& global_stats,
+                  std::vector<Query_Statistics> const& shard_stats,
+                  int const ntop,
+                  double* scores,
+                  Domain domain = Domain::linear)
+{
+    score_shards<Gamma>(Sequential_Executor{}, global_stats, shard_stats, ntop, scores, domain);
 }
 
 /// Scores shards given by `shard_stats`.
@@ -195,43 +658,223 @@ calculate_cdf(double const cutoff, Query_Statistics const& stats) -> double
 /// \param shard_stats Term statistics for individual shards
 /// \param ntop The parameter to Taily algorithm saying how many top results we
 /// are shooting for
-[[nodiscard]] inline auto score_shards(Query_Statistics const& global_stats,
-                                       std::vector<Query_Statistics> const& shard_stats,
-                                       int const ntop) -> std::vector<double>
+/// \param domain Domain of `any` and `all`
+template<typename Gamma = Exact_Gamma>
+[[nodiscard]] auto score_shards(Query_Statistics const& global_stats,
+                                std::vector<Query_Statistics> const& shard_stats,
+                                int const ntop,
+                                Domain domain = Domain::linear) -> std::vector<double>
 {
-    int const shard_count = shard_stats.size();
+    std::vector<double> estimates(shard_stats.size());
+    score_shards<Gamma>(global_stats, shard_stats, ntop, estimates.data(), domain);
+    return estimates;
+}
 
-    std::vector<double> shard_all(shard_count);
-    std::transform(std::begin(shard_stats),
-                   std::end(shard_stats),
-                   std::begin(shard_all),
-                   [](auto const& shard_stats) { return taily::all(shard_stats); });
+/// Returns true if `lhs` should be selected before `rhs`: it has a higher
+/// score or, for equal scores, a lower shard ID.
+[[nodiscard]] inline auto selected_before(Shard_Score const& lhs, Shard_Score const& rhs) -> bool
+{
+    return lhs.score > rhs.score || (lhs.score == rhs.score && lhs.shard < rhs.shard);
+}
 
-    double const global_all = all(global_stats);
-    double const global_cutoff = estimate_cutoff(global_stats, ntop);
+/// Selects the `k` shards with the highest scores.
+///
+/// Only a heap of `k` candidates is maintained while shards are scored, so
+/// the full score vector is never materialized or sorted. Shards with
+/// a score of zero are never selected, so fewer than `k` shards may be
+/// returned. The returned scores are equal to those of `score_shards` in the
+/// same domain, up to rounding in the log domain.
+///
+/// \param global_stats Term statistics for the entire collection
+/// \param shard_stats Term statistics for individual shards
+/// \param ntop The parameter to Taily algorithm saying how many top results we
+/// are shooting for
+/// \param k Maximum number of shards to select
+/// \param domain Domain of `any` and `all`
+/// \return Selected shards ordered by descending score
+template<typename Gamma = Exact_Gamma>
+[[nodiscard]] auto select_shards(Query_Statistics const& global_stats,
+                                 std::vector<Query_Statistics> const& shard_stats,
+                                 int const ntop,
+                                 std::size_t const k,
+                                 Domain domain = Domain::linear) -> std::vector<Shard_Score>
+{
+    std::vector<Shard_Score> heap;
+    if (k == 0) {
+        return heap;
+    }
+    heap.reserve(k);
+    double const global_cutoff = estimate_cutoff<Gamma>(global_stats, ntop, domain);
+    detail::Score_Normalizer normalize(domain, ntop);
+    for (std::size_t shard = 0; shard < shard_stats.size(); shard++) {
+        double const coef =
+            detail::shard_coefficient<Gamma>(global_cutoff, shard_stats[shard], domain);
+        normalize.add(coef);
+        if (!normalize.nonzero(coef)) {
+            continue;
+        }
+        Shard_Score candidate{shard, coef};
+        if (heap.size() < k) {
+            heap.push_back(candidate);
+            std::push_heap(heap.begin(), heap.end(), selected_before);
+        } else if (selected_before(candidate, heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), selected_before);
+            heap.back() = candidate;
+            std::push_heap(heap.begin(), heap.end(), selected_before);
+        }
+    }
+    std::sort_heap(heap.begin(), heap.end(), selected_before);
+    for (auto& shard_score : heap) {
+        shard_score.score = normalize(shard_score.score);
+    }
+    return heap;
+}
 
-    std::vector<double> shard_coefs(shard_count);
-    std::transform(std::begin(shard_stats),
-                   std::end(shard_stats),
-                   std::begin(shard_coefs),
-                   std::bind(calculate_cdf, global_cutoff, std::placeholders::_1));
+/// Selects all shards with a score greater than `threshold`.
+///
+/// Only shards with a non-zero score are kept while scoring, so memory is
+/// proportional to the number of candidate shards rather than all shards.
+/// The returned scores are equal to those of `score_shards` in the same
+/// domain, up to rounding in the log domain.
+///
+/// \param global_stats Term statistics for the entire collection
+/// \param shard_stats Term statistics for individual shards
+/// \param ntop The parameter to Taily algorithm saying how many top results we
+/// are shooting for
+/// \param threshold Minimum score (exclusive) of a selected shard
+/// \param domain Domain of `any` and `all`
+/// \return Selected shards ordered by descending score
+template<typename Gamma = Exact_Gamma>
+[[nodiscard]] auto select_shards_above(Query_Statistics const& global_stats,
+                                       std::vector<Query_Statistics> const& shard_stats,
+                                       int const ntop,
+                                       double const threshold,
+                                       Domain domain = Domain::linear) -> std::vector<Shard_Score>
+{
+    double const global_cutoff = estimate_cutoff<Gamma>(global_stats, ntop, domain);
+    detail::Score_Normalizer normalize(domain, ntop);
+    std::vector<Shard_Score> candidates;
+    for (std::size_t shard = 0; shard < shard_stats.size(); shard++) {
+        double const coef =
+            detail::shard_coefficient<Gamma>(global_cutoff, shard_stats[shard], domain);
+        normalize.add(coef);
+        if (normalize.nonzero(coef)) {
+            candidates.push_back(Shard_Score{shard, coef});
+        }
+    }
+    if (!normalize.nonzero_sum()) {
+        return {};
+    }
+    for (auto& shard_score : candidates) {
+        shard_score.score = normalize(shard_score.score);
+    }
+    candidates.erase(std::remove_if(candidates.begin(),
+                                    candidates.end(),
+                                    [threshold](auto const& shard_score) {
+                                        return !(shard_score.score > threshold);
+                                    }),
+                     candidates.end());
+    std::sort(candidates.begin(), candidates.end(), selected_before);
+    return candidates;
+}
 
-    std::transform(std::begin(shard_coefs),
-                   std::end(shard_coefs),
-                   std::begin(shard_all),
-                   std::begin(shard_coefs),
-                   std::multiplies<double>());
+/// Scores shards for a query consisting of a single term, using gamma
+/// distributions fitted in advance, e.g., stored in `Gamma_Parameter_Store`.
+///
+/// The scores are exactly the same as those returned by `score_shards` for
+/// the same query, but no distribution is fitted at query time.
+///
+/// \param global_stats Statistics of the term in the entire collection
+/// \param global_gamma Gamma distribution fitted to `global_stats` with `fit_gamma`
+/// \param collection_size Size of the entire collection
+/// \param shard_stats Statistics of the term in each of `shard_count` shards
+/// \param shard_gammas Gamma distributions fitted to `shard_stats`
+/// \param shard_sizes Sizes of the shards
+/// \param shard_count Number of shards
+/// \param ntop The parameter to Taily algorithm saying how many top results we
+/// are shooting for
+/// \param scores Output shard scores
+template<typename Gamma = Exact_Gamma>
+void score_single_term(Feature_Statistics const& global_stats,
+                       Gamma_Parameters const& global_gamma,
+                       std::int64_t const collection_size,
+                       Feature_Statistics const* shard_stats,
+                       Gamma_Parameters const* shard_gammas,
+                       std::int64_t const* shard_sizes,
+                       std::size_t const shard_count,
+                       int const ntop,
+                       double* scores)
+{
+    // Same operations as `all` performs for a single term.
+    auto single_term_all = [](Feature_Statistics const& stats, std::int64_t collection_size) {
+        double const any_product = 1.0 - double(stats.frequency) / collection_size;
+        double const any = collection_size * (1.0 - any_product);
+        return any == 0.0 ? 0.0 : any * (stats.frequency / any);
+    };
+
+    double const p_c = std::min(1.0, ntop / single_term_all(global_stats, collection_size));
+    double const global_cutoff = Gamma::complement_quantile(global_gamma, p_c);
+
+    for (std::size_t shard = 0; shard < shard_count; shard++) {
+        auto const& stats = shard_stats[shard];
+        double cdf = 1.0;
+        if (global_cutoff > 0) {
+            cdf = stats.expected_value == 0 || stats.variance == 0
+                ? 0.0
+                : Gamma::complement_cdf(shard_gammas[shard], global_cutoff);
+        }
+        scores[shard] = cdf * single_term_all(stats, shard_sizes[shard]);
+    }
 
-    double const normalization_factor = std::accumulate(
-        std::begin(shard_coefs), std::end(shard_coefs), 0.0);
+    double* const last = std::next(scores, shard_count);
+    double const normalization_factor = std::accumulate(scores, last, 0.0);
 
-    std::vector<double> estimates(shard_count);
     auto normalize = [ntop, normalization_factor](auto const& element) {
         return normalization_factor > 0 ? element * ntop / normalization_factor : 0.0;
     };
-    std::transform(
-        std::begin(shard_coefs), std::end(shard_coefs), std::begin(estimates), normalize);
-    return estimates;
+    std::transform(scores, last, scores, normalize);
+}
+
+/// Scores shards for a batch of queries.
+///
+/// The scores are written to `scores` as a row-major matrix of
+/// `global_stats.size()` rows (queries) and `shard_count` columns (shards),
+/// which must be allocated by the caller. Every query must have statistics for
+/// exactly `shard_count` shards.
+///
+/// This is a convenience over scoring each query in turn into its row: nothing
+/// is allocated, but no work is shared between queries, whose statistics are
+/// given separately. To look up each term once and evaluate gamma
+/// distributions of all queries together over a `Sharded_Stats_Store`, use
+/// `score_batch` from `include/taily/scoring_workspace.hpp`.
+///
+/// \param global_stats Term statistics for the entire collection, one per query
+/// \param shard_stats Term statistics for individual shards, one vector per query
+/// \param shard_count Number of shards
+/// \param ntop The parameter to Taily algorithm saying how many top results we
+/// are shooting for
+/// \param scores Output score matrix
+/// \param domain Domain of `any` and `all`
+template<typename Gamma = Exact_Gamma>
+void score_shards(std::vector<Query_Statistics> const& global_stats,
+                  std::vector<std::vector<Query_Statistics>> const& shard_stats,
+                  std::size_t const shard_count,
+                  int const ntop,
+                  double* scores,
+                  Domain domain = Domain::linear)
+{
+    if (global_stats.size() != shard_stats.size()) {
+        throw std::invalid_argument("global and shard stats must be given for the same queries");
+    }
+    for (auto const& query_shard_stats : shard_stats) {
+        if (query_shard_stats.size() != shard_count) {
+            throw std::invalid_argument("every query must have stats for all shards");
+        }
+    }
+    for (std::size_t query = 0; query < global_stats.size(); query++) {
+        score_shards<Gamma>(global_stats[query], shard_stats[query], ntop, scores, domain);
+        scores += shard_count;
+    }
 }
 
 }  // namespace taily
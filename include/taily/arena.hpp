@@ -0,0 +1,115 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace taily {
+
+/// Bump allocator of temporary arrays, reused across queries.
+///
+/// Arrays are carved out of large blocks and are all released at once by
+/// `reset`. If a round of allocations did not fit in a single block, `reset`
+/// replaces all blocks with one big enough for all of them, so once the arena
+/// has seen the largest query, it no longer allocates memory.
+class Arena {
+public:
+    Arena() = default;
+
+    /// Creates an arena with a single block of `capacity` bytes.
+    explicit Arena(std::size_t capacity) { add_block(capacity); }
+
+    /// Returns an uninitialized array of `count` elements, valid until `reset`.
+    template<typename T>
+    [[nodiscard]] auto allocate(std::size_t count) -> T*
+    {
+        static_assert(std::is_trivially_default_constructible_v<T>
+                          && std::is_trivially_destructible_v<T>,
+                      "arena arrays are never constructed nor destroyed");
+        static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned type");
+        std::size_t const size = count * sizeof(T);
+        std::size_t offset = aligned(m_used, alignof(T));
+        if (m_blocks.empty() || offset + size > m_blocks.back().size) {
+            std::size_t const last_size = m_blocks.empty() ? 0 : m_blocks.back().size;
+            add_block(std::max({size, 2 * last_size, min_block_size}));
+            offset = 0;
+        }
+        m_used = offset + size;
+        auto* first = reinterpret_cast<T*>(m_blocks.back().data.get() + offset);
+        std::uninitialized_default_construct_n(first, count);
+        return first;
+    }
+
+    /// Releases all arrays allocated since the last reset.
+    void reset()
+    {
+        if (m_blocks.size() > 1) {
+            std::size_t const total = capacity();
+            m_blocks.clear();
+            add_block(total);
+        }
+        m_used = 0;
+    }
+
+    /// Returns the total size of all blocks in bytes.
+    [[nodiscard]] auto capacity() const -> std::size_t
+    {
+        std::size_t capacity = 0;
+        for (auto const& block : m_blocks) {
+            capacity += block.size;
+        }
+        return capacity;
+    }
+
+private:
+    static constexpr std::size_t min_block_size = 4096;
+
+    struct Block {
+        std::unique_ptr<std::byte[]> data;
+        std::size_t size;
+    };
+
+    [[nodiscard]] static auto aligned(std::size_t offset, std::size_t alignment) -> std::size_t
+    {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    void add_block(std::size_t size)
+    {
+        m_blocks.push_back(Block{std::unique_ptr<std::byte[]>(new std::byte[size]), size});
+        m_used = 0;
+    }
+
+    std::vector<Block> m_blocks{};
+    std::size_t m_used = 0;
+};
+
+}  // namespace taily
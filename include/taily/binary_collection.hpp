@@ -0,0 +1,130 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <taily/stats_store.hpp>
+
+namespace taily {
+
+/// Memory-mapped PISA-style binary collection: a sequence of sequences, each
+/// encoded as its 32-bit length followed by that many values of type `T`.
+template<typename T>
+class Binary_Collection {
+    static_assert(sizeof(T) == sizeof(std::uint32_t), "values must be 32-bit");
+
+public:
+    struct Sequence {
+        T const* first;
+        T const* last;
+
+        [[nodiscard]] auto begin() const -> T const* { return first; }
+        [[nodiscard]] auto end() const -> T const* { return last; }
+        [[nodiscard]] auto size() const -> std::size_t { return last - first; }
+    };
+
+    explicit Binary_Collection(std::string const& filename) : m_file(filename)
+    {
+        if (m_file.size() % sizeof(std::uint32_t) != 0) {
+            throw std::runtime_error(filename + " is not a valid binary collection");
+        }
+        auto const* data = reinterpret_cast<std::uint32_t const*>(m_file.data());
+        std::size_t const length = m_file.size() / sizeof(std::uint32_t);
+        std::size_t pos = 0;
+        while (pos < length) {
+            m_offsets.push_back(pos);
+            pos += std::size_t{data[pos]} + 1;
+        }
+        if (pos != length) {
+            throw std::runtime_error(filename + " is truncated");
+        }
+        m_offsets.push_back(length);
+    }
+
+    /// Returns the number of sequences.
+    [[nodiscard]] auto size() const -> std::size_t { return m_offsets.size() - 1; }
+
+    /// Returns the sequence at position `idx`.
+    [[nodiscard]] auto operator[](std::size_t idx) const -> Sequence
+    {
+        auto const* values = reinterpret_cast<T const*>(m_file.data()) + m_offsets[idx] + 1;
+        return Sequence{values, values + (m_offsets[idx + 1] - m_offsets[idx] - 1)};
+    }
+
+private:
+    Memory_Mapped_File m_file;
+    std::vector<std::size_t> m_offsets{};
+};
+
+/// Collection of posting lists with per-posting scores.
+///
+/// Documents are read from a PISA `.docs` file, whose first sequence holds
+/// only the number of documents, and whose next sequences are document IDs
+/// of consecutive terms. Scores are read from a binary collection of 32-bit
+/// floats with one sequence per term, parallel to the document sequences.
+class Scored_Posting_Collection {
+public:
+    Scored_Posting_Collection(std::string const& documents_file, std::string const& scores_file)
+        : m_documents(documents_file), m_scores(scores_file)
+    {
+        if (m_documents.size() == 0 || m_documents[0].size() != 1) {
+            throw std::runtime_error(documents_file + " does not start with document count");
+        }
+        if (m_scores.size() != term_count()) {
+            throw std::runtime_error("term counts of " + documents_file + " and " + scores_file
+                                     + " differ");
+        }
+    }
+
+    [[nodiscard]] auto term_count() const -> std::size_t { return m_documents.size() - 1; }
+
+    [[nodiscard]] auto document_count() const -> std::size_t { return *m_documents[0].first; }
+
+    /// Returns the document IDs of the postings of `term`.
+    [[nodiscard]] auto documents(std::size_t term) const
+        -> Binary_Collection<std::uint32_t>::Sequence
+    {
+        return m_documents[term + 1];
+    }
+
+    /// Returns the scores of the postings of `term`.
+    [[nodiscard]] auto scores(std::size_t term) const -> Binary_Collection<float>::Sequence
+    {
+        return m_scores[term];
+    }
+
+private:
+    Binary_Collection<std::uint32_t> m_documents;
+    Binary_Collection<float> m_scores;
+};
+
+}  // namespace taily
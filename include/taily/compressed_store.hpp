@@ -0,0 +1,498 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <taily.hpp>
+#include <taily/scoring_workspace.hpp>
+#include <taily/shard_block.hpp>
+#include <taily/stats_store.hpp>
+#include <taily/varint.hpp>
+
+namespace taily {
+
+/// Encoding of expected values and variances in a compressed stats file.
+enum class Moment_Encoding : std::uint64_t {
+    /// 32-bit floats: relative error at most 2^-24 (about 6e-8).
+    float32 = 0,
+    /// 16-bit codes of the base-2 logarithm, evenly spaced in [-32, 32]:
+    /// relative error at most 2^(32 / 65534) - 1 (about 3.4e-4) for values in
+    /// [2^-32, 2^32]; values outside that range are clamped to its ends.
+    log16 = 1,
+};
+
+namespace detail {
+
+    constexpr double log16_min = -32.0;
+    constexpr double log16_step = 64.0 / 65534.0;
+
+    [[nodiscard]] inline auto log16_encode(double value) -> std::uint16_t
+    {
+        if (value == 0.0) {
+            return 0;
+        }
+        double const code = std::round((std::log2(value) - log16_min) / log16_step) + 1;
+        return static_cast<std::uint16_t>(std::clamp(code, 1.0, 65535.0));
+    }
+
+    [[nodiscard]] inline auto log16_decode(std::uint16_t code) -> double
+    {
+        return code == 0 ? 0.0 : std::exp2(log16_min + (code - 1) * log16_step);
+    }
+
+    template<typename T>
+    void write_raw(T value, std::vector<char>& out)
+    {
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    template<typename T>
+    [[nodiscard]] auto read_raw(char const*& pos) -> T
+    {
+        T value;
+        std::memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    inline void encode_moment(double value, Moment_Encoding encoding, std::vector<char>& out)
+    {
+        if (encoding == Moment_Encoding::float32) {
+            write_raw(static_cast<float>(value), out);
+        } else {
+            write_raw(log16_encode(value), out);
+        }
+    }
+
+    [[nodiscard]] inline auto
+    decode_moment(char const*& pos, char const* end, Moment_Encoding encoding) -> double
+    {
+        std::size_t const size =
+            encoding == Moment_Encoding::float32 ? sizeof(float) : sizeof(std::uint16_t);
+        if (static_cast<std::size_t>(end - pos) < size) {
+            throw std::runtime_error("truncated moment");
+        }
+        if (encoding == Moment_Encoding::float32) {
+            return read_raw<float>(pos);
+        }
+        return log16_decode(read_raw<std::uint16_t>(pos));
+    }
+
+    /// Appends the encoding of `stats` to `out`: a varint of the frequency
+    /// shifted left by one, with the lowest bit set if moments follow.
+    inline void encode_stats(Feature_Statistics const& stats,
+                             Moment_Encoding encoding,
+                             std::vector<char>& out)
+    {
+        if (stats.frequency < 0 || stats.expected_value < 0 || stats.variance < 0) {
+            throw std::invalid_argument("cannot compress negative statistics");
+        }
+        bool const has_moments = stats.expected_value != 0 || stats.variance != 0;
+        write_varint(static_cast<std::uint64_t>(stats.frequency) << 1 | (has_moments ? 1 : 0),
+                     out);
+        if (has_moments) {
+            encode_moment(stats.expected_value, encoding, out);
+            encode_moment(stats.variance, encoding, out);
+        }
+    }
+
+    constexpr std::array<char, 8> compressed_magic = {'T', 'A', 'I', 'L', 'Y', 'C', 'M', 'P'};
+
+}  // namespace detail
+
+/// Writes statistics of `store` in the compressed layout read by
+/// `Compressed_Stats_Store`.
+///
+/// The file starts with a `Stats_File_Header` and the shard sizes, like a
+/// sharded stats file, followed by the moment encoding as a 64-bit unsigned
+/// integer, whose checksum is included in the header checksum. Then come
+/// `term_count + 1` 64-bit offsets of term rows relative to the end of the
+/// offsets, the rows, and finally a 64-bit checksum of each block of
+/// `block_terms` consecutive rows. Each row encodes the global statistics and
+/// the statistics in each shard, in the order of `store`: a varint frequency,
+/// followed by the expected value and variance only if either of them is not
+/// zero, which makes the many shards not containing a term take a single byte.
+inline void write_compressed_stats(Sharded_Stats_Store const& store,
+                                   std::ostream& os,
+                                   Moment_Encoding encoding = Moment_Encoding::float32)
+{
+    std::vector<char> buffer;
+    auto encode_row = [&](std::size_t term) {
+        for (std::size_t column = 0; column <= store.shard_count(); column++) {
+            detail::encode_stats(store.row(term)[column], encoding, buffer);
+        }
+    };
+
+    std::size_t const term_count = store.term_count();
+    std::vector<std::uint64_t> offsets(term_count + 1, 0);
+    for (std::size_t term = 0; term < term_count; term++) {
+        buffer.clear();
+        encode_row(term);
+        offsets[term + 1] = offsets[term] + buffer.size();
+    }
+    // Blocks take about as many bytes as those of sharded stats files.
+    std::size_t const mean_row_size =
+        std::max<std::size_t>(1, offsets[term_count] / std::max<std::size_t>(1, term_count));
+    std::size_t const block_terms =
+        std::max<std::size_t>(1, detail::Row_File_Writer::block_bytes / mean_row_size);
+
+    auto const encoding_code = static_cast<std::uint64_t>(encoding);
+    Stats_File_Header header{detail::compressed_magic,
+                             Stats_File_Header::current_version,
+                             Stats_File_Header::native_byte_order,
+                             term_count,
+                             store.shard_count(),
+                             std::accumulate(store.shard_sizes().begin(),
+                                             store.shard_sizes().end(),
+                                             std::int64_t{0}),
+                             block_terms,
+                             0};
+    header.header_checksum = detail::checksum(
+        detail::header_checksum(header, store.shard_sizes().data()), &encoding_code, 8);
+    os.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    os.write(reinterpret_cast<char const*>(store.shard_sizes().data()),
+             store.shard_count() * sizeof(std::int64_t));
+    os.write(reinterpret_cast<char const*>(&encoding_code), sizeof(encoding_code));
+    os.write(reinterpret_cast<char const*>(offsets.data()),
+             offsets.size() * sizeof(std::uint64_t));
+    std::vector<std::uint64_t> checksums;
+    for (std::size_t first = 0; first < term_count; first += block_terms) {
+        buffer.clear();
+        for (std::size_t term = first; term < std::min(term_count, first + block_terms); term++) {
+            encode_row(term);
+        }
+        checksums.push_back(detail::checksum(detail::checksum_seed, buffer.data(), buffer.size()));
+        os.write(buffer.data(), buffer.size());
+    }
+    os.write(reinterpret_cast<char const*>(checksums.data()),
+             checksums.size() * sizeof(std::uint64_t));
+}
+
+/// Memory-mapped statistics of an index and its shards written by
+/// `write_compressed_stats`.
+///
+/// Rows are decoded on access, so the store provides the same query-level
+/// accessors as `Sharded_Stats_Store`, but no references to single statistics.
+/// Frequencies are exact; expected values and variances are approximated
+/// within the bounds of the `Moment_Encoding` used.
+///
+/// Opening a store validates the header and checks that row offsets increase
+/// and stay within the file. Blocks of rows are validated against their
+/// checksums as in `Sharded_Stats_Store`, and decoding never reads past the
+/// end of a row; a `std::runtime_error` is thrown if the file is corrupt.
+class Compressed_Stats_Store {
+public:
+    explicit Compressed_Stats_Store(std::string const& filename,
+                                    Validation validation = Validation::lazy)
+        : m_filename(filename), m_file(filename), m_validation(validation)
+    {
+        Stats_File_Header header{};
+        std::size_t const size = m_file.size();
+        if (size < sizeof(header)) {
+            fail("is too short");
+        }
+        std::memcpy(&header, m_file.data(), sizeof(header));
+        if (header.magic != detail::compressed_magic) {
+            fail("has a wrong magic number");
+        }
+        if (header.byte_order != Stats_File_Header::native_byte_order) {
+            fail("was written on a machine with a different byte order");
+        }
+        if (header.version != Stats_File_Header::current_version) {
+            fail("has unsupported version " + std::to_string(header.version));
+        }
+        // Each count is checked against the file size before it is multiplied.
+        std::size_t const word = sizeof(std::uint64_t);
+        if (header.block_terms == 0 || header.shard_count > (size - sizeof(header)) / word) {
+            fail("has an invalid header");
+        }
+        auto const* shard_sizes =
+            reinterpret_cast<std::int64_t const*>(m_file.data() + sizeof(header));
+        std::size_t const offsets_pos = sizeof(header) + (header.shard_count + 1) * word;
+        if (size < offsets_pos) {
+            fail("has an invalid header");
+        }
+        std::uint64_t encoding_code;
+        std::memcpy(&encoding_code, m_file.data() + offsets_pos - word, word);
+        if (detail::checksum(detail::header_checksum(header, shard_sizes), &encoding_code, word)
+            != header.header_checksum) {
+            fail("has a corrupt header");
+        }
+        if (encoding_code > static_cast<std::uint64_t>(Moment_Encoding::log16)) {
+            fail("has an unknown moment encoding");
+        }
+        m_term_count = header.term_count;
+        m_shard_count = header.shard_count;
+        m_collection_size = header.collection_size;
+        m_block_terms = header.block_terms;
+        m_encoding = static_cast<Moment_Encoding>(encoding_code);
+        m_shard_sizes.assign(shard_sizes, shard_sizes + m_shard_count);
+        if (m_term_count >= (size - offsets_pos) / word) {
+            fail("has a wrong size");
+        }
+        m_block_count = (m_term_count + m_block_terms - 1) / m_block_terms;
+        m_offsets = reinterpret_cast<std::uint64_t const*>(m_file.data() + offsets_pos);
+        m_rows = reinterpret_cast<char const*>(m_offsets + m_term_count + 1);
+        std::size_t const rows_pos = offsets_pos + (m_term_count + 1) * word;
+        if (m_block_count > (size - rows_pos) / word) {
+            fail("has a wrong size");
+        }
+        std::size_t const rows_size = size - rows_pos - m_block_count * word;
+        if (m_offsets[0] != 0 || m_offsets[m_term_count] != rows_size) {
+            fail("has a wrong size");
+        }
+        for (std::size_t term = 0; term < m_term_count; term++) {
+            if (m_offsets[term + 1] < m_offsets[term]) {
+                fail("has decreasing row offsets at term " + std::to_string(term));
+            }
+        }
+        m_checksums = m_rows + rows_size;
+        m_validated = std::make_unique<std::atomic<bool>[]>(m_block_count);
+        if (m_validation == Validation::eager) {
+            validate();
+        }
+    }
+
+    [[nodiscard]] auto term_count() const -> std::size_t { return m_term_count; }
+    [[nodiscard]] auto shard_count() const -> std::size_t { return m_shard_count; }
+    [[nodiscard]] auto encoding() const -> Moment_Encoding { return m_encoding; }
+
+    /// Returns the size of the entire collection, or zero if unknown.
+    [[nodiscard]] auto collection_size() const -> std::int64_t { return m_collection_size; }
+
+    /// Returns the sizes of all shards, which are zeros if unknown.
+    [[nodiscard]] auto shard_sizes() const -> std::vector<std::int64_t> const&
+    {
+        return m_shard_sizes;
+    }
+
+    /// Validates checksums of all rows.
+    ///
+    /// \throws std::runtime_error if any row is corrupt
+    void validate() const
+    {
+        for (std::size_t block = 0; block < m_block_count; block++) {
+            validate_block(block);
+        }
+    }
+
+    /// Returns the size of the encoded row of `term` in bytes.
+    [[nodiscard]] auto row_size(std::size_t term) const -> std::size_t
+    {
+        return m_offsets[checked(term) + 1] - m_offsets[term];
+    }
+
+    /// Decodes the row of `term` and calls `fn(column, stats)` for each of its
+    /// statistics, where column 0 is global and column `s + 1` is shard `s`.
+    template<typename Fn>
+    void decode_row(std::size_t term, Fn&& fn) const
+    {
+        char const* pos = m_rows + m_offsets[checked(term)];
+        char const* end = m_rows + m_offsets[term + 1];
+        for (std::size_t column = 0; column <= m_shard_count; column++) {
+            fn(column, decode_stats(term, pos, end));
+        }
+        if (pos != end) {
+            fail("is corrupt: row of term " + std::to_string(term) + " is too long");
+        }
+    }
+
+    /// Decodes the row of `term` into `row`, which must have room for
+    /// `shard_count() + 1` statistics.
+    void decode_row(std::size_t term, Feature_Statistics* row) const
+    {
+        decode_row(term, [row](std::size_t column, auto const& stats) { row[column] = stats; });
+    }
+
+    /// Returns the statistics of `term` in the entire index.
+    [[nodiscard]] auto global(std::size_t term) const -> Feature_Statistics
+    {
+        char const* pos = m_rows + m_offsets[checked(term)];
+        return decode_stats(term, pos, m_rows + m_offsets[term + 1]);
+    }
+
+    /// Collects global statistics of `terms` into `stats`, reusing its memory.
+    template<typename Term_Range>
+    void global_query_stats(Term_Range const& terms,
+                            std::int64_t collection_size,
+                            Query_Statistics& stats) const
+    {
+        stats.collection_size = collection_size;
+        stats.term_stats.clear();
+        for (auto term : terms) {
+            stats.term_stats.push_back(global(term));
+        }
+    }
+
+    /// Collects global statistics of `terms` for a collection of size `collection_size`.
+    template<typename Term_Range>
+    [[nodiscard]] auto global_query_stats(Term_Range const& terms,
+                                          std::int64_t collection_size) const -> Query_Statistics
+    {
+        Query_Statistics stats{{}, collection_size};
+        global_query_stats(terms, collection_size, stats);
+        return stats;
+    }
+
+private:
+    [[noreturn]] void fail(std::string const& reason) const
+    {
+        throw std::runtime_error(m_filename + " " + reason);
+    }
+
+    [[nodiscard]] auto decode_stats(std::size_t term, char const*& pos, char const* end) const
+        -> Feature_Statistics
+    {
+        try {
+            std::uint64_t const code = detail::read_varint(pos, end);
+            Feature_Statistics stats{0.0, 0.0, static_cast<std::int64_t>(code >> 1)};
+            if ((code & 1) != 0) {
+                stats.expected_value = detail::decode_moment(pos, end, m_encoding);
+                stats.variance = detail::decode_moment(pos, end, m_encoding);
+            }
+            return stats;
+        } catch (std::runtime_error const& error) {
+            fail("is corrupt: row of term " + std::to_string(term) + " has a " + error.what());
+        }
+    }
+
+    /// Checks that `term` is in range and validates its block if validation is
+    /// lazy and it has not been validated yet.
+    [[nodiscard]] auto checked(std::size_t term) const -> std::size_t
+    {
+        if (term >= m_term_count) {
+            throw std::out_of_range("term ID out of range: " + std::to_string(term));
+        }
+        if (m_validation == Validation::lazy) {
+            std::size_t const block = term / m_block_terms;
+            if (!m_validated[block].load(std::memory_order_acquire)) {
+                validate_block(block);
+            }
+        }
+        return term;
+    }
+
+    void validate_block(std::size_t block) const
+    {
+        std::size_t const first = block * m_block_terms;
+        std::size_t const last = std::min(m_term_count, first + m_block_terms);
+        std::uint64_t const actual = detail::checksum(
+            detail::checksum_seed, m_rows + m_offsets[first], m_offsets[last] - m_offsets[first]);
+        std::uint64_t expected;
+        std::memcpy(&expected, m_checksums + block * sizeof(expected), sizeof(expected));
+        if (actual != expected) {
+            fail("is corrupt: checksum mismatch in rows " + std::to_string(first) + " to "
+                 + std::to_string(last - 1));
+        }
+        m_validated[block].store(true, std::memory_order_release);
+    }
+
+    std::string m_filename;
+    Memory_Mapped_File m_file;
+    Validation m_validation;
+    std::size_t m_term_count = 0;
+    std::size_t m_shard_count = 0;
+    std::int64_t m_collection_size = 0;
+    std::size_t m_block_terms = 0;
+    std::size_t m_block_count = 0;
+    Moment_Encoding m_encoding = Moment_Encoding::float32;
+    std::vector<std::int64_t> m_shard_sizes{};
+    std::uint64_t const* m_offsets = nullptr;
+    char const* m_rows = nullptr;
+    char const* m_checksums = nullptr;
+    std::unique_ptr<std::atomic<bool>[]> m_validated{};
+};
+
+/// Loads statistics of `terms` in all shards of a compressed `store` into `block`.
+template<typename Term_Range>
+void load_shard_block(Compressed_Stats_Store const& store,
+                      Term_Range const& terms,
+                      std::vector<std::int64_t> const& shard_sizes,
+                      Shard_Block& block)
+{
+    if (shard_sizes.size() != store.shard_count()) {
+        throw std::invalid_argument("expected " + std::to_string(store.shard_count())
+                                    + " shard sizes but got "
+                                    + std::to_string(shard_sizes.size()));
+    }
+    block.reset(std::size(terms), shard_sizes);
+    std::size_t idx = 0;
+    for (auto term : terms) {
+        store.decode_row(term, [&block, idx](std::size_t column, auto const& stats) {
+            if (column > 0) {
+                block.set(idx, column - 1, stats);
+            }
+        });
+        idx += 1;
+    }
+}
+
+/// Scores all shards of a compressed `store` for a query, collecting
+/// statistics into `workspace` like the `Sharded_Stats_Store` overload.
+template<typename Gamma = Exact_Gamma,
+         typename Term_Range,
+         typename Instrumentation = No_Instrumentation>
+void score_shards(Compressed_Stats_Store const& store,
+                  Term_Range const& terms,
+                  std::int64_t const collection_size,
+                  std::vector<std::int64_t> const& shard_sizes,
+                  int const ntop,
+                  double* scores,
+                  Scoring_Workspace& workspace,
+                  Domain domain = Domain::linear,
+                  Instrumentation&& instrumentation = {})
+{
+    workspace.arena().reset();
+    instrumentation.start(Phase::lookup);
+    store.global_query_stats(terms, collection_size, workspace.global_stats());
+    load_shard_block(store, terms, shard_sizes, workspace.block());
+    instrumentation.stop(Phase::lookup);
+    score_shards<Gamma>(workspace.global_stats(),
+                        workspace.block(),
+                        ntop,
+                        scores,
+                        workspace.arena(),
+                        domain,
+                        std::forward<Instrumentation>(instrumentation));
+}
+
+}  // namespace taily
@@ -0,0 +1,495 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include <taily.hpp>
+#include <taily/scoring_workspace.hpp>
+#include <taily/shard_block.hpp>
+#include <taily/stats_store.hpp>
+
+namespace taily {
+
+/// Header of a delta log file, written by `Delta_Log_Writer`.
+///
+/// The header is followed by any number of `Delta_Record`s appended over time.
+struct Delta_Log_Header {
+    static constexpr std::uint32_t current_version = 1;
+
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint64_t shard_count;
+    /// Checksum of the header with this field set to zero.
+    std::uint64_t header_checksum;
+};
+
+/// A single update in a delta log: features of `term` newly indexed in
+/// `shard`, summarized by `stats`, or, if `term` is `documents_term`,
+/// `stats.frequency` documents newly added to `shard`.
+struct Delta_Record {
+    static constexpr std::uint64_t documents_term = std::numeric_limits<std::uint64_t>::max();
+
+    std::uint64_t term;
+    std::uint64_t shard;
+    Feature_Statistics stats;
+    /// Checksum of the record with this field set to zero.
+    std::uint64_t checksum;
+};
+
+static_assert(std::is_standard_layout_v<Delta_Log_Header> && sizeof(Delta_Log_Header) == 32,
+              "Delta_Log_Header must match its on-disk representation");
+static_assert(std::is_standard_layout_v<Delta_Record> && sizeof(Delta_Record) == 48,
+              "Delta_Record must match its on-disk representation");
+
+namespace detail {
+
+    constexpr std::array<char, 8> delta_magic = {'T', 'A', 'I', 'L', 'Y', 'D', 'L', 'T'};
+
+    template<typename Record>
+    [[nodiscard]] auto record_checksum(Record record, std::uint64_t Record::*field)
+        -> std::uint64_t
+    {
+        record.*field = 0;
+        return checksum(checksum_seed, &record, sizeof(record));
+    }
+
+    [[nodiscard]] inline auto read_delta_header(char const* data,
+                                                std::size_t size,
+                                                std::string const& filename) -> Delta_Log_Header
+    {
+        Delta_Log_Header header{};
+        if (size < sizeof(header)) {
+            throw std::runtime_error("delta log " + filename + " is too short");
+        }
+        std::memcpy(&header, data, sizeof(header));
+        if (header.magic != delta_magic
+            || header.byte_order != Stats_File_Header::native_byte_order
+            || header.version != Delta_Log_Header::current_version
+            || record_checksum(header, &Delta_Log_Header::header_checksum)
+                   != header.header_checksum) {
+            throw std::runtime_error("delta log " + filename + " has an invalid header");
+        }
+        return header;
+    }
+
+    /// Checks that the record at `data` is intact and refers to one of `shard_count` shards.
+    [[nodiscard]] inline auto valid_delta_record(char const* data, std::size_t shard_count)
+        -> bool
+    {
+        Delta_Record record{};
+        std::memcpy(&record, data, sizeof(record));
+        return record_checksum(record, &Delta_Record::checksum) == record.checksum
+               && record.shard < shard_count;
+    }
+
+}  // namespace detail
+
+/// Appends updates of term statistics to a delta log, so that documents newly
+/// added to shards can be reflected without rebuilding the stats file.
+///
+/// Updates are summarized the same way as in `build_sharded_stats`: the
+/// features of a term in a batch of new documents of one shard are collected
+/// in a `Feature_Accumulator` and appended as a single record. Records are
+/// only ever appended, each with its own checksum, so a record torn by a crash
+/// while appending is detected and ignored when the log is read, whether it is
+/// cut short or was extended to full size with garbage.
+class Delta_Log_Writer {
+public:
+    /// Opens the log in `filename` for appending, creating it if it does not
+    /// exist. A partial or corrupt record at the end of an existing log is
+    /// truncated, and a log with a partial header is started anew.
+    ///
+    /// \throws std::runtime_error if an existing log has a different shard count
+    Delta_Log_Writer(std::string const& filename, std::size_t shard_count)
+        : m_shard_count(shard_count)
+    {
+        std::ifstream existing(filename, std::ios::binary | std::ios::ate);
+        std::size_t size = existing ? static_cast<std::size_t>(existing.tellg()) : 0;
+        if (size > 0 && size < sizeof(Delta_Log_Header)) {
+            if (::truncate(filename.c_str(), 0) != 0) {
+                throw std::system_error(
+                    errno, std::generic_category(), "cannot truncate " + filename);
+            }
+            size = 0;
+        }
+        if (size > 0) {
+            std::array<char, sizeof(Delta_Log_Header)> bytes{};
+            existing.seekg(0);
+            existing.read(bytes.data(), std::min(size, bytes.size()));
+            auto header = detail::read_delta_header(bytes.data(), size, filename);
+            if (header.shard_count != shard_count) {
+                throw std::runtime_error("delta log " + filename + " has "
+                                         + std::to_string(header.shard_count) + " shards");
+            }
+            std::size_t complete =
+                size - (size - sizeof(Delta_Log_Header)) % sizeof(Delta_Record);
+            if (complete > sizeof(Delta_Log_Header)) {
+                std::array<char, sizeof(Delta_Record)> last{};
+                existing.seekg(complete - sizeof(Delta_Record));
+                existing.read(last.data(), last.size());
+                if (!detail::valid_delta_record(last.data(), shard_count)) {
+                    complete -= sizeof(Delta_Record);
+                }
+            }
+            if (complete != size && ::truncate(filename.c_str(), complete) != 0) {
+                throw std::system_error(
+                    errno, std::generic_category(), "cannot truncate " + filename);
+            }
+        }
+        m_os.open(filename, std::ios::binary | std::ios::app);
+        if (!m_os) {
+            throw std::runtime_error("cannot open delta log " + filename);
+        }
+        if (size == 0) {
+            Delta_Log_Header header{detail::delta_magic,
+                                    Delta_Log_Header::current_version,
+                                    Stats_File_Header::native_byte_order,
+                                    shard_count,
+                                    0};
+            header.header_checksum =
+                detail::record_checksum(header, &Delta_Log_Header::header_checksum);
+            m_os.write(reinterpret_cast<char const*>(&header), sizeof(header));
+        }
+    }
+
+    [[nodiscard]] auto shard_count() const -> std::size_t { return m_shard_count; }
+
+    /// Appends features of `term` newly indexed in `shard`.
+    void add(std::size_t term, std::size_t shard, Feature_Accumulator const& features)
+    {
+        if (features.count() > 0) {
+            append(term, shard, features.stats());
+        }
+    }
+
+    /// Appends `count` documents newly added to `shard`.
+    void add_documents(std::size_t shard, std::int64_t count)
+    {
+        append(Delta_Record::documents_term, shard, Feature_Statistics{0.0, 0.0, count});
+    }
+
+    /// Flushes appended records to the file.
+    void flush() { m_os.flush(); }
+
+private:
+    void append(std::uint64_t term, std::size_t shard, Feature_Statistics const& stats)
+    {
+        if (shard >= m_shard_count) {
+            throw std::out_of_range("shard ID out of range: " + std::to_string(shard));
+        }
+        Delta_Record record{term, shard, stats, 0};
+        record.checksum = detail::record_checksum(record, &Delta_Record::checksum);
+        m_os.write(reinterpret_cast<char const*>(&record), sizeof(record));
+    }
+
+    std::size_t m_shard_count;
+    std::ofstream m_os{};
+};
+
+/// All updates of a delta log, merged per (term, shard).
+class Stats_Delta {
+public:
+    /// Reads and merges all records of the log in `filename`.
+    ///
+    /// A partial or corrupt record at the end, left by an interrupted append,
+    /// is ignored.
+    ///
+    /// \throws std::runtime_error if the header or any record but the last is corrupt
+    explicit Stats_Delta(std::string const& filename)
+    {
+        Memory_Mapped_File file(filename);
+        auto header = detail::read_delta_header(file.data(), file.size(), filename);
+        m_shard_count = header.shard_count;
+        m_documents.assign(m_shard_count, 0);
+        m_record_count = (file.size() - sizeof(header)) / sizeof(Delta_Record);
+        char const* records = file.data() + sizeof(header);
+        if (m_record_count > 0
+            && !detail::valid_delta_record(records + (m_record_count - 1) * sizeof(Delta_Record),
+                                           m_shard_count)) {
+            m_record_count--;
+        }
+        for (std::size_t idx = 0; idx < m_record_count; idx++) {
+            if (!detail::valid_delta_record(records + idx * sizeof(Delta_Record), m_shard_count)) {
+                throw std::runtime_error("delta log " + filename + " is corrupt: bad record "
+                                         + std::to_string(idx));
+            }
+            Delta_Record record{};
+            std::memcpy(&record, records + idx * sizeof(record), sizeof(record));
+            apply(record);
+        }
+    }
+
+    [[nodiscard]] auto shard_count() const -> std::size_t { return m_shard_count; }
+
+    /// Number of records read from the log.
+    [[nodiscard]] auto record_count() const -> std::size_t { return m_record_count; }
+
+    /// Returns one past the largest term ID updated by the log.
+    [[nodiscard]] auto term_bound() const -> std::size_t { return m_term_bound; }
+
+    /// Returns the numbers of documents added to each shard.
+    [[nodiscard]] auto documents() const -> std::vector<std::int64_t> const&
+    {
+        return m_documents;
+    }
+
+    /// Returns the IDs of all updated terms, in no particular order.
+    [[nodiscard]] auto terms() const -> std::vector<std::size_t>
+    {
+        std::vector<std::size_t> terms;
+        terms.reserve(m_terms.size());
+        for (auto const& [term, accumulators] : m_terms) {
+            terms.push_back(term);
+        }
+        return terms;
+    }
+
+    /// Returns the accumulated features of `term` in each shard, or `nullptr`
+    /// if the log does not update `term`.
+    [[nodiscard]] auto find(std::size_t term) const -> Feature_Accumulator const*
+    {
+        auto pos = m_terms.find(term);
+        return pos == m_terms.end() ? nullptr : pos->second.data();
+    }
+
+private:
+    void apply(Delta_Record const& record)
+    {
+        if (record.term == Delta_Record::documents_term) {
+            m_documents[record.shard] += record.stats.frequency;
+            return;
+        }
+        auto& accumulators = m_terms[record.term];
+        accumulators.resize(m_shard_count);
+        accumulators[record.shard] += Feature_Accumulator::from_stats(record.stats);
+        m_term_bound = std::max(m_term_bound, static_cast<std::size_t>(record.term) + 1);
+    }
+
+    std::size_t m_shard_count = 0;
+    std::size_t m_record_count = 0;
+    std::size_t m_term_bound = 0;
+    std::vector<std::int64_t> m_documents{};
+    std::unordered_map<std::size_t, std::vector<Feature_Accumulator>> m_terms{};
+};
+
+/// A `Sharded_Stats_Store` with the updates of a `Stats_Delta` applied.
+///
+/// Rows of updated terms are merged once, when the overlay is created, and
+/// kept in memory; all other rows are read from the base store, which must
+/// outlive the overlay. Terms first introduced by the delta, with IDs beyond
+/// those of the base store, extend the term range.
+class Overlaid_Stats_Store {
+public:
+    /// \throws std::invalid_argument if the shard counts of `base` and `delta` differ
+    Overlaid_Stats_Store(Sharded_Stats_Store const& base, Stats_Delta const& delta)
+        : m_base(base),
+          m_term_count(std::max(base.term_count(), delta.term_bound())),
+          m_shard_count(base.shard_count()),
+          m_shard_sizes(base.shard_sizes()),
+          m_empty_row(m_shard_count + 1, Feature_Statistics{0.0, 0.0, 0})
+    {
+        if (delta.shard_count() != m_shard_count) {
+            throw std::invalid_argument("delta has " + std::to_string(delta.shard_count())
+                                        + " shards but the store has "
+                                        + std::to_string(m_shard_count));
+        }
+        for (std::size_t shard = 0; shard < m_shard_count; shard++) {
+            m_shard_sizes[shard] += delta.documents()[shard];
+        }
+        m_collection_size =
+            std::accumulate(m_shard_sizes.begin(), m_shard_sizes.end(), std::int64_t{0});
+        auto terms = delta.terms();
+        std::sort(terms.begin(), terms.end());
+        m_rows.resize(terms.size() * (m_shard_count + 1));
+        for (std::size_t idx = 0; idx < terms.size(); idx++) {
+            Feature_Statistics const* base_row =
+                terms[idx] < base.term_count() ? base.row(terms[idx]) : m_empty_row.data();
+            Feature_Accumulator const* updates = delta.find(terms[idx]);
+            Feature_Statistics* row = m_rows.data() + idx * (m_shard_count + 1);
+            Feature_Accumulator global;
+            for (std::size_t shard = 0; shard < m_shard_count; shard++) {
+                auto merged = Feature_Accumulator::from_stats(base_row[shard + 1]) + updates[shard];
+                row[shard + 1] = merged.stats();
+                global += merged;
+            }
+            row[0] = global.stats();
+            m_updated.emplace(terms[idx], idx);
+        }
+    }
+
+    [[nodiscard]] auto term_count() const -> std::size_t { return m_term_count; }
+    [[nodiscard]] auto shard_count() const -> std::size_t { return m_shard_count; }
+
+    /// Returns the size of the entire collection, including added documents.
+    [[nodiscard]] auto collection_size() const -> std::int64_t { return m_collection_size; }
+
+    /// Returns the sizes of all shards, including added documents.
+    [[nodiscard]] auto shard_sizes() const -> std::vector<std::int64_t> const&
+    {
+        return m_shard_sizes;
+    }
+
+    /// Returns the number of terms whose rows differ from the base store.
+    [[nodiscard]] auto updated_term_count() const -> std::size_t { return m_updated.size(); }
+
+    /// Returns a pointer to the row of `term`, laid out like the rows of `Sharded_Stats_Store`.
+    [[nodiscard]] auto row(std::size_t term) const -> Feature_Statistics const*
+    {
+        if (term >= m_term_count) {
+            throw std::out_of_range("term ID out of range: " + std::to_string(term));
+        }
+        if (auto pos = m_updated.find(term); pos != m_updated.end()) {
+            return m_rows.data() + pos->second * (m_shard_count + 1);
+        }
+        return term < m_base.term_count() ? m_base.row(term) : m_empty_row.data();
+    }
+
+    /// Returns the statistics of `term` in the entire index.
+    [[nodiscard]] auto global(std::size_t term) const -> Feature_Statistics const&
+    {
+        return row(term)[0];
+    }
+
+    /// Collects global statistics of `terms` into `stats`, reusing its memory.
+    template<typename Term_Range>
+    void global_query_stats(Term_Range const& terms,
+                            std::int64_t collection_size,
+                            Query_Statistics& stats) const
+    {
+        stats.collection_size = collection_size;
+        stats.term_stats.clear();
+        for (auto term : terms) {
+            stats.term_stats.push_back(global(term));
+        }
+    }
+
+    /// Collects global statistics of `terms` for a collection of size `collection_size`.
+    template<typename Term_Range>
+    [[nodiscard]] auto global_query_stats(Term_Range const& terms,
+                                          std::int64_t collection_size) const -> Query_Statistics
+    {
+        Query_Statistics stats{{}, collection_size};
+        global_query_stats(terms, collection_size, stats);
+        return stats;
+    }
+
+private:
+    Sharded_Stats_Store const& m_base;
+    std::size_t m_term_count;
+    std::size_t m_shard_count;
+    std::vector<std::int64_t> m_shard_sizes;
+    std::int64_t m_collection_size = 0;
+    std::vector<Feature_Statistics> m_empty_row;
+    std::vector<Feature_Statistics> m_rows{};
+    std::unordered_map<std::size_t, std::size_t> m_updated{};
+};
+
+/// Compacts a delta log into its base store by writing all rows of `store`,
+/// with their current shard sizes, as a new sharded stats file to `os`.
+///
+/// Once the new file replaces the base store, the delta log can be removed.
+inline void write_compacted_stats(Overlaid_Stats_Store const& store, std::ostream& os)
+{
+    Sharded_Stats_Writer writer(os, store.term_count(), store.shard_sizes());
+    for (std::size_t term = 0; term < store.term_count(); term++) {
+        writer.write_rows(store.row(term), 1);
+    }
+}
+
+/// Loads statistics of `terms` in all shards of an overlaid `store` into `block`.
+template<typename Term_Range>
+void load_shard_block(Overlaid_Stats_Store const& store,
+                      Term_Range const& terms,
+                      std::vector<std::int64_t> const& shard_sizes,
+                      Shard_Block& block)
+{
+    if (shard_sizes.size() != store.shard_count()) {
+        throw std::invalid_argument("expected " + std::to_string(store.shard_count())
+                                    + " shard sizes but got "
+                                    + std::to_string(shard_sizes.size()));
+    }
+    block.reset(std::size(terms), shard_sizes);
+    std::size_t idx = 0;
+    for (auto term : terms) {
+        Feature_Statistics const* row = store.row(term) + 1;
+        for (std::size_t shard = 0; shard < store.shard_count(); shard++) {
+            block.set(idx, shard, row[shard]);
+        }
+        idx += 1;
+    }
+}
+
+/// Scores all shards of an overlaid `store` for a query, collecting
+/// statistics into `workspace` like the `Sharded_Stats_Store` overload.
+template<typename Gamma = Exact_Gamma,
+         typename Term_Range,
+         typename Instrumentation = No_Instrumentation>
+void score_shards(Overlaid_Stats_Store const& store,
+                  Term_Range const& terms,
+                  std::int64_t const collection_size,
+                  std::vector<std::int64_t> const& shard_sizes,
+                  int const ntop,
+                  double* scores,
+                  Scoring_Workspace& workspace,
+                  Domain domain = Domain::linear,
+                  Instrumentation&& instrumentation = {})
+{
+    workspace.arena().reset();
+    instrumentation.start(Phase::lookup);
+    store.global_query_stats(terms, collection_size, workspace.global_stats());
+    load_shard_block(store, terms, shard_sizes, workspace.block());
+    instrumentation.stop(Phase::lookup);
+    score_shards<Gamma>(workspace.global_stats(),
+                        workspace.block(),
+                        ntop,
+                        scores,
+                        workspace.arena(),
+                        domain,
+                        std::forward<Instrumentation>(instrumentation));
+}
+
+}  // namespace taily
@@ -0,0 +1,237 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace taily {
+
+/// Phases of scoring shards for a query, timed by an instrumentation.
+enum class Phase : std::size_t {
+    /// Collecting statistics of query terms from a store.
+    lookup,
+    /// Finding shards containing all query terms and gathering their statistics.
+    candidates,
+    /// Computing `all` of every shard.
+    all,
+    /// Estimating the global cutoff score with a gamma quantile.
+    cutoff,
+    /// Fitting and evaluating gamma distributions of shards.
+    cdf,
+    /// Normalizing shard scores.
+    normalization,
+};
+
+/// Events counted for each query by an instrumentation.
+enum class Counter : std::size_t {
+    /// Shards whose gamma distribution was evaluated.
+    shards_evaluated,
+    /// Shards scored without evaluating a gamma distribution, such as those
+    /// not containing all query terms.
+    shards_skipped,
+    /// Evaluations of gamma CDFs and quantiles, with Boost.Math for `Exact_Gamma`.
+    gamma_evaluations,
+};
+
+constexpr std::size_t phase_count = 6;
+constexpr std::size_t counter_count = 3;
+
+[[nodiscard]] constexpr auto to_string(Phase phase) -> char const*
+{
+    constexpr std::array<char const*, phase_count> names = {
+        "lookup", "candidates", "all", "cutoff", "cdf", "normalization"};
+    return names[static_cast<std::size_t>(phase)];
+}
+
+[[nodiscard]] constexpr auto to_string(Counter counter) -> char const*
+{
+    constexpr std::array<char const*, counter_count> names = {
+        "shards_evaluated", "shards_skipped", "gamma_evaluations"};
+    return names[static_cast<std::size_t>(counter)];
+}
+
+/// Instrumentation recording nothing, the default of scoring functions.
+///
+/// An instrumentation must define `start(Phase)` and `stop(Phase)`, called
+/// around each phase of a query, and `count(Counter, std::size_t)`, called
+/// once per query for each counter. All of them are empty here, so with this
+/// instrumentation, scoring compiles to the same code as without any.
+struct No_Instrumentation {
+    void start(Phase /* phase */) {}
+    void stop(Phase /* phase */) {}
+    void count(Counter /* counter */, std::size_t /* value */) {}
+};
+
+/// Histogram of non-negative integers in power-of-two buckets: bucket 0
+/// counts zeros, and bucket `b > 0` counts values in `[2^(b-1), 2^b)`.
+class Log2_Histogram {
+public:
+    static constexpr std::size_t bucket_count = 65;
+
+    void record(std::uint64_t value)
+    {
+        m_buckets[bucket_of(value)] += 1;
+        m_count += 1;
+        m_sum += value;
+    }
+
+    /// Returns the index of the bucket counting `value`.
+    [[nodiscard]] static constexpr auto bucket_of(std::uint64_t value) -> std::size_t
+    {
+        std::size_t bucket = 0;
+        for (; value > 0; value >>= 1U) {
+            bucket += 1;
+        }
+        return bucket;
+    }
+
+    /// Returns the smallest value counted by `bucket`.
+    [[nodiscard]] static constexpr auto lower_bound(std::size_t bucket) -> std::uint64_t
+    {
+        return bucket == 0 ? 0 : std::uint64_t{1} << (bucket - 1);
+    }
+
+    [[nodiscard]] auto bucket(std::size_t bucket) const -> std::uint64_t
+    {
+        return m_buckets[bucket];
+    }
+    [[nodiscard]] auto count() const -> std::uint64_t { return m_count; }
+    [[nodiscard]] auto sum() const -> std::uint64_t { return m_sum; }
+
+    /// Returns an upper bound of the `q`-quantile of recorded values: the
+    /// largest value of the bucket containing it.
+    [[nodiscard]] auto quantile(double q) const -> std::uint64_t
+    {
+        auto const rank = static_cast<std::uint64_t>(q * m_count);
+        std::uint64_t seen = 0;
+        for (std::size_t bucket = 0; bucket < bucket_count; bucket++) {
+            seen += m_buckets[bucket];
+            if (seen > rank || seen == m_count) {
+                return bucket == 0 ? 0 : (lower_bound(bucket) << 1U) - 1;
+            }
+        }
+        return 0;
+    }
+
+    auto operator+=(Log2_Histogram const& other) -> Log2_Histogram&
+    {
+        for (std::size_t bucket = 0; bucket < bucket_count; bucket++) {
+            m_buckets[bucket] += other.m_buckets[bucket];
+        }
+        m_count += other.m_count;
+        m_sum += other.m_sum;
+        return *this;
+    }
+
+private:
+    std::array<std::uint64_t, bucket_count> m_buckets{};
+    std::uint64_t m_count = 0;
+    std::uint64_t m_sum = 0;
+};
+
+/// Instrumentation recording the latency of each phase, in nanoseconds, and
+/// the value of each counter per query as histograms.
+///
+/// A recorder is not thread-safe: use one per thread and merge them with `+=`.
+class Latency_Recorder {
+public:
+    using clock = std::chrono::steady_clock;
+
+    void start(Phase phase) { m_started[static_cast<std::size_t>(phase)] = clock::now(); }
+
+    void stop(Phase phase)
+    {
+        auto const elapsed = clock::now() - m_started[static_cast<std::size_t>(phase)];
+        m_phases[static_cast<std::size_t>(phase)].record(static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+
+    void count(Counter counter, std::size_t value)
+    {
+        m_counters[static_cast<std::size_t>(counter)].record(value);
+    }
+
+    /// Returns the histogram of latencies of `phase` in nanoseconds.
+    [[nodiscard]] auto phase(Phase phase) const -> Log2_Histogram const&
+    {
+        return m_phases[static_cast<std::size_t>(phase)];
+    }
+
+    /// Returns the histogram of per-query values of `counter`.
+    [[nodiscard]] auto counter(Counter counter) const -> Log2_Histogram const&
+    {
+        return m_counters[static_cast<std::size_t>(counter)];
+    }
+
+    auto operator+=(Latency_Recorder const& other) -> Latency_Recorder&
+    {
+        for (std::size_t phase = 0; phase < phase_count; phase++) {
+            m_phases[phase] += other.m_phases[phase];
+        }
+        for (std::size_t counter = 0; counter < counter_count; counter++) {
+            m_counters[counter] += other.m_counters[counter];
+        }
+        return *this;
+    }
+
+    /// Writes all non-empty buckets as CSV lines `name,lower_bound,count`,
+    /// preceded by a header line. Phase names end with `_ns`.
+    void write_histograms(std::ostream& os) const
+    {
+        os << "name,lower_bound,count\n";
+        for (std::size_t phase = 0; phase < phase_count; phase++) {
+            write_histogram(
+                os, std::string(to_string(static_cast<Phase>(phase))) + "_ns", m_phases[phase]);
+        }
+        for (std::size_t counter = 0; counter < counter_count; counter++) {
+            write_histogram(os, to_string(static_cast<Counter>(counter)), m_counters[counter]);
+        }
+    }
+
+private:
+    static void
+    write_histogram(std::ostream& os, std::string const& name, Log2_Histogram const& histogram)
+    {
+        for (std::size_t bucket = 0; bucket < Log2_Histogram::bucket_count; bucket++) {
+            if (histogram.bucket(bucket) > 0) {
+                os << name << ',' << Log2_Histogram::lower_bound(bucket) << ','
+                   << histogram.bucket(bucket) << '\n';
+            }
+        }
+    }
+
+    std::array<clock::time_point, phase_count> m_started{};
+    std::array<Log2_Histogram, phase_count> m_phases{};
+    std::array<Log2_Histogram, counter_count> m_counters{};
+};
+
+}  // namespace taily
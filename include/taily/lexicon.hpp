@@ -0,0 +1,470 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <taily/stats_store.hpp>
+#include <taily/varint.hpp>
+
+namespace taily {
+
+/// Header of lexicon files.
+///
+/// All fields are in the byte order of the machine that wrote the file, which
+/// is identified by `byte_order`, as in `Stats_File_Header`.
+struct Lexicon_File_Header {
+    static constexpr std::uint32_t current_version = 2;
+
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint64_t term_count;
+    std::uint64_t bucket_size;
+    /// Number of buckets covered by each block checksum.
+    std::uint64_t block_buckets;
+    /// One if term IDs follow the sorted order of terms and are not stored.
+    std::uint64_t sorted_ids;
+    /// Checksum of the header, with this field set to zero.
+    std::uint64_t header_checksum;
+};
+
+static_assert(std::is_standard_layout_v<Lexicon_File_Header>
+                  && sizeof(Lexicon_File_Header) == 56,
+              "Lexicon_File_Header must match its on-disk representation");
+
+namespace detail {
+
+    constexpr std::array<char, 8> lexicon_magic = {'T', 'A', 'I', 'L', 'Y', 'L', 'E', 'X'};
+
+    /// Checksum of the buckets `first` to `last - 1` of a lexicon: their
+    /// offsets, including the end offset of the last one, the IDs of their
+    /// terms, if stored, and their bytes.
+    [[nodiscard]] inline auto lexicon_block_checksum(std::uint64_t const* offsets,
+                                                     std::uint32_t const* ids,
+                                                     char const* buckets,
+                                                     std::size_t first,
+                                                     std::size_t last,
+                                                     std::size_t bucket_size,
+                                                     std::size_t term_count) -> std::uint64_t
+    {
+        std::uint64_t state = checksum(
+            checksum_seed, offsets + first, (last - first + 1) * sizeof(std::uint64_t));
+        if (ids != nullptr) {
+            std::size_t const first_term = first * bucket_size;
+            std::size_t const last_term = std::min(last * bucket_size, term_count);
+            state = checksum(state, ids + first_term, (last_term - first_term) * sizeof(*ids));
+        }
+        return checksum(state, buckets + offsets[first], offsets[last] - offsets[first]);
+    }
+
+}  // namespace detail
+
+/// Writes a lexicon of `terms`, where `terms[id]` is the term with ID `id`,
+/// in the layout read by `Term_Lexicon`.
+///
+/// Terms are sorted and front-coded in buckets of `bucket_size`: each term is
+/// written as a varint length of the prefix shared with the previous term,
+/// a varint length of the remaining suffix, and the suffix; the first term
+/// of each bucket shares nothing. The file starts with a `Lexicon_File_Header`,
+/// followed by `bucket_count + 1` 64-bit offsets of buckets, then (unless IDs
+/// follow the sorted order) the 32-bit ID of each sorted term, padded to 8
+/// bytes, then the buckets, and finally one 64-bit checksum per block of
+/// `block_buckets` buckets.
+///
+/// \throws std::invalid_argument if a term occurs more than once
+template<typename String_Range>
+void write_lexicon(String_Range const& terms,
+                   std::ostream& os,
+                   std::size_t bucket_size = 16,
+                   std::size_t block_buckets = 256)
+{
+    std::vector<std::string_view> views(std::begin(terms), std::end(terms));
+    if (views.size() > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::invalid_argument("too many terms for a lexicon");
+    }
+    if (bucket_size == 0) {
+        throw std::invalid_argument("bucket size must be positive");
+    }
+    if (block_buckets == 0) {
+        throw std::invalid_argument("block size must be positive");
+    }
+    std::vector<std::uint32_t> ids(views.size());
+    std::iota(ids.begin(), ids.end(), 0);
+    std::sort(ids.begin(), ids.end(), [&views](auto lhs, auto rhs) {
+        return views[lhs] < views[rhs];
+    });
+    for (std::size_t pos = 1; pos < ids.size(); pos++) {
+        if (views[ids[pos - 1]] == views[ids[pos]]) {
+            throw std::invalid_argument("duplicate term: " + std::string(views[ids[pos]]));
+        }
+    }
+    bool const sorted_ids = std::is_sorted(ids.begin(), ids.end());
+
+    std::vector<char> buckets;
+    std::vector<std::uint64_t> offsets;
+    for (std::size_t pos = 0; pos < ids.size(); pos++) {
+        std::string_view const term = views[ids[pos]];
+        std::size_t shared = 0;
+        if (pos % bucket_size == 0) {
+            offsets.push_back(buckets.size());
+        } else {
+            std::string_view const previous = views[ids[pos - 1]];
+            auto const limit = std::min(term.size(), previous.size());
+            while (shared < limit && term[shared] == previous[shared]) {
+                shared += 1;
+            }
+        }
+        detail::write_varint(shared, buckets);
+        detail::write_varint(term.size() - shared, buckets);
+        buckets.insert(buckets.end(), term.begin() + shared, term.end());
+    }
+    offsets.push_back(buckets.size());
+
+    if (sorted_ids) {
+        ids.clear();
+    }
+    std::size_t const bucket_count = offsets.size() - 1;
+    std::vector<std::uint64_t> checksums;
+    for (std::size_t first = 0; first < bucket_count; first += block_buckets) {
+        checksums.push_back(detail::lexicon_block_checksum(offsets.data(),
+                                                           sorted_ids ? nullptr : ids.data(),
+                                                           buckets.data(),
+                                                           first,
+                                                           std::min(first + block_buckets,
+                                                                    bucket_count),
+                                                           bucket_size,
+                                                           views.size()));
+    }
+    ids.resize(ids.size() + ids.size() % 2, 0);
+    Lexicon_File_Header header{detail::lexicon_magic,
+                               Lexicon_File_Header::current_version,
+                               Stats_File_Header::native_byte_order,
+                               views.size(),
+                               bucket_size,
+                               block_buckets,
+                               sorted_ids ? 1U : 0U,
+                               0};
+    header.header_checksum = detail::checksum(detail::checksum_seed, &header, sizeof(header));
+    os.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    os.write(reinterpret_cast<char const*>(offsets.data()),
+             offsets.size() * sizeof(std::uint64_t));
+    os.write(reinterpret_cast<char const*>(ids.data()), ids.size() * sizeof(std::uint32_t));
+    os.write(buckets.data(), buckets.size());
+    os.write(reinterpret_cast<char const*>(checksums.data()),
+             checksums.size() * sizeof(std::uint64_t));
+}
+
+/// Memory-mapped dictionary of term strings, written by `write_lexicon`,
+/// mapping terms to the IDs of their rows in a stats store.
+///
+/// A lookup binary searches the first terms of buckets, which are stored
+/// uncompressed, and then decodes at most one bucket, comparing the front-coded
+/// terms with the searched one without reconstructing them, so it touches a
+/// single bucket of memory besides the search path, and never allocates.
+///
+/// Opening a lexicon validates only the header and the file size, in time
+/// independent of the number of terms. As in `Sharded_Stats_Store`, blocks of
+/// buckets are validated according to `Validation`: their checksums are
+/// compared, and their offsets, varint lengths, and term IDs are checked to be
+/// in bounds, so that decoding needs no checks. With `Validation::none`, only
+/// checksums are skipped. A `std::runtime_error` is thrown, by the constructor
+/// or by `find`, if the file is corrupt.
+class Term_Lexicon {
+public:
+    /// Returned by the batch `find` for terms that are not in the lexicon.
+    static constexpr std::size_t not_found = std::numeric_limits<std::size_t>::max();
+
+    explicit Term_Lexicon(std::string const& filename, Validation validation = Validation::lazy)
+        : m_filename(filename), m_file(filename), m_validation(validation)
+    {
+        Lexicon_File_Header header{};
+        std::size_t const size = m_file.size();
+        if (size < sizeof(header)) {
+            fail("is too short");
+        }
+        std::memcpy(&header, m_file.data(), sizeof(header));
+        if (header.magic != detail::lexicon_magic) {
+            fail("has a wrong magic number");
+        }
+        if (header.byte_order != Stats_File_Header::native_byte_order) {
+            fail("was written on a machine with a different byte order");
+        }
+        if (header.version != Lexicon_File_Header::current_version) {
+            fail("has unsupported version " + std::to_string(header.version));
+        }
+        std::uint64_t const expected_checksum = std::exchange(header.header_checksum, 0);
+        if (detail::checksum(detail::checksum_seed, &header, sizeof(header))
+            != expected_checksum) {
+            fail("has a corrupt header");
+        }
+        // Each count is checked against the file size before it is multiplied.
+        std::size_t const available = size - sizeof(header);
+        if (header.bucket_size == 0 || header.block_buckets == 0 || header.sorted_ids > 1
+            || header.term_count > available / sizeof(std::uint32_t)) {
+            fail("has an invalid header");
+        }
+        m_term_count = header.term_count;
+        m_bucket_size = header.bucket_size;
+        m_block_buckets = header.block_buckets;
+        m_bucket_count = m_term_count / m_bucket_size + (m_term_count % m_bucket_size != 0 ? 1 : 0);
+        m_block_count =
+            m_bucket_count / m_block_buckets + (m_bucket_count % m_block_buckets != 0 ? 1 : 0);
+        std::size_t const offsets_size = (m_bucket_count + 1) * sizeof(std::uint64_t);
+        std::size_t const ids_size = header.sorted_ids != 0
+            ? 0
+            : (m_term_count + m_term_count % 2) * sizeof(std::uint32_t);
+        std::size_t const checksums_size = m_block_count * sizeof(std::uint64_t);
+        if (available < offsets_size + ids_size + checksums_size) {
+            fail("has a wrong size");
+        }
+        m_offsets = reinterpret_cast<std::uint64_t const*>(m_file.data() + sizeof(header));
+        if (ids_size > 0) {
+            m_ids = reinterpret_cast<std::uint32_t const*>(m_file.data() + sizeof(header)
+                                                           + offsets_size);
+        }
+        m_buckets = m_file.data() + sizeof(header) + offsets_size + ids_size;
+        m_buckets_size = available - offsets_size - ids_size - checksums_size;
+        if (m_offsets[0] != 0 || m_offsets[m_bucket_count] != m_buckets_size) {
+            fail("has a wrong size");
+        }
+        m_checksums = reinterpret_cast<std::uint64_t const*>(m_buckets + m_buckets_size);
+        m_validated = std::make_unique<std::atomic<bool>[]>(m_block_count);
+        if (m_validation == Validation::eager) {
+            validate();
+        }
+    }
+
+    [[nodiscard]] auto term_count() const -> std::size_t { return m_term_count; }
+
+    /// Returns the ID of `term`, or nothing if it is not in the lexicon.
+    [[nodiscard]] auto find(std::string_view term) const -> std::optional<std::size_t>
+    {
+        if (m_bucket_count == 0) {
+            return std::nullopt;
+        }
+        // Find the last bucket whose first term is not greater than `term`.
+        std::size_t first = 0;
+        std::size_t count = m_bucket_count;
+        while (count > 0) {
+            std::size_t const half = count / 2;
+            if (first_term(first + half) <= term) {
+                first += half + 1;
+                count -= half + 1;
+            } else {
+                count = half;
+            }
+        }
+        if (first == 0) {
+            return std::nullopt;
+        }
+        std::size_t const bucket = first - 1;
+        check(bucket);
+
+        // Invariant: the current term is less than `term` and shares `matched`
+        // characters with it.
+        char const* pos = m_buckets + m_offsets[bucket];
+        char const* const end = m_buckets + m_offsets[bucket + 1];
+        std::size_t matched = 0;
+        for (std::size_t entry = 0; pos < end; entry++) {
+            auto const shared = static_cast<std::size_t>(detail::read_varint(pos));
+            auto const suffix_size = static_cast<std::size_t>(detail::read_varint(pos));
+            std::string_view const suffix(pos, suffix_size);
+            pos += suffix_size;
+            if (shared > matched) {
+                // Same character as the previous term at `matched`, which is too small.
+                continue;
+            }
+            if (shared < matched) {
+                // Differs from the previous term at `shared` with a greater character.
+                return std::nullopt;
+            }
+            std::string_view const rest = term.substr(matched);
+            std::size_t const limit = std::min(suffix.size(), rest.size());
+            std::size_t common = 0;
+            while (common < limit && suffix[common] == rest[common]) {
+                common += 1;
+            }
+            if (common == suffix.size() && common == rest.size()) {
+                return id(bucket * m_bucket_size + entry);
+            }
+            // Characters are compared as unsigned, like `std::string_view`.
+            if (common == rest.size()
+                || (common < suffix.size()
+                    && static_cast<unsigned char>(suffix[common])
+                        > static_cast<unsigned char>(rest[common]))) {
+                return std::nullopt;
+            }
+            matched += common;
+        }
+        return std::nullopt;
+    }
+
+    /// Looks up all `terms` and writes their IDs to `ids`, or `not_found` for
+    /// terms that are not in the lexicon.
+    template<typename String_Range>
+    void find(String_Range const& terms, std::size_t* ids) const
+    {
+        for (auto const& term : terms) {
+            *ids++ = find(std::string_view(term)).value_or(not_found);
+        }
+    }
+
+    /// Validates all blocks.
+    void validate() const
+    {
+        for (std::size_t block = 0; block < m_block_count; block++) {
+            validate_block(block);
+        }
+    }
+
+private:
+    [[noreturn]] void fail(std::string const& reason) const
+    {
+        throw std::runtime_error(m_filename + " " + reason);
+    }
+
+    /// Validates the block of `bucket` if it has not been validated yet.
+    void check(std::size_t bucket) const
+    {
+        std::size_t const block = bucket / m_block_buckets;
+        if (!m_validated[block].load(std::memory_order_acquire)) {
+            validate_block(block);
+        }
+    }
+
+    /// Checks that offsets of the buckets of `block` increase within the
+    /// buckets, then compares the checksum, unless validation is disabled, and
+    /// finally checks each bucket and the IDs of its terms.
+    void validate_block(std::size_t block) const
+    {
+        std::size_t const first = block * m_block_buckets;
+        std::size_t const last = std::min(first + m_block_buckets, m_bucket_count);
+        for (std::size_t bucket = first; bucket < last; bucket++) {
+            if (m_offsets[bucket + 1] < m_offsets[bucket]
+                || m_offsets[bucket + 1] > m_buckets_size) {
+                fail("has invalid bucket offsets at bucket " + std::to_string(bucket));
+            }
+        }
+        if (m_validation != Validation::none) {
+            std::uint64_t expected;
+            std::memcpy(&expected, m_checksums + block, sizeof(expected));
+            if (detail::lexicon_block_checksum(
+                    m_offsets, m_ids, m_buckets, first, last, m_bucket_size, m_term_count)
+                != expected) {
+                fail("is corrupt: checksum mismatch in buckets " + std::to_string(first)
+                     + " to " + std::to_string(last - 1));
+            }
+        }
+        for (std::size_t bucket = first; bucket < last; bucket++) {
+            validate_bucket(bucket);
+        }
+        std::size_t const last_term = std::min(last * m_bucket_size, m_term_count);
+        for (std::size_t position = first * m_bucket_size; m_ids != nullptr && position < last_term;
+             position++) {
+            if (m_ids[position] >= m_term_count) {
+                fail("has a term ID out of range at position " + std::to_string(position));
+            }
+        }
+        m_validated[block].store(true, std::memory_order_release);
+    }
+
+    /// Checks that `bucket` decodes to exactly its number of terms, each sharing
+    /// at most the length of the previous term, without reading past its end.
+    void validate_bucket(std::size_t bucket) const
+    {
+        char const* pos = m_buckets + m_offsets[bucket];
+        char const* const end = m_buckets + m_offsets[bucket + 1];
+        std::size_t const entries = std::min(m_bucket_size, m_term_count - bucket * m_bucket_size);
+        std::uint64_t previous_size = 0;
+        for (std::size_t entry = 0; entry < entries; entry++) {
+            std::uint64_t shared = 0;
+            std::uint64_t suffix_size = 0;
+            try {
+                shared = detail::read_varint(pos, end);
+                suffix_size = detail::read_varint(pos, end);
+            } catch (std::runtime_error const& error) {
+                fail("is corrupt: bucket " + std::to_string(bucket) + " has a " + error.what());
+            }
+            if (shared > previous_size || suffix_size > static_cast<std::size_t>(end - pos)) {
+                fail("is corrupt: invalid term in bucket " + std::to_string(bucket));
+            }
+            pos += suffix_size;
+            previous_size = shared + suffix_size;
+        }
+        if (pos != end) {
+            fail("is corrupt: bucket " + std::to_string(bucket) + " is too long");
+        }
+    }
+
+    [[nodiscard]] auto first_term(std::size_t bucket) const -> std::string_view
+    {
+        check(bucket);
+        char const* pos = m_buckets + m_offsets[bucket];
+        (void)detail::read_varint(pos);
+        auto const size = static_cast<std::size_t>(detail::read_varint(pos));
+        return std::string_view(pos, size);
+    }
+
+    [[nodiscard]] auto id(std::size_t position) const -> std::size_t
+    {
+        return m_ids == nullptr ? position : m_ids[position];
+    }
+
+    std::string m_filename;
+    Memory_Mapped_File m_file;
+    Validation m_validation;
+    std::size_t m_term_count = 0;
+    std::size_t m_bucket_size = 0;
+    std::size_t m_bucket_count = 0;
+    std::size_t m_block_buckets = 0;
+    std::size_t m_block_count = 0;
+    std::size_t m_buckets_size = 0;
+    std::uint64_t const* m_offsets = nullptr;
+    std::uint32_t const* m_ids = nullptr;
+    char const* m_buckets = nullptr;
+    std::uint64_t const* m_checksums = nullptr;
+    std::unique_ptr<std::atomic<bool>[]> m_validated{};
+};
+
+}  // namespace taily
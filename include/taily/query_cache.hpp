@@ -0,0 +1,260 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <taily.hpp>
+
+namespace taily {
+
+/// Bounded, thread-safe cache of shard scores of queries.
+///
+/// Taily scores depend only on the query terms, `ntop`, the domain, the gamma
+/// policy, and statistics, so scores can be reused for repeated queries as
+/// long as statistics do not change. Queries are keyed by their sorted term
+/// IDs, `ntop`, the domain, and the gamma policy given as the `Gamma` template
+/// argument; the order of terms is irrelevant, but repeated terms are kept
+/// because they affect scores.
+///
+/// The cache is split into independently locked segments, each evicting its
+/// least recently used entries. Call `invalidate()` whenever statistics are
+/// reloaded.
+class Query_Cache {
+public:
+    using term_type = std::uint64_t;
+    using value_type = std::shared_ptr<std::vector<double> const>;
+
+    /// Constructs a cache holding at most about `capacity` queries.
+    explicit Query_Cache(std::size_t capacity, std::size_t segment_count = 16)
+        : m_segments(std::max<std::size_t>(1, std::min(segment_count, capacity))),
+          m_segment_capacity((capacity + m_segments.size() - 1) / m_segments.size())
+    {}
+
+    /// Returns cached scores of a query, or `nullptr` if not cached.
+    template<typename Gamma = Exact_Gamma, typename Term_Range>
+    [[nodiscard]] auto find(Term_Range const& terms, int ntop, Domain domain = Domain::linear)
+        -> value_type
+    {
+        return find(make_key<Gamma>(terms, ntop, domain));
+    }
+
+    /// Returns the current generation, which is advanced by `invalidate()`.
+    ///
+    /// Read it before computing scores and pass it to `insert`.
+    [[nodiscard]] auto generation() const -> std::uint64_t
+    {
+        return m_generation.load(std::memory_order_acquire);
+    }
+
+    /// Caches scores of a query computed against statistics of generation
+    /// `computed_generation`, as returned by `generation()` before the
+    /// computation started. If the cache has been invalidated since, the scores
+    /// may be stale and are not cached.
+    template<typename Gamma = Exact_Gamma, typename Term_Range>
+    void insert(Term_Range const& terms,
+                int ntop,
+                std::vector<double> scores,
+                std::uint64_t computed_generation,
+                Domain domain = Domain::linear)
+    {
+        insert(make_key<Gamma>(terms, ntop, domain),
+               std::make_shared<std::vector<double> const>(std::move(scores)),
+               computed_generation);
+    }
+
+    /// Returns cached scores of a query or, if not cached, computes them with
+    /// `compute()` and caches them.
+    ///
+    /// Concurrent misses of the same query may compute it more than once.
+    /// Scores computed while the cache is invalidated are returned but not cached.
+    template<typename Gamma = Exact_Gamma, typename Term_Range, typename Compute>
+    [[nodiscard]] auto get_or_compute(Term_Range const& terms,
+                                      int ntop,
+                                      Compute&& compute,
+                                      Domain domain = Domain::linear) -> value_type
+    {
+        auto key = make_key<Gamma>(terms, ntop, domain);
+        if (auto cached = find(key); cached != nullptr) {
+            return cached;
+        }
+        auto const started_generation = generation();
+        auto scores = std::make_shared<std::vector<double> const>(compute());
+        insert(std::move(key), scores, started_generation);
+        return scores;
+    }
+
+    /// Removes all entries.
+    void invalidate()
+    {
+        m_generation.fetch_add(1, std::memory_order_acq_rel);
+        for (auto& segment : m_segments) {
+            std::lock_guard<std::mutex> lock(segment.mutex);
+            segment.entries.clear();
+            segment.index.clear();
+        }
+    }
+
+    /// Returns the number of cached queries.
+    [[nodiscard]] auto size() const -> std::size_t
+    {
+        std::size_t size = 0;
+        for (auto& segment : m_segments) {
+            std::lock_guard<std::mutex> lock(segment.mutex);
+            size += segment.entries.size();
+        }
+        return size;
+    }
+
+    [[nodiscard]] auto hits() const -> std::uint64_t
+    {
+        return m_hits.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] auto misses() const -> std::uint64_t
+    {
+        return m_misses.load(std::memory_order_relaxed);
+    }
+
+    /// Returns the fraction of lookups that were hits, or 0 if there were none.
+    [[nodiscard]] auto hit_rate() const -> double
+    {
+        auto const hits = this->hits();
+        auto const lookups = hits + misses();
+        return lookups > 0 ? static_cast<double>(hits) / lookups : 0.0;
+    }
+
+private:
+    struct Key {
+        std::vector<term_type> terms;
+        int ntop;
+        Domain domain;
+        std::type_index gamma;
+
+        [[nodiscard]] auto operator==(Key const& other) const -> bool
+        {
+            return ntop == other.ntop && domain == other.domain && gamma == other.gamma
+                && terms == other.terms;
+        }
+    };
+
+    struct Key_Hash {
+        [[nodiscard]] auto operator()(Key const& key) const -> std::size_t
+        {
+            std::size_t hash = std::hash<int>{}(key.ntop);
+            hash ^= std::hash<std::type_index>{}(key.gamma) + 0x9e3779b97f4a7c15ULL + (hash << 6)
+                + (hash >> 2);
+            hash ^= static_cast<std::size_t>(key.domain) + 0x9e3779b97f4a7c15ULL + (hash << 6)
+                + (hash >> 2);
+            for (auto term : key.terms) {
+                hash ^= std::hash<term_type>{}(term) + 0x9e3779b97f4a7c15ULL + (hash << 6)
+                    + (hash >> 2);
+            }
+            return hash;
+        }
+    };
+
+    using Entry_List = std::list<std::pair<Key, value_type>>;
+
+    struct Segment {
+        mutable std::mutex mutex{};
+        Entry_List entries{};
+        std::unordered_map<Key, Entry_List::iterator, Key_Hash> index{};
+    };
+
+    template<typename Gamma, typename Term_Range>
+    [[nodiscard]] static auto make_key(Term_Range const& terms, int ntop, Domain domain) -> Key
+    {
+        Key key{std::vector<term_type>(std::begin(terms), std::end(terms)),
+                ntop,
+                domain,
+                std::type_index(typeid(Gamma))};
+        std::sort(key.terms.begin(), key.terms.end());
+        return key;
+    }
+
+    [[nodiscard]] auto find(Key const& key) -> value_type
+    {
+        auto& segment = segment_for(key);
+        std::lock_guard<std::mutex> lock(segment.mutex);
+        if (auto pos = segment.index.find(key); pos != segment.index.end()) {
+            segment.entries.splice(segment.entries.begin(), segment.entries, pos->second);
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+            return pos->second->second;
+        }
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    [[nodiscard]] auto segment_for(Key const& key) -> Segment&
+    {
+        return m_segments[Key_Hash{}(key) % m_segments.size()];
+    }
+
+    void insert(Key key, value_type scores, std::uint64_t computed_generation)
+    {
+        if (m_segment_capacity == 0) {
+            return;
+        }
+        auto& segment = segment_for(key);
+        std::lock_guard<std::mutex> lock(segment.mutex);
+        if (computed_generation != generation()) {
+            return;
+        }
+        if (auto pos = segment.index.find(key); pos != segment.index.end()) {
+            pos->second->second = std::move(scores);
+            segment.entries.splice(segment.entries.begin(), segment.entries, pos->second);
+            return;
+        }
+        if (segment.entries.size() == m_segment_capacity) {
+            segment.index.erase(segment.entries.back().first);
+            segment.entries.pop_back();
+        }
+        segment.entries.emplace_front(key, std::move(scores));
+        segment.index.emplace(std::move(key), segment.entries.begin());
+    }
+
+    std::vector<Segment> m_segments;
+    std::size_t m_segment_capacity;
+    std::atomic<std::uint64_t> m_generation{0};
+    std::atomic<std::uint64_t> m_hits{0};
+    std::atomic<std::uint64_t> m_misses{0};
+};
+
+}  // namespace taily
@@ -0,0 +1,463 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <taily.hpp>
+#include <taily/arena.hpp>
+#include <taily/instrumentation.hpp>
+#include <taily/shard_block.hpp>
+#include <taily/stats_store.hpp>
+
+namespace taily {
+
+/// Memory reused by all queries scored by one thread.
+///
+/// Holds global statistics of the current query, its statistics in all shards
+/// as a `Shard_Block` (or those of all terms of a batch), an `Arena` for
+/// temporary arrays of a query, and another for arrays kept for a whole batch.
+/// All of them only grow, so once the workspace has seen the largest query (or
+/// batch), scoring performs no heap allocations. A workspace must not be used
+/// by concurrent queries; create one per thread instead.
+class Scoring_Workspace {
+public:
+    [[nodiscard]] auto global_stats() -> Query_Statistics& { return m_global_stats; }
+    [[nodiscard]] auto block() -> Shard_Block& { return m_block; }
+    [[nodiscard]] auto arena() -> Arena& { return m_arena; }
+    [[nodiscard]] auto batch_arena() -> Arena& { return m_batch_arena; }
+
+private:
+    Query_Statistics m_global_stats{{}, 0};
+    Shard_Block m_block{};
+    Arena m_arena{};
+    Arena m_batch_arena{};
+};
+
+namespace detail {
+
+    template<typename Gamma, typename Term_Range, typename Instrumentation>
+    void score_shards(Sharded_Stats_Store const& store,
+                      Shard_Occurrences const* occurrences,
+                      Gamma_Parameter_Store const* gammas,
+                      Term_Range const& terms,
+                      std::int64_t const collection_size,
+                      std::vector<std::int64_t> const& shard_sizes,
+                      int const ntop,
+                      double* scores,
+                      Scoring_Workspace& workspace,
+                      Domain domain,
+                      Instrumentation&& instrumentation)
+    {
+        if (gammas != nullptr && std::size(terms) == 1) {
+            // The single-term fast path allocates nothing.
+            taily::score_shards<Gamma>(
+                store, gammas, terms, collection_size, shard_sizes, ntop, scores);
+            return;
+        }
+        workspace.arena().reset();
+        instrumentation.start(Phase::lookup);
+        store.global_query_stats(terms, collection_size, workspace.global_stats());
+        if (occurrences != nullptr) {
+            load_shard_block(store, *occurrences, terms, shard_sizes, workspace.block());
+        } else {
+            load_shard_block(store, terms, shard_sizes, workspace.block());
+        }
+        instrumentation.stop(Phase::lookup);
+        taily::score_shards<Gamma>(workspace.global_stats(),
+                                   workspace.block(),
+                                   ntop,
+                                   scores,
+                                   workspace.arena(),
+                                   domain,
+                                   std::forward<Instrumentation>(instrumentation));
+    }
+
+    /// Maximum number of gamma distributions of a batch evaluated together,
+    /// unless a single query has more shards.
+    constexpr std::size_t batch_cdf_capacity = 4096;
+
+    template<typename Gamma, typename Query_Range, typename Instrumentation>
+    void score_batch(Sharded_Stats_Store const& store,
+                     Shard_Occurrences const* occurrences,
+                     Gamma_Parameter_Store const* gammas,
+                     Query_Range const& queries,
+                     std::int64_t const collection_size,
+                     std::vector<std::int64_t> const& shard_sizes,
+                     int const ntop,
+                     double* scores,
+                     Scoring_Workspace& workspace,
+                     Domain domain,
+                     Instrumentation&& instrumentation)
+    {
+        if (gammas != nullptr
+            && (gammas->term_count() != store.term_count()
+                || gammas->shard_count() != store.shard_count())) {
+            throw std::invalid_argument("gamma parameters do not match the stats store");
+        }
+        if (occurrences != nullptr
+            && (occurrences->term_count() != store.term_count()
+                || occurrences->shard_count() != store.shard_count())) {
+            throw std::invalid_argument("shard occurrences do not match the stats store");
+        }
+        if (shard_sizes.size() != store.shard_count()) {
+            throw std::invalid_argument("expected " + std::to_string(store.shard_count())
+                                        + " shard sizes but got "
+                                        + std::to_string(shard_sizes.size()));
+        }
+        std::size_t const shard_count = store.shard_count();
+        std::size_t const query_count = std::size(queries);
+        auto single_term = [gammas](auto const& terms) {
+            return gammas != nullptr && std::size(terms) == 1;
+        };
+        Arena& batch_arena = workspace.batch_arena();
+        batch_arena.reset();
+
+        // Each distinct term of the batch is looked up once, into a row of the
+        // block; `rows` holds the row of each term of each query in turn.
+        instrumentation.start(Phase::lookup);
+        std::size_t term_count = 0;
+        for (auto const& terms : queries) {
+            term_count += single_term(terms) ? 0 : std::size(terms);
+        }
+        auto* distinct = batch_arena.allocate<std::size_t>(term_count);
+        auto* rows = batch_arena.allocate<std::size_t>(term_count);
+        std::size_t* distinct_last = distinct;
+        for (auto const& terms : queries) {
+            if (single_term(terms)) {
+                continue;
+            }
+            for (auto term : terms) {
+                if (static_cast<std::size_t>(term) >= store.term_count()) {
+                    throw std::out_of_range("term ID out of range: " + std::to_string(term));
+                }
+                *distinct_last++ = static_cast<std::size_t>(term);
+            }
+        }
+        std::sort(distinct, distinct_last);
+        distinct_last = std::unique(distinct, distinct_last);
+        auto const distinct_count = static_cast<std::size_t>(distinct_last - distinct);
+        std::size_t pos = 0;
+        for (auto const& terms : queries) {
+            if (single_term(terms)) {
+                continue;
+            }
+            for (auto term : terms) {
+                auto const row =
+                    std::lower_bound(distinct, distinct_last, static_cast<std::size_t>(term));
+                rows[pos++] = static_cast<std::size_t>(row - distinct);
+            }
+        }
+        Shard_Block& block = workspace.block();
+        block.reset(distinct_count, shard_sizes);
+        if (occurrences != nullptr) {
+            // Only shards in which a term occurs can be candidates of its queries.
+            block.clear();
+        }
+        auto* global_term_stats = batch_arena.allocate<Feature_Statistics>(distinct_count);
+        for (std::size_t row = 0; row < distinct_count; row++) {
+            Feature_Statistics const* stats = store.row(distinct[row]);
+            global_term_stats[row] = stats[0];
+            if (occurrences == nullptr) {
+                for (std::size_t shard = 0; shard < shard_count; shard++) {
+                    block.set(row, shard, stats[shard + 1]);
+                }
+                continue;
+            }
+            std::uint64_t const* words = occurrences->occurrences(distinct[row]);
+            for (std::size_t word = 0; word < block.word_count(); word++) {
+                for (std::uint64_t bits = words[word]; bits != 0; bits &= bits - 1) {
+                    std::size_t const shard = word * 64 + detail::trailing_zeros(bits);
+                    block.set(row, shard, stats[shard + 1]);
+                }
+            }
+        }
+        instrumentation.stop(Phase::lookup);
+
+        // Gamma distributions of consecutive queries are evaluated together, and
+        // their rows are normalized once they have been.
+        Pending_Cdfs pending(std::max(shard_count, batch_cdf_capacity), batch_arena);
+        auto* deferred = batch_arena.allocate<bool>(query_count);
+        std::size_t first_deferred = 0;
+        auto flush = [&](std::size_t query_last) {
+            if (pending.count > 0) {
+                instrumentation.start(Phase::cdf);
+                evaluate_cdfs<Gamma>(pending, domain);
+                instrumentation.stop(Phase::cdf);
+            }
+            for (std::size_t query = first_deferred; query < query_last; query++) {
+                if (deferred[query]) {
+                    instrumentation.start(Phase::normalization);
+                    normalize_scores(scores + query * shard_count, shard_count, ntop, domain);
+                    instrumentation.stop(Phase::normalization);
+                }
+            }
+            first_deferred = query_last;
+        };
+
+        std::size_t const* query_rows = rows;
+        std::size_t query = 0;
+        for (auto const& terms : queries) {
+            double* query_scores = scores + query * shard_count;
+            deferred[query] = !single_term(terms);
+            if (!deferred[query]) {
+                taily::score_shards<Gamma>(
+                    store, gammas, terms, collection_size, shard_sizes, ntop, query_scores);
+                query += 1;
+                continue;
+            }
+            Block_Rows query_block(block, query_rows, std::size(terms));
+            Query_Statistics& global_stats = workspace.global_stats();
+            global_stats.collection_size = collection_size;
+            global_stats.term_stats.clear();
+            for (std::size_t term = 0; term < query_block.term_count(); term++) {
+                global_stats.term_stats.push_back(global_term_stats[query_rows[term]]);
+            }
+            query_rows += query_block.term_count();
+
+            Arena& arena = workspace.arena();
+            arena.reset();
+            instrumentation.start(Phase::candidates);
+            auto* candidates = arena.allocate<std::size_t>(shard_count);
+            std::size_t const candidate_count = candidate_shards(query_block, candidates);
+            std::size_t fitted_count = 0;
+            auto score = [&](auto const& scored_block, std::size_t const* shards) {
+                instrumentation.start(Phase::cutoff);
+                double const global_cutoff = estimate_cutoff<Gamma>(global_stats, ntop, domain);
+                instrumentation.stop(Phase::cutoff);
+                if (global_cutoff > 0) {
+                    if (pending.count + scored_block.shard_count() > pending.capacity) {
+                        flush(query);
+                    }
+                    instrumentation.start(Phase::cdf);
+                    fitted_count = fit_shards(
+                        scored_block, global_cutoff, query_scores, shards, arena, domain, pending);
+                    instrumentation.stop(Phase::cdf);
+                }
+            };
+            if (candidate_count == shard_count) {
+                instrumentation.stop(Phase::candidates);
+                instrumentation.start(Phase::all);
+                all_coefficients(query_block, query_scores, domain);
+                instrumentation.stop(Phase::all);
+                score(query_block, nullptr);
+            } else {
+                Gathered_Block gathered(query_block, candidates, candidate_count, arena);
+                instrumentation.stop(Phase::candidates);
+                instrumentation.start(Phase::all);
+                auto* coefficients = arena.allocate<double>(candidate_count);
+                all_coefficients(gathered, coefficients, domain);
+                std::fill_n(query_scores,
+                            shard_count,
+                            domain == Domain::log ? -std::numeric_limits<double>::infinity()
+                                                  : 0.0);
+                for (std::size_t idx = 0; idx < candidate_count; idx++) {
+                    query_scores[candidates[idx]] = coefficients[idx];
+                }
+                instrumentation.stop(Phase::all);
+                score(gathered, candidates);
+            }
+
+            bool const has_cutoff = !global_stats.term_stats.empty();
+            instrumentation.count(Counter::shards_evaluated, fitted_count);
+            instrumentation.count(Counter::shards_skipped, shard_count - fitted_count);
+            instrumentation.count(Counter::gamma_evaluations,
+                                  fitted_count + (has_cutoff ? 1 : 0));
+            query += 1;
+        }
+        flush(query_count);
+    }
+
+}  // namespace detail
+
+/// Scores all shards of `store` for a query, like the store-based `score_shards`,
+/// but collecting statistics into `workspace` and scoring them with the
+/// `Shard_Block` overload, which performs no allocations in steady state.
+///
+/// \param store Statistics of the index and its shards
+/// \param gammas Optional gamma parameters fitted to `store`, or `nullptr`
+/// \param terms Query term IDs
+/// \param collection_size Size of the entire collection
+/// \param shard_sizes Sizes of the shards
+/// \param ntop The parameter to Taily algorithm saying how many top results we
+/// are shooting for
+/// \param scores Output shard scores, one for each shard
+/// \param workspace Memory reused across queries
+/// \param domain Domain of `any` and `all` of multi-term queries
+/// \param instrumentation Instrumentation timing the phases of scoring, including
+/// the lookup of statistics; single-term queries with `gammas` are not recorded
+template<typename Gamma = Exact_Gamma,
+         typename Term_Range,
+         typename Instrumentation = No_Instrumentation>
+void score_shards(Sharded_Stats_Store const& store,
+                  Gamma_Parameter_Store const* gammas,
+                  Term_Range const& terms,
+                  std::int64_t const collection_size,
+                  std::vector<std::int64_t> const& shard_sizes,
+                  int const ntop,
+                  double* scores,
+                  Scoring_Workspace& workspace,
+                  Domain domain = Domain::linear,
+                  Instrumentation&& instrumentation = {})
+{
+    detail::score_shards<Gamma>(store,
+                                nullptr,
+                                gammas,
+                                terms,
+                                collection_size,
+                                shard_sizes,
+                                ntop,
+                                scores,
+                                workspace,
+                                domain,
+                                std::forward<Instrumentation>(instrumentation));
+}
+
+/// Scores all shards of `store` for a query like the overload above, but
+/// looks up statistics only in the shards containing all query terms, found
+/// with `occurrences` built once for `store`. The scores are the same.
+template<typename Gamma = Exact_Gamma,
+         typename Term_Range,
+         typename Instrumentation = No_Instrumentation>
+void score_shards(Sharded_Stats_Store const& store,
+                  Shard_Occurrences const& occurrences,
+                  Gamma_Parameter_Store const* gammas,
+                  Term_Range const& terms,
+                  std::int64_t const collection_size,
+                  std::vector<std::int64_t> const& shard_sizes,
+                  int const ntop,
+                  double* scores,
+                  Scoring_Workspace& workspace,
+                  Domain domain = Domain::linear,
+                  Instrumentation&& instrumentation = {})
+{
+    detail::score_shards<Gamma>(store,
+                                &occurrences,
+                                gammas,
+                                terms,
+                                collection_size,
+                                shard_sizes,
+                                ntop,
+                                scores,
+                                workspace,
+                                domain,
+                                std::forward<Instrumentation>(instrumentation));
+}
+
+/// Scores all shards of `store` for a batch of queries, writing the scores to
+/// `scores` as a row-major matrix of `std::size(queries)` rows (queries) and
+/// `store.shard_count()` columns (shards), which must be allocated by the caller.
+///
+/// The batch is processed term-major: the row of each distinct term of the
+/// batch is read from `store` once, into the `Shard_Block` of `workspace`, and
+/// each query is scored from its terms' rows of the block. Gamma distributions
+/// of shards of consecutive queries are then evaluated together, each at the
+/// cutoff of its query, by the batch `complement_cdf` (vectorized for
+/// `Fast_Gamma`), in groups of up to 4096 or the number of shards. Single-term
+/// queries with `gammas` take the fast path of the single-query overload.
+/// Each row is equal to the scores of the single-query overload above. All
+/// arguments and term IDs are checked before any row is written, and once the
+/// workspace fits the largest batch, no memory is allocated.
+///
+/// \param store Statistics of the index and its shards
+/// \param gammas Optional gamma parameters fitted to `store`, or `nullptr`
+/// \param queries Range of queries, each a range of term IDs
+/// \param collection_size Size of the entire collection
+/// \param shard_sizes Sizes of the shards
+/// \param ntop The parameter to Taily algorithm saying how many top results we
+/// are shooting for
+/// \param scores Output score matrix
+/// \param workspace Memory reused across queries
+/// \param domain Domain of `any` and `all` of multi-term queries
+/// \param instrumentation Instrumentation accumulating the phases of all queries
+template<typename Gamma = Exact_Gamma,
+         typename Query_Range,
+         typename Instrumentation = No_Instrumentation>
+void score_batch(Sharded_Stats_Store const& store,
+                 Gamma_Parameter_Store const* gammas,
+                 Query_Range const& queries,
+                 std::int64_t const collection_size,
+                 std::vector<std::int64_t> const& shard_sizes,
+                 int const ntop,
+                 double* scores,
+                 Scoring_Workspace& workspace,
+                 Domain domain = Domain::linear,
+                 Instrumentation&& instrumentation = {})
+{
+    detail::score_batch<Gamma>(store,
+                               nullptr,
+                               gammas,
+                               queries,
+                               collection_size,
+                               shard_sizes,
+                               ntop,
+                               scores,
+                               workspace,
+                               domain,
+                               std::forward<Instrumentation>(instrumentation));
+}
+
+/// Scores all shards of `store` for a batch of queries like the overload
+/// above, looking up the statistics of each term only in the shards in which
+/// it occurs, found with `occurrences` built once for `store`.
+template<typename Gamma = Exact_Gamma,
+         typename Query_Range,
+         typename Instrumentation = No_Instrumentation>
+void score_batch(Sharded_Stats_Store const& store,
+                 Shard_Occurrences const& occurrences,
+                 Gamma_Parameter_Store const* gammas,
+                 Query_Range const& queries,
+                 std::int64_t const collection_size,
+                 std::vector<std::int64_t> const& shard_sizes,
+                 int const ntop,
+                 double* scores,
+                 Scoring_Workspace& workspace,
+                 Domain domain = Domain::linear,
+                 Instrumentation&& instrumentation = {})
+{
+    detail::score_batch<Gamma>(store,
+                               &occurrences,
+                               gammas,
+                               queries,
+                               collection_size,
+                               shard_sizes,
+                               ntop,
+                               scores,
+                               workspace,
+                               domain,
+                               std::forward<Instrumentation>(instrumentation));
+}
+
+}  // namespace taily
@@ -0,0 +1,885 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <taily.hpp>
+#include <taily/arena.hpp>
+#include <taily/instrumentation.hpp>
+#include <taily/simd.hpp>
+#include <taily/stats_store.hpp>
+
+namespace taily {
+
+namespace detail {
+
+    /// Returns the index of the lowest set bit of `bits`, which must not be zero.
+    [[nodiscard]] inline auto trailing_zeros(std::uint64_t bits) -> std::size_t
+    {
+#if defined(__GNUC__)
+        return static_cast<std::size_t>(__builtin_ctzll(bits));
+#else
+        std::size_t count = 0;
+        for (; (bits & 1U) == 0; bits >>= 1U) {
+            count += 1;
+        }
+        return count;
+#endif
+    }
+
+}  // namespace detail
+
+/// Statistics of query terms in many shards, stored as a struct of arrays.
+///
+/// For each query term, frequencies, expected values, and variances in all
+/// shards are stored in separate contiguous arrays, which lets the kernels
+/// below process many shards at once with SIMD instructions. Frequencies are
+/// stored as doubles, which are exact up to 2^53. For each term, a bitmap of
+/// the shards in which it occurs is maintained as well, to find the shards
+/// containing all terms without touching the statistics.
+///
+/// The memory is only ever grown, so a block reused for many queries stops
+/// allocating once it fits the largest query.
+class Shard_Block {
+public:
+    /// Prepares the block for `term_count` terms in shards of sizes `collection_sizes`.
+    template<typename Size_Range>
+    void reset(std::size_t term_count, Size_Range const& collection_sizes)
+    {
+        m_term_count = term_count;
+        m_shard_count = std::size(collection_sizes);
+        m_collection_sizes.resize(std::max(m_collection_sizes.size(), m_shard_count));
+        std::transform(std::begin(collection_sizes),
+                       std::end(collection_sizes),
+                       m_collection_sizes.begin(),
+                       [](auto size) { return static_cast<double>(size); });
+        reset_terms(term_count);
+    }
+
+    /// Copies statistics from a vector of per-shard query statistics.
+    void assign(std::vector<Query_Statistics> const& shard_stats)
+    {
+        std::size_t const term_count =
+            shard_stats.empty() ? 0 : shard_stats.front().term_stats.size();
+        m_shard_count = shard_stats.size();
+        m_collection_sizes.resize(std::max(m_collection_sizes.size(), m_shard_count));
+        for (std::size_t shard = 0; shard < m_shard_count; shard++) {
+            m_collection_sizes[shard] = static_cast<double>(shard_stats[shard].collection_size);
+        }
+        reset_terms(term_count);
+        for (std::size_t shard = 0; shard < m_shard_count; shard++) {
+            if (shard_stats[shard].term_stats.size() != term_count) {
+                throw std::invalid_argument("all shards must have the same number of terms");
+            }
+            for (std::size_t term = 0; term < term_count; term++) {
+                set(term, shard, shard_stats[shard].term_stats[term]);
+            }
+        }
+    }
+
+    /// Sets statistics of `term` in `shard`.
+    void set(std::size_t term, std::size_t shard, Feature_Statistics const& stats)
+    {
+        std::size_t const pos = term * m_shard_count + shard;
+        m_frequencies[pos] = static_cast<double>(stats.frequency);
+        m_expected_values[pos] = stats.expected_value;
+        m_variances[pos] = stats.variance;
+        std::uint64_t& word = m_occurrences[term * word_count() + shard / 64];
+        std::uint64_t const bit = std::uint64_t{1} << (shard % 64);
+        word = stats.frequency != 0 ? word | bit : word & ~bit;
+    }
+
+    /// Sets statistics of all terms in all shards to zero.
+    void clear()
+    {
+        std::size_t const size = m_term_count * m_shard_count;
+        std::fill_n(m_frequencies.begin(), size, 0.0);
+        std::fill_n(m_expected_values.begin(), size, 0.0);
+        std::fill_n(m_variances.begin(), size, 0.0);
+        std::fill_n(m_occurrences.begin(), m_term_count * word_count(), 0);
+    }
+
+    [[nodiscard]] auto term_count() const -> std::size_t { return m_term_count; }
+    [[nodiscard]] auto shard_count() const -> std::size_t { return m_shard_count; }
+
+    /// Returns the number of 64-bit words of the bitmap of each term.
+    [[nodiscard]] auto word_count() const -> std::size_t { return (m_shard_count + 63) / 64; }
+
+    /// Returns the bitmap of shards in which `term` occurs: bit `s % 64` of
+    /// word `s / 64` is set if its frequency in shard `s` is not zero.
+    [[nodiscard]] auto occurrences(std::size_t term) const -> std::uint64_t const*
+    {
+        return m_occurrences.data() + term * word_count();
+    }
+
+    /// Returns collection sizes of all shards.
+    [[nodiscard]] auto collection_sizes() const -> double const*
+    {
+        return m_collection_sizes.data();
+    }
+
+    /// Returns frequencies of `term` in all shards.
+    [[nodiscard]] auto frequencies(std::size_t term) const -> double const*
+    {
+        return m_frequencies.data() + term * m_shard_count;
+    }
+
+    /// Returns expected values of `term` in all shards.
+    [[nodiscard]] auto expected_values(std::size_t term) const -> double const*
+    {
+        return m_expected_values.data() + term * m_shard_count;
+    }
+
+    /// Returns variances of `term` in all shards.
+    [[nodiscard]] auto variances(std::size_t term) const -> double const*
+    {
+        return m_variances.data() + term * m_shard_count;
+    }
+
+private:
+    void reset_terms(std::size_t term_count)
+    {
+        m_term_count = term_count;
+        std::size_t const size = term_count * m_shard_count;
+        if (m_frequencies.size() < size) {
+            m_frequencies.resize(size);
+            m_expected_values.resize(size);
+            m_variances.resize(size);
+        }
+        std::size_t const words = term_count * word_count();
+        m_occurrences.resize(std::max(m_occurrences.size(), words));
+        std::fill_n(m_occurrences.begin(), words, 0);
+    }
+
+    std::size_t m_term_count = 0;
+    std::size_t m_shard_count = 0;
+    std::vector<double> m_collection_sizes{};
+    std::vector<double> m_frequencies{};
+    std::vector<double> m_expected_values{};
+    std::vector<double> m_variances{};
+    std::vector<std::uint64_t> m_occurrences{};
+};
+
+/// Loads statistics of `terms` in all shards of `store` into `block`.
+template<typename Term_Range>
+void load_shard_block(Sharded_Stats_Store const& store,
+                      Term_Range const& terms,
+                      std::vector<std::int64_t> const& shard_sizes,
+                      Shard_Block& block)
+{
+    if (shard_sizes.size() != store.shard_count()) {
+        throw std::invalid_argument("expected " + std::to_string(store.shard_count())
+                                    + " shard sizes but got "
+                                    + std::to_string(shard_sizes.size()));
+    }
+    block.reset(std::size(terms), shard_sizes);
+    std::size_t idx = 0;
+    for (auto term : terms) {
+        if (static_cast<std::size_t>(term) >= store.term_count()) {
+            throw std::out_of_range("term ID out of range: " + std::to_string(term));
+        }
+        Feature_Statistics const* row = store.row(term) + 1;
+        for (std::size_t shard = 0; shard < store.shard_count(); shard++) {
+            block.set(idx, shard, row[shard]);
+        }
+        idx += 1;
+    }
+}
+
+/// Bitmaps of the shards in which each term of a `Sharded_Stats_Store`
+/// occurs, in the layout of `Shard_Block::occurrences`.
+///
+/// They are built once, when the store is loaded, and let `load_shard_block`
+/// find the shards containing all query terms before reading any statistics.
+/// They take one bit per term and shard, 1/192 of the size of the store.
+class Shard_Occurrences {
+public:
+    /// Builds the bitmaps of all terms of `store`, reading every row once.
+    explicit Shard_Occurrences(Sharded_Stats_Store const& store)
+        : m_term_count(store.term_count()),
+          m_shard_count(store.shard_count()),
+          m_bitmaps(m_term_count * word_count(), 0)
+    {
+        for (std::size_t term = 0; term < m_term_count; term++) {
+            Feature_Statistics const* row = store.row(term) + 1;
+            std::uint64_t* words = m_bitmaps.data() + term * word_count();
+            for (std::size_t shard = 0; shard < m_shard_count; shard++) {
+                if (row[shard].frequency != 0) {
+                    words[shard / 64] |= std::uint64_t{1} << (shard % 64);
+                }
+            }
+        }
+    }
+
+    [[nodiscard]] auto term_count() const -> std::size_t { return m_term_count; }
+    [[nodiscard]] auto shard_count() const -> std::size_t { return m_shard_count; }
+
+    /// Returns the number of 64-bit words of the bitmap of each term.
+    [[nodiscard]] auto word_count() const -> std::size_t { return (m_shard_count + 63) / 64; }
+
+    /// Returns the bitmap of shards in which `term` occurs.
+    [[nodiscard]] auto occurrences(std::size_t term) const -> std::uint64_t const*
+    {
+        return m_bitmaps.data() + term * word_count();
+    }
+
+private:
+    std::size_t m_term_count;
+    std::size_t m_shard_count;
+    std::vector<std::uint64_t> m_bitmaps;
+};
+
+/// Loads statistics of `terms` into `block` like the overload above, but only
+/// in the shards in which all of them occur.
+///
+/// These candidates are found by intersecting `occurrences` first, so only
+/// their statistics are read from `store`, and the lookup takes time
+/// proportional to the number of terms times the number of shards / 64, plus
+/// the number of terms times the number of candidates, besides clearing the
+/// block. Statistics of the other shards are zero in `block`, as if they
+/// contained none of the terms: `candidate_shards`, and thus the `Shard_Block`
+/// overload of `score_shards`, is unaffected, and the other kernels return
+/// zero rather than the true values for these shards.
+///
+/// \throws std::invalid_argument if `occurrences` was built for another store
+template<typename Term_Range>
+void load_shard_block(Sharded_Stats_Store const& store,
+                      Shard_Occurrences const& occurrences,
+                      Term_Range const& terms,
+                      std::vector<std::int64_t> const& shard_sizes,
+                      Shard_Block& block)
+{
+    if (occurrences.term_count() != store.term_count()
+        || occurrences.shard_count() != store.shard_count()) {
+        throw std::invalid_argument("shard occurrences do not match the stats store");
+    }
+    if (shard_sizes.size() != store.shard_count()) {
+        throw std::invalid_argument("expected " + std::to_string(store.shard_count())
+                                    + " shard sizes but got "
+                                    + std::to_string(shard_sizes.size()));
+    }
+    for (auto term : terms) {
+        if (static_cast<std::size_t>(term) >= store.term_count()) {
+            throw std::out_of_range("term ID out of range: " + std::to_string(term));
+        }
+    }
+    block.reset(std::size(terms), shard_sizes);
+    block.clear();
+    for (std::size_t word = 0; word < block.word_count(); word++) {
+        std::uint64_t candidates = ~std::uint64_t{0};
+        for (auto term : terms) {
+            candidates &= occurrences.occurrences(term)[word];
+            if (candidates == 0) {
+                break;
+            }
+        }
+        if (candidates == 0) {
+            continue;
+        }
+        std::size_t idx = 0;
+        for (auto term : terms) {
+            Feature_Statistics const* row = store.row(term) + 1;
+            for (std::uint64_t bits = candidates; bits != 0; bits &= bits - 1) {
+                std::size_t const shard = word * 64 + detail::trailing_zeros(bits);
+                block.set(idx, shard, row[shard]);
+            }
+            idx += 1;
+        }
+    }
+}
+
+namespace detail {
+
+    template<typename Block>
+    void all_scalar(Block const& block, std::size_t first, std::size_t last, double* all)
+    {
+        double const* sizes = block.collection_sizes();
+        for (std::size_t shard = first; shard < last; shard++) {
+            double any_product = 1.0;
+            for (std::size_t term = 0; term < block.term_count(); term++) {
+                any_product *= 1.0 - block.frequencies(term)[shard] / sizes[shard];
+            }
+            double const any = sizes[shard] * (1.0 - any_product);
+            if (any == 0.0) {
+                all[shard] = 0.0;
+                continue;
+            }
+            double all_product = 1.0;
+            for (std::size_t term = 0; term < block.term_count(); term++) {
+                all_product *= block.frequencies(term)[shard] / any;
+            }
+            all[shard] = any * all_product;
+        }
+    }
+
+    template<typename Block>
+    void moments_scalar(Block const& block,
+                        std::size_t first,
+                        std::size_t last,
+                        double* expected_values,
+                        double* variances)
+    {
+        std::fill(expected_values + first, expected_values + last, 0.0);
+        std::fill(variances + first, variances + last, 0.0);
+        for (std::size_t term = 0; term < block.term_count(); term++) {
+            double const* term_expected_values = block.expected_values(term);
+            double const* term_variances = block.variances(term);
+            for (std::size_t shard = first; shard < last; shard++) {
+                expected_values[shard] += term_expected_values[shard];
+                variances[shard] += term_variances[shard];
+            }
+        }
+    }
+
+    template<typename Block>
+    auto all_simd(Block const& block, double* all) -> std::size_t
+    {
+        std::size_t const end = block.shard_count() - block.shard_count() % simd::width;
+        simd::Vector const one = simd::broadcast(1.0);
+        simd::Vector const zero = simd::broadcast(0.0);
+        for (std::size_t shard = 0; shard < end; shard += simd::width) {
+            simd::Vector const size = simd::load(block.collection_sizes() + shard);
+            simd::Vector any_product = one;
+            for (std::size_t term = 0; term < block.term_count(); term++) {
+                simd::Vector const freq = simd::load(block.frequencies(term) + shard);
+                any_product = simd::mul(any_product, simd::sub(one, simd::div(freq, size)));
+            }
+            simd::Vector const any = simd::mul(size, simd::sub(one, any_product));
+            simd::Vector all_product = one;
+            for (std::size_t term = 0; term < block.term_count(); term++) {
+                simd::Vector const freq = simd::load(block.frequencies(term) + shard);
+                all_product = simd::mul(all_product, simd::div(freq, any));
+            }
+            simd::store(all + shard,
+                        simd::select(simd::equal(any, zero), zero, simd::mul(any, all_product)));
+        }
+        return end;
+    }
+
+    template<typename Block>
+    auto moments_simd(Block const& block, double* expected_values, double* variances)
+        -> std::size_t
+    {
+        std::size_t const end = block.shard_count() - block.shard_count() % simd::width;
+        for (std::size_t shard = 0; shard < end; shard += simd::width) {
+            simd::Vector expected_value = simd::broadcast(0.0);
+            simd::Vector variance = simd::broadcast(0.0);
+            for (std::size_t term = 0; term < block.term_count(); term++) {
+                expected_value =
+                    simd::add(expected_value, simd::load(block.expected_values(term) + shard));
+                variance = simd::add(variance, simd::load(block.variances(term) + shard));
+            }
+            simd::store(expected_values + shard, expected_value);
+            simd::store(variances + shard, variance);
+        }
+        return end;
+    }
+
+    /// Products of frequencies are scaled down by this factor whenever they
+    /// exceed it, so they neither overflow nor lose precision.
+    constexpr double frequency_scale = 0x1p512;
+
+    /// Returns the logarithm of `all` of a shard of size `size`, given the
+    /// fraction of its documents containing any term, and the product of
+    /// term frequencies scaled down `scale_count` times by `frequency_scale`.
+    [[nodiscard]] inline auto log_all_of(double size,
+                                         double any_fraction,
+                                         double product,
+                                         double scale_count,
+                                         std::size_t term_count) -> double
+    {
+        double const log_any = std::log(size * any_fraction);
+        if (product == 0.0 || log_any == -std::numeric_limits<double>::infinity()) {
+            return -std::numeric_limits<double>::infinity();
+        }
+        return std::log(product) + scale_count * std::log(frequency_scale)
+            - static_cast<double>(term_count - 1) * log_any;
+    }
+
+    // The fraction of documents containing any term is accumulated as
+    // `a + x (1 - a)`, which equals `1 - (1 - a)(1 - x)` without cancellation,
+    // so that `any` is accurate even for terms much rarer than the shard size.
+    template<typename Block>
+    void log_all_scalar(Block const& block, std::size_t first, std::size_t last, double* log_all)
+    {
+        double const* sizes = block.collection_sizes();
+        for (std::size_t shard = first; shard < last; shard++) {
+            double any_fraction = 0.0;
+            double product = 1.0;
+            double scale_count = 0.0;
+            for (std::size_t term = 0; term < block.term_count(); term++) {
+                double const freq = block.frequencies(term)[shard];
+                any_fraction += freq / sizes[shard] * (1.0 - any_fraction);
+                product *= freq;
+                if (frequency_scale < product) {
+                    product /= frequency_scale;
+                    scale_count += 1.0;
+                }
+            }
+            log_all[shard] = log_all_of(
+                sizes[shard], any_fraction, product, scale_count, block.term_count());
+        }
+    }
+
+    template<typename Block>
+    auto log_all_simd(Block const& block, double* log_all) -> std::size_t
+    {
+        std::size_t const end = block.shard_count() - block.shard_count() % simd::width;
+        simd::Vector const one = simd::broadcast(1.0);
+        simd::Vector const scale = simd::broadcast(frequency_scale);
+        double lane_any_fraction[simd::width];
+        double lane_product[simd::width];
+        double lane_scale_count[simd::width];
+        for (std::size_t shard = 0; shard < end; shard += simd::width) {
+            simd::Vector const size = simd::load(block.collection_sizes() + shard);
+            simd::Vector any_fraction = simd::broadcast(0.0);
+            simd::Vector product = one;
+            simd::Vector scale_count = simd::broadcast(0.0);
+            for (std::size_t term = 0; term < block.term_count(); term++) {
+                simd::Vector const freq = simd::load(block.frequencies(term) + shard);
+                any_fraction = simd::add(
+                    any_fraction, simd::mul(simd::div(freq, size), simd::sub(one, any_fraction)));
+                product = simd::mul(product, freq);
+                auto const overflow = simd::less(scale, product);
+                product = simd::select(overflow, simd::div(product, scale), product);
+                scale_count = simd::select(overflow, simd::add(scale_count, one), scale_count);
+            }
+            simd::store(lane_any_fraction, any_fraction);
+            simd::store(lane_product, product);
+            simd::store(lane_scale_count, scale_count);
+            for (std::size_t lane = 0; lane < simd::width; lane++) {
+                log_all[shard + lane] = log_all_of(block.collection_sizes()[shard + lane],
+                                                   lane_any_fraction[lane],
+                                                   lane_product[lane],
+                                                   lane_scale_count[lane],
+                                                   block.term_count());
+            }
+        }
+        return end;
+    }
+
+}  // namespace detail
+
+/// Computes `all` of every shard in `block` and writes it to `all`.
+///
+/// Uses the SIMD wrappers of `simd.hpp`, i.e., AVX-512 or AVX2 if enabled at
+/// compile time (e.g., with `-march=native`), and scalar code otherwise. The
+/// results are exactly equal to those of `taily::all` computed for each shard.
+inline void all(Shard_Block const& block, double* all)
+{
+    std::size_t const end = detail::all_simd(block, all);
+    detail::all_scalar(block, end, block.shard_count(), all);
+}
+
+/// Computes the logarithm of `all` of every shard in `block` and writes it to
+/// `log_all`, without underflow for any number of terms.
+///
+/// Instead of a logarithm per term and shard, frequencies are multiplied with
+/// the SIMD wrappers of `simd.hpp` and rescaled by a power of two before they
+/// could overflow, so only two logarithms per shard are evaluated. The results
+/// agree with `taily::log_all` of each shard up to rounding.
+inline void log_all(Shard_Block const& block, double* log_all)
+{
+    std::size_t const end = detail::log_all_simd(block, log_all);
+    detail::log_all_scalar(block, end, block.shard_count(), log_all);
+}
+
+/// Sums expected values and variances of all terms for every shard in `block`.
+///
+/// The results are exactly equal to those of accumulating `Feature_Statistics`.
+inline void sum_moments(Shard_Block const& block, double* expected_values, double* variances)
+{
+    std::size_t const end = detail::moments_simd(block, expected_values, variances);
+    detail::moments_scalar(block, end, block.shard_count(), expected_values, variances);
+}
+
+/// Writes the IDs of the shards in which all terms of `block` occur to
+/// `shards`, in increasing order, and returns their number. Only these shards
+/// can have a positive `all`, and thus a positive score.
+///
+/// Only the occurrence bitmaps are read, 64 shards at a time, so this takes
+/// time proportional to the number of terms times the number of shards / 64,
+/// plus the number of candidates.
+///
+/// \tparam Block `Shard_Block` or a view with the same `occurrences` accessors
+template<typename Block>
+[[nodiscard]] auto candidate_shards(Block const& block, std::size_t* shards) -> std::size_t
+{
+    std::size_t count = 0;
+    std::size_t const word_count = block.word_count();
+    for (std::size_t word = 0; word < word_count; word++) {
+        std::size_t const tail = block.shard_count() % 64;
+        std::uint64_t bits = word + 1 < word_count || tail == 0
+            ? ~std::uint64_t{0}
+            : (std::uint64_t{1} << tail) - 1;
+        for (std::size_t term = 0; term < block.term_count() && bits != 0; term++) {
+            bits &= block.occurrences(term)[word];
+        }
+        for (; bits != 0; bits &= bits - 1) {
+            shards[count] = word * 64 + detail::trailing_zeros(bits);
+            count += 1;
+        }
+    }
+    return count;
+}
+
+namespace detail {
+
+    /// Some terms of a `Shard_Block`, the `term`-th of them being its row
+    /// `rows[term]`, with the accessors of a `Shard_Block` but nothing copied.
+    ///
+    /// This lets each query of a batch be scored from a block holding each
+    /// distinct term of the batch once.
+    class Block_Rows {
+    public:
+        Block_Rows(Shard_Block const& block, std::size_t const* rows, std::size_t term_count)
+            : m_block(block), m_rows(rows), m_term_count(term_count)
+        {}
+
+        [[nodiscard]] auto term_count() const -> std::size_t { return m_term_count; }
+        [[nodiscard]] auto shard_count() const -> std::size_t { return m_block.shard_count(); }
+        [[nodiscard]] auto word_count() const -> std::size_t { return m_block.word_count(); }
+
+        [[nodiscard]] auto occurrences(std::size_t term) const -> std::uint64_t const*
+        {
+            return m_block.occurrences(m_rows[term]);
+        }
+
+        [[nodiscard]] auto collection_sizes() const -> double const*
+        {
+            return m_block.collection_sizes();
+        }
+
+        [[nodiscard]] auto frequencies(std::size_t term) const -> double const*
+        {
+            return m_block.frequencies(m_rows[term]);
+        }
+
+        [[nodiscard]] auto expected_values(std::size_t term) const -> double const*
+        {
+            return m_block.expected_values(m_rows[term]);
+        }
+
+        [[nodiscard]] auto variances(std::size_t term) const -> double const*
+        {
+            return m_block.variances(m_rows[term]);
+        }
+
+    private:
+        Shard_Block const& m_block;
+        std::size_t const* m_rows;
+        std::size_t m_term_count;
+    };
+
+    /// Statistics of some shards of a `Shard_Block` or `Block_Rows`, gathered
+    /// into contiguous arrays allocated from an arena, with the accessors used
+    /// by the kernels.
+    class Gathered_Block {
+    public:
+        template<typename Block>
+        Gathered_Block(Block const& block,
+                       std::size_t const* shards,
+                       std::size_t count,
+                       Arena& arena)
+            : m_term_count(block.term_count()),
+              m_shard_count(count),
+              m_collection_sizes(arena.allocate<double>(count)),
+              m_frequencies(arena.allocate<double>(m_term_count * count)),
+              m_expected_values(arena.allocate<double>(m_term_count * count)),
+              m_variances(arena.allocate<double>(m_term_count * count))
+        {
+            for (std::size_t idx = 0; idx < count; idx++) {
+                m_collection_sizes[idx] = block.collection_sizes()[shards[idx]];
+            }
+            for (std::size_t term = 0; term < m_term_count; term++) {
+                double const* frequencies = block.frequencies(term);
+                double const* expected_values = block.expected_values(term);
+                double const* variances = block.variances(term);
+                std::size_t const offset = term * count;
+                for (std::size_t idx = 0; idx < count; idx++) {
+                    m_frequencies[offset + idx] = frequencies[shards[idx]];
+                    m_expected_values[offset + idx] = expected_values[shards[idx]];
+                    m_variances[offset + idx] = variances[shards[idx]];
+                }
+            }
+        }
+
+        [[nodiscard]] auto term_count() const -> std::size_t { return m_term_count; }
+        [[nodiscard]] auto shard_count() const -> std::size_t { return m_shard_count; }
+        [[nodiscard]] auto collection_sizes() const -> double const* { return m_collection_sizes; }
+
+        [[nodiscard]] auto frequencies(std::size_t term) const -> double const*
+        {
+            return m_frequencies + term * m_shard_count;
+        }
+
+        [[nodiscard]] auto expected_values(std::size_t term) const -> double const*
+        {
+            return m_expected_values + term * m_shard_count;
+        }
+
+        [[nodiscard]] auto variances(std::size_t term) const -> double const*
+        {
+            return m_variances + term * m_shard_count;
+        }
+
+    private:
+        std::size_t m_term_count;
+        std::size_t m_shard_count;
+        double* m_collection_sizes;
+        double* m_frequencies;
+        double* m_expected_values;
+        double* m_variances;
+    };
+
+    /// Writes `all` of all shards of `block` to `coefficients`, or its
+    /// logarithm in `Domain::log`.
+    template<typename Block>
+    void all_coefficients(Block const& block, double* coefficients, Domain domain)
+    {
+        std::size_t const shard_count = block.shard_count();
+        if (domain == Domain::log) {
+            std::size_t const end = log_all_simd(block, coefficients);
+            log_all_scalar(block, end, shard_count, coefficients);
+        } else {
+            std::size_t const end = all_simd(block, coefficients);
+            all_scalar(block, end, shard_count, coefficients);
+        }
+    }
+
+    /// Gamma distributions fitted to shards, waiting to be evaluated together,
+    /// each at the cutoff of its query, and combined with the coefficient of
+    /// its shard. The arrays are allocated from an arena.
+    struct Pending_Cdfs {
+        Pending_Cdfs(std::size_t capacity, Arena& arena)
+            : capacity(capacity),
+              dists(arena.allocate<Gamma_Parameters>(capacity)),
+              cutoffs(arena.allocate<double>(capacity)),
+              coefficients(arena.allocate<double*>(capacity)),
+              cdfs(arena.allocate<double>(capacity))
+        {}
+
+        std::size_t capacity;
+        Gamma_Parameters* dists;
+        double* cutoffs;
+        double** coefficients;
+        double* cdfs;
+        std::size_t count = 0;
+    };
+
+    /// Fits gamma distributions to the shards of `block` and appends them to
+    /// `pending`, to be evaluated at `cutoff`, and returns their number.
+    ///
+    /// The coefficient of shard `s` of `block` is `coefficients[s]`, or
+    /// `coefficients[shards[s]]` if `shards` is given. Shards without a
+    /// fitted distribution have a CDF of zero, so their coefficients are set
+    /// right away. `pending` must have room for all shards of `block`.
+    template<typename Block>
+    auto fit_shards(Block const& block,
+                    double const cutoff,
+                    double* coefficients,
+                    std::size_t const* shards,
+                    Arena& arena,
+                    Domain domain,
+                    Pending_Cdfs& pending) -> std::size_t
+    {
+        std::size_t const shard_count = block.shard_count();
+        auto* expected_values = arena.allocate<double>(shard_count);
+        auto* variances = arena.allocate<double>(shard_count);
+        std::size_t const end = moments_simd(block, expected_values, variances);
+        moments_scalar(block, end, shard_count, expected_values, variances);
+        std::size_t fitted_count = 0;
+        for (std::size_t shard = 0; shard < shard_count; shard++) {
+            double& coefficient = coefficients[shards != nullptr ? shards[shard] : shard];
+            if (expected_values[shard] == 0 || variances[shard] == 0) {
+                coefficient = domain == Domain::log ? -std::numeric_limits<double>::infinity()
+                                                    : 0.0 * coefficient;
+            } else {
+                std::size_t const idx = pending.count + fitted_count;
+                pending.dists[idx] = fit_gamma({expected_values[shard], variances[shard], 0});
+                pending.cutoffs[idx] = cutoff;
+                pending.coefficients[idx] = &coefficient;
+                fitted_count += 1;
+            }
+        }
+        pending.count += fitted_count;
+        return fitted_count;
+    }
+
+    /// Evaluates all distributions in `pending` with a single call to the
+    /// batch `complement_cdf`, combines them with their coefficients, and
+    /// empties `pending`.
+    template<typename Gamma>
+    void evaluate_cdfs(Pending_Cdfs& pending, Domain domain)
+    {
+        complement_cdf<Gamma>(pending.dists, pending.count, pending.cutoffs, pending.cdfs);
+        for (std::size_t idx = 0; idx < pending.count; idx++) {
+            double& coefficient = *pending.coefficients[idx];
+            coefficient = domain == Domain::log ? std::log(pending.cdfs[idx]) + coefficient
+                                                : pending.cdfs[idx] * coefficient;
+        }
+        pending.count = 0;
+    }
+
+    /// Normalizes unnormalized shard coefficients in `scores` to sum up to
+    /// `ntop`; in `Domain::log`, they are given by their logarithms.
+    inline void normalize_scores(double* scores, std::size_t count, int ntop, Domain domain)
+    {
+        if (domain == Domain::log) {
+            normalize_log_scores(scores, count, ntop);
+            return;
+        }
+        double const normalization_factor = std::accumulate(scores, scores + count, 0.0);
+        auto normalize = [ntop, normalization_factor](auto const& element) {
+            return normalization_factor > 0 ? element * ntop / normalization_factor : 0.0;
+        };
+        std::transform(scores, scores + count, scores, normalize);
+    }
+
+    /// Writes unnormalized score coefficients of all shards of `block` to
+    /// `coefficients` (their logarithms in `Domain::log`), and returns the
+    /// number of shards whose gamma distribution was evaluated.
+    template<typename Gamma, typename Block, typename Instrumentation>
+    auto shard_coefficients(Block const& block,
+                            Query_Statistics const& global_stats,
+                            int const ntop,
+                            double* coefficients,
+                            Arena& arena,
+                            Domain domain,
+                            Instrumentation& instrumentation) -> std::size_t
+    {
+        instrumentation.start(Phase::all);
+        all_coefficients(block, coefficients, domain);
+        instrumentation.stop(Phase::all);
+
+        instrumentation.start(Phase::cutoff);
+        double const global_cutoff = estimate_cutoff<Gamma>(global_stats, ntop, domain);
+        instrumentation.stop(Phase::cutoff);
+
+        instrumentation.start(Phase::cdf);
+        std::size_t fitted_count = 0;
+        if (global_cutoff > 0) {
+            Pending_Cdfs pending(block.shard_count(), arena);
+            fitted_count =
+                fit_shards(block, global_cutoff, coefficients, nullptr, arena, domain, pending);
+            evaluate_cdfs<Gamma>(pending, domain);
+        }
+        instrumentation.stop(Phase::cdf);
+        return fitted_count;
+    }
+
+}  // namespace detail
+
+/// Scores shards given by `block`, computing `all` and accumulated moments with
+/// the SIMD kernels above, and evaluating gamma distributions of all shards with
+/// a single call to the batch `complement_cdf` (vectorized for `Fast_Gamma`).
+/// The scores are exactly equal to those of `score_shards` for the same
+/// statistics if `Gamma` has no batch overload, and within its error bounds
+/// otherwise.
+///
+/// Shards in which some term does not occur have an `all` of zero, so they
+/// are found with `candidate_shards` first and scored zero right away. If
+/// there are any, statistics of the remaining candidates are gathered, and
+/// all further work is proportional to the number of candidates.
+///
+/// Temporary arrays are allocated from `arena`, which is not reset, so no
+/// memory is allocated once the arena is big enough.
+///
+/// \param global_stats Term statistics for the entire collection
+/// \param block Term statistics for individual shards
+/// \param ntop The parameter to Taily algorithm saying how many top results we
+/// are shooting for
+/// \param scores Output shard scores, one for each shard in `block`
+/// \param arena Memory for temporary arrays
+/// \param domain Domain of `any` and `all`; in `Domain::log`, `log_all` is used
+/// \param instrumentation Instrumentation timing the phases of scoring, such as
+/// `Latency_Recorder`; by default, nothing is recorded at no cost
+template<typename Gamma = Exact_Gamma, typename Instrumentation = No_Instrumentation>
+void score_shards(Query_Statistics const& global_stats,
+                  Shard_Block const& block,
+                  int const ntop,
+                  double* scores,
+                  Arena& arena,
+                  Domain domain = Domain::linear,
+                  Instrumentation&& instrumentation = {})
+{
+    std::size_t const shard_count = block.shard_count();
+    instrumentation.start(Phase::candidates);
+    auto* candidates = arena.allocate<std::size_t>(shard_count);
+    std::size_t const candidate_count = candidate_shards(block, candidates);
+    std::size_t fitted_count = 0;
+    if (candidate_count == shard_count) {
+        instrumentation.stop(Phase::candidates);
+        fitted_count = detail::shard_coefficients<Gamma>(
+            block, global_stats, ntop, scores, arena, domain, instrumentation);
+    } else {
+        detail::Gathered_Block gathered(block, candidates, candidate_count, arena);
+        instrumentation.stop(Phase::candidates);
+        auto* coefficients = arena.allocate<double>(candidate_count);
+        fitted_count = detail::shard_coefficients<Gamma>(
+            gathered, global_stats, ntop, coefficients, arena, domain, instrumentation);
+        std::fill_n(scores,
+                    shard_count,
+                    domain == Domain::log ? -std::numeric_limits<double>::infinity() : 0.0);
+        for (std::size_t idx = 0; idx < candidate_count; idx++) {
+            scores[candidates[idx]] = coefficients[idx];
+        }
+    }
+
+    instrumentation.start(Phase::normalization);
+    detail::normalize_scores(scores, shard_count, ntop, domain);
+    instrumentation.stop(Phase::normalization);
+
+    bool const has_cutoff = !global_stats.term_stats.empty();
+    instrumentation.count(Counter::shards_evaluated, fitted_count);
+    instrumentation.count(Counter::shards_skipped, shard_count - fitted_count);
+    instrumentation.count(Counter::gamma_evaluations, fitted_count + (has_cutoff ? 1 : 0));
+}
+
+/// Scores shards given by `block`, allocating temporary arrays for this call only.
+template<typename Gamma = Exact_Gamma>
+void score_shards(Query_Statistics const& global_stats,
+                  Shard_Block const& block,
+                  int const ntop,
+                  double* scores,
+                  Domain domain = Domain::linear)
+{
+    Arena arena;
+    score_shards<Gamma>(global_stats, block, ntop, scores, arena, domain);
+}
+
+}  // namespace taily
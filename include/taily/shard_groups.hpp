@@ -0,0 +1,288 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <ostream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <taily.hpp>
+#include <taily/stats_store.hpp>
+
+namespace taily {
+
+/// Partition of shards into groups (super-shards).
+class Shard_Groups {
+public:
+    /// Constructs groups from the group ID of each shard.
+    explicit Shard_Groups(std::vector<std::size_t> const& shard_groups)
+    {
+        std::size_t const group_count =
+            shard_groups.empty() ? 0
+                                 : *std::max_element(shard_groups.begin(), shard_groups.end()) + 1;
+        m_offsets.assign(group_count + 1, 0);
+        for (auto group : shard_groups) {
+            m_offsets[group + 1] += 1;
+        }
+        std::partial_sum(m_offsets.begin(), m_offsets.end(), m_offsets.begin());
+        m_shards.resize(shard_groups.size());
+        auto positions = m_offsets;
+        for (std::size_t shard = 0; shard < shard_groups.size(); shard++) {
+            m_shards[positions[shard_groups[shard]]++] = shard;
+        }
+    }
+
+    /// Groups consecutive shards into groups of `group_size` shards.
+    [[nodiscard]] static auto consecutive(std::size_t shard_count, std::size_t group_size)
+        -> Shard_Groups
+    {
+        if (group_size == 0) {
+            throw std::invalid_argument("group size must be positive");
+        }
+        std::vector<std::size_t> shard_groups(shard_count);
+        for (std::size_t shard = 0; shard < shard_count; shard++) {
+            shard_groups[shard] = shard / group_size;
+        }
+        return Shard_Groups(shard_groups);
+    }
+
+    [[nodiscard]] auto group_count() const -> std::size_t { return m_offsets.size() - 1; }
+    [[nodiscard]] auto shard_count() const -> std::size_t { return m_shards.size(); }
+
+    /// Returns the sorted shards of `group`.
+    [[nodiscard]] auto shards(std::size_t group) const
+        -> std::pair<std::size_t const*, std::size_t const*>
+    {
+        return {m_shards.data() + m_offsets[group], m_shards.data() + m_offsets[group + 1]};
+    }
+
+private:
+    std::vector<std::size_t> m_offsets{};
+    std::vector<std::size_t> m_shards{};
+};
+
+/// Writes statistics of shard groups in the format of `Sharded_Stats_Writer`,
+/// where groups take the place of shards.
+///
+/// The statistics of a term in a group are merged exactly from the statistics
+/// of the term in the shards of the group, and the global statistics are copied.
+/// The size of a group is the sum of the sizes of its shards.
+inline void write_group_stats(Sharded_Stats_Store const& store,
+                              Shard_Groups const& groups,
+                              std::ostream& os)
+{
+    if (groups.shard_count() != store.shard_count()) {
+        throw std::invalid_argument("groups must partition all shards of the store");
+    }
+    std::vector<std::int64_t> group_sizes(groups.group_count(), 0);
+    for (std::size_t group = 0; group < groups.group_count(); group++) {
+        auto [first, last] = groups.shards(group);
+        for (; first != last; ++first) {
+            group_sizes[group] += store.shard_sizes()[*first];
+        }
+    }
+    Sharded_Stats_Writer writer(os, store.term_count(), group_sizes);
+    std::vector<Feature_Statistics> group_stats(groups.group_count());
+    for (std::size_t term = 0; term < store.term_count(); term++) {
+        Feature_Statistics const* shard_stats = store.row(term) + 1;
+        for (std::size_t group = 0; group < groups.group_count(); group++) {
+            Feature_Accumulator accumulator;
+            auto [first, last] = groups.shards(group);
+            for (; first != last; ++first) {
+                accumulator += Feature_Accumulator::from_stats(shard_stats[*first]);
+            }
+            group_stats[group] = accumulator.stats();
+        }
+        writer.write_term(store.global(term), group_stats);
+    }
+}
+
+/// Selects shards by first bounding the scores of shard groups, and then
+/// scoring only the shards of groups that can contain a shard with a score
+/// above `threshold`.
+///
+/// The coefficient of a shard (its score before normalization) never
+/// exceeds the lowest frequency of any query term in that shard, so the sum
+/// of coefficients of the shards in a group is bounded by the lowest group
+/// frequency of any query term. Groups are visited in the order of decreasing
+/// bounds. The normalization factor of `score_shards` is then at least the sum
+/// `N` of coefficients scored so far, and at most `N + P`, where `P` is the sum
+/// of bounds of the groups not visited yet. Visiting stops once both:
+///  - the bound of the next group, normalized by `N`, is at most `threshold`,
+///    so no shard of the remaining groups could score above `threshold`, and
+///  - every scored shard is either above `threshold` when normalized by
+///    `N + P`, or not above it when normalized by `N`.
+///
+/// Scored coefficients are kept sorted, so the second condition is checked
+/// by looking for a coefficient between `threshold * N / ntop` and
+/// `threshold * (N + P) / ntop` in logarithmic time. In the log domain,
+/// coefficients, `N`, and the bounds are compared as logarithms, so long
+/// queries of rare terms are not lost to underflow.
+///
+/// The selected shards are thus exactly those that `select_shards_above`
+/// selects in the same domain, up to rounding. Their scores are normalized by
+/// `N + P`, so they are lower bounds of the scores returned by `score_shards`,
+/// and equal to them, up to rounding, if no group was skipped.
+///
+/// \param shard_store Statistics of the index and its shards
+/// \param group_store Statistics of the index and its groups, written by `write_group_stats`
+/// \param groups Partition of shards into groups
+/// \param terms Query term IDs
+/// \param collection_size Size of the entire collection
+/// \param shard_sizes Sizes of the shards
+/// \param ntop The parameter to Taily algorithm saying how many top results we
+/// are shooting for
+/// \param threshold Minimum score (exclusive) of a selected shard
+/// \param domain Domain of `any` and `all`
+/// \return Selected shards ordered by descending score
+template<typename Gamma = Exact_Gamma, typename Term_Range>
+[[nodiscard]] auto select_shards(Sharded_Stats_Store const& shard_store,
+                                 Sharded_Stats_Store const& group_store,
+                                 Shard_Groups const& groups,
+                                 Term_Range const& terms,
+                                 std::int64_t const collection_size,
+                                 std::vector<std::int64_t> const& shard_sizes,
+                                 int const ntop,
+                                 double const threshold,
+                                 Domain domain = Domain::linear) -> std::vector<Shard_Score>
+{
+    if (group_store.shard_count() != groups.group_count()
+        || shard_store.shard_count() != groups.shard_count()
+        || group_store.term_count() != shard_store.term_count()) {
+        throw std::invalid_argument("shard groups do not match the stores");
+    }
+    if (shard_sizes.size() != shard_store.shard_count()) {
+        throw std::invalid_argument("expected " + std::to_string(shard_store.shard_count())
+                                    + " shard sizes but got "
+                                    + std::to_string(shard_sizes.size()));
+    }
+    auto const global_stats = shard_store.global_query_stats(terms, collection_size);
+    double const global_cutoff = estimate_cutoff<Gamma>(global_stats, ntop, domain);
+
+    struct Group_Bound {
+        std::size_t group;
+        double bound;
+    };
+    std::vector<Group_Bound> bounds;
+    bounds.reserve(groups.group_count());
+    for (std::size_t group = 0; group < groups.group_count(); group++) {
+        auto bound = std::numeric_limits<double>::infinity();
+        for (auto term : terms) {
+            bound = std::min(bound, double(group_store.shard(term, group).frequency));
+        }
+        if (bound > 0) {
+            bounds.push_back({group, bound});
+        }
+    }
+    std::sort(bounds.begin(), bounds.end(), [](auto const& lhs, auto const& rhs) {
+        return lhs.bound > rhs.bound || (lhs.bound == rhs.bound && lhs.group < rhs.group);
+    });
+
+    // Sums of bounds of the groups from each position onwards.
+    std::vector<double> remaining_bounds(bounds.size() + 1, 0.0);
+    for (std::size_t idx = bounds.size(); idx > 0; idx--) {
+        remaining_bounds[idx - 1] = remaining_bounds[idx] + bounds[idx - 1].bound;
+    }
+
+    // All comparisons are made between logarithms: a coefficient `c` is above
+    // `threshold` when normalized by `F` if `log(c) > log_threshold + log(F)`.
+    double const log_threshold = std::log(threshold) - std::log(double(ntop));
+    auto log_coefficient = [domain](double coef) {
+        return domain == Domain::log ? coef : std::log(coef);
+    };
+    auto log_sum = [](double log_lhs, double log_rhs) {
+        double const high = std::max(log_lhs, log_rhs);
+        if (high == -std::numeric_limits<double>::infinity()) {
+            return high;
+        }
+        return high + std::log(std::exp(log_lhs - high) + std::exp(log_rhs - high));
+    };
+
+    std::vector<Shard_Score> scored;
+    std::multiset<double> log_coefficients;
+    detail::Score_Normalizer normalize(domain, ntop);
+    Query_Statistics shard_stats{std::vector<Feature_Statistics>(std::size(terms)), 0};
+    auto undecided = [&](double log_factor, double log_remaining) {
+        double const low = log_threshold + log_factor;
+        double const high = log_threshold + log_sum(log_factor, log_remaining);
+        auto pos = log_coefficients.upper_bound(low);
+        return pos != log_coefficients.end() && *pos <= high;
+    };
+    std::size_t visited = 0;
+    for (; visited < bounds.size(); visited++) {
+        auto const& [group, bound] = bounds[visited];
+        if (normalize.nonzero_sum()) {
+            double const log_factor = normalize.log_sum();
+            if (std::log(bound) <= log_threshold + log_factor
+                && !undecided(log_factor, std::log(remaining_bounds[visited]))) {
+                break;
+            }
+        }
+        auto [first, last] = groups.shards(group);
+        for (; first != last; ++first) {
+            std::size_t const shard = *first;
+            std::size_t idx = 0;
+            for (auto term : terms) {
+                shard_stats.term_stats[idx++] = shard_store.shard(term, shard);
+            }
+            shard_stats.collection_size = shard_sizes[shard];
+            double const coef =
+                detail::shard_coefficient<Gamma>(global_cutoff, shard_stats, domain);
+            if (normalize.nonzero(coef)) {
+                normalize.add(coef);
+                scored.push_back({shard, coef});
+                log_coefficients.insert(log_coefficient(coef));
+            }
+        }
+    }
+
+    std::vector<Shard_Score> selected;
+    if (!normalize.nonzero_sum()) {
+        return selected;
+    }
+    double const log_bound =
+        log_sum(normalize.log_sum(), std::log(remaining_bounds[visited])) - std::log(double(ntop));
+    for (auto const& [shard, coef] : scored) {
+        double const score = std::exp(log_coefficient(coef) - log_bound);
+        if (score > threshold) {
+            selected.push_back({shard, score});
+        }
+    }
+    std::sort(selected.begin(), selected.end(), selected_before);
+    return selected;
+}
+
+}  // namespace taily
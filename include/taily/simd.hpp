@@ -0,0 +1,259 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace taily::simd {
+
+/// Minimal wrappers of SIMD operations on vectors of doubles, used to write
+/// a kernel once for all instruction sets. The widest of AVX-512 and AVX2
+/// enabled at compile time is used; otherwise, vectors are single doubles.
+///
+/// Comparisons are ordered: they return false if either operand is NaN.
+
+#if defined(__AVX512F__)
+
+constexpr std::size_t width = 8;
+using Vector = __m512d;
+using Mask = __mmask8;
+
+[[nodiscard]] inline auto load(double const* ptr) -> Vector
+{
+    return _mm512_loadu_pd(ptr);
+}
+
+inline void store(double* ptr, Vector v)
+{
+    _mm512_storeu_pd(ptr, v);
+}
+
+[[nodiscard]] inline auto broadcast(double value) -> Vector
+{
+    return _mm512_set1_pd(value);
+}
+
+[[nodiscard]] inline auto add(Vector lhs, Vector rhs) -> Vector
+{
+    return _mm512_add_pd(lhs, rhs);
+}
+
+[[nodiscard]] inline auto sub(Vector lhs, Vector rhs) -> Vector
+{
+    return _mm512_sub_pd(lhs, rhs);
+}
+
+[[nodiscard]] inline auto mul(Vector lhs, Vector rhs) -> Vector
+{
+    return _mm512_mul_pd(lhs, rhs);
+}
+
+[[nodiscard]] inline auto div(Vector lhs, Vector rhs) -> Vector
+{
+    return _mm512_div_pd(lhs, rhs);
+}
+
+[[nodiscard]] inline auto abs(Vector v) -> Vector
+{
+    return _mm512_abs_pd(v);
+}
+
+[[nodiscard]] inline auto less(Vector lhs, Vector rhs) -> Mask
+{
+    return _mm512_cmp_pd_mask(lhs, rhs, _CMP_LT_OQ);
+}
+
+[[nodiscard]] inline auto equal(Vector lhs, Vector rhs) -> Mask
+{
+    return _mm512_cmp_pd_mask(lhs, rhs, _CMP_EQ_OQ);
+}
+
+[[nodiscard]] inline auto select(Mask mask, Vector if_true, Vector if_false) -> Vector
+{
+    return _mm512_mask_blend_pd(mask, if_false, if_true);
+}
+
+[[nodiscard]] inline auto and_not(Mask lhs, Mask rhs) -> Mask
+{
+    return lhs & static_cast<Mask>(~rhs);
+}
+
+[[nodiscard]] inline auto none(Mask mask) -> bool
+{
+    return mask == 0;
+}
+
+#elif defined(__AVX2__)
+
+constexpr std::size_t width = 4;
+using Vector = __m256d;
+using Mask = __m256d;
+
+[[nodiscard]] inline auto load(double const* ptr) -> Vector
+{
+    return _mm256_loadu_pd(ptr);
+}
+
+inline void store(double* ptr, Vector v)
+{
+    _mm256_storeu_pd(ptr, v);
+}
+
+[[nodiscard]] inline auto broadcast(double value) -> Vector
+{
+    return _mm256_set1_pd(value);
+}
+
+[[nodiscard]] inline auto add(Vector lhs, Vector rhs) -> Vector
+{
+    return _mm256_add_pd(lhs, rhs);
+}
+
+[[nodiscard]] inline auto sub(Vector lhs, Vector rhs) -> Vector
+{
+    return _mm256_sub_pd(lhs, rhs);
+}
+
+[[nodiscard]] inline auto mul(Vector lhs, Vector rhs) -> Vector
+{
+    return _mm256_mul_pd(lhs, rhs);
+}
+
+[[nodiscard]] inline auto div(Vector lhs, Vector rhs) -> Vector
+{
+    return _mm256_div_pd(lhs, rhs);
+}
+
+[[nodiscard]] inline auto abs(Vector v) -> Vector
+{
+    return _mm256_andnot_pd(_mm256_set1_pd(-0.0), v);
+}
+
+[[nodiscard]] inline auto less(Vector lhs, Vector rhs) -> Mask
+{
+    return _mm256_cmp_pd(lhs, rhs, _CMP_LT_OQ);
+}
+
+[[nodiscard]] inline auto equal(Vector lhs, Vector rhs) -> Mask
+{
+    return _mm256_cmp_pd(lhs, rhs, _CMP_EQ_OQ);
+}
+
+[[nodiscard]] inline auto select(Mask mask, Vector if_true, Vector if_false) -> Vector
+{
+    return _mm256_blendv_pd(if_false, if_true, mask);
+}
+
+[[nodiscard]] inline auto and_not(Mask lhs, Mask rhs) -> Mask
+{
+    return _mm256_andnot_pd(rhs, lhs);
+}
+
+[[nodiscard]] inline auto none(Mask mask) -> bool
+{
+    return _mm256_movemask_pd(mask) == 0;
+}
+
+#else
+
+constexpr std::size_t width = 1;
+using Vector = double;
+using Mask = bool;
+
+[[nodiscard]] inline auto load(double const* ptr) -> Vector
+{
+    return *ptr;
+}
+
+inline void store(double* ptr, Vector v)
+{
+    *ptr = v;
+}
+
+[[nodiscard]] inline auto broadcast(double value) -> Vector
+{
+    return value;
+}
+
+[[nodiscard]] inline auto add(Vector lhs, Vector rhs) -> Vector
+{
+    return lhs + rhs;
+}
+
+[[nodiscard]] inline auto sub(Vector lhs, Vector rhs) -> Vector
+{
+    return lhs - rhs;
+}
+
+[[nodiscard]] inline auto mul(Vector lhs, Vector rhs) -> Vector
+{
+    return lhs * rhs;
+}
+
+[[nodiscard]] inline auto div(Vector lhs, Vector rhs) -> Vector
+{
+    return lhs / rhs;
+}
+
+[[nodiscard]] inline auto abs(Vector v) -> Vector
+{
+    return std::abs(v);
+}
+
+[[nodiscard]] inline auto less(Vector lhs, Vector rhs) -> Mask
+{
+    return lhs < rhs;
+}
+
+[[nodiscard]] inline auto equal(Vector lhs, Vector rhs) -> Mask
+{
+    return lhs == rhs;
+}
+
+[[nodiscard]] inline auto select(Mask mask, Vector if_true, Vector if_false) -> Vector
+{
+    return mask ? if_true : if_false;
+}
+
+[[nodiscard]] inline auto and_not(Mask lhs, Mask rhs) -> Mask
+{
+    return lhs && !rhs;
+}
+
+[[nodiscard]] inline auto none(Mask mask) -> bool
+{
+    return !mask;
+}
+
+#endif
+
+}  // namespace taily::simd
@@ -0,0 +1,287 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <taily/query_cache.hpp>
+#include <taily/stats_store.hpp>
+
+namespace taily {
+
+/// Statistics of one build of an index: a memory-mapped stats store and,
+/// optionally, gamma parameters fitted to it.
+///
+/// A snapshot is immutable and is shared by all queries using it, so loading
+/// it only maps the files and reads their headers.
+class Stats_Snapshot {
+public:
+    explicit Stats_Snapshot(std::string const& stats_file, Validation validation = Validation::lazy)
+        : m_store(stats_file, validation)
+    {}
+
+    /// Loads a stats store together with gamma parameters fitted to it.
+    ///
+    /// \throws std::invalid_argument if the gamma parameters do not match the store
+    Stats_Snapshot(std::string const& stats_file,
+                   std::string const& gamma_file,
+                   Validation validation = Validation::lazy)
+        : m_store(stats_file, validation), m_gammas(std::in_place, gamma_file, validation)
+    {
+        if (m_gammas->term_count() != m_store.term_count()
+            || m_gammas->shard_count() != m_store.shard_count()) {
+            throw std::invalid_argument("gamma parameters do not match the stats store");
+        }
+    }
+
+    [[nodiscard]] auto store() const -> Sharded_Stats_Store const& { return m_store; }
+
+    /// Returns the gamma parameters, or `nullptr` if the snapshot has none.
+    [[nodiscard]] auto gammas() const -> Gamma_Parameter_Store const*
+    {
+        return m_gammas ? &*m_gammas : nullptr;
+    }
+
+private:
+    Sharded_Stats_Store m_store;
+    std::optional<Gamma_Parameter_Store> m_gammas{};
+};
+
+/// Publishes stats snapshots to concurrent readers, in the style of RCU with
+/// hazard pointers.
+///
+/// Each query thread registers a `Reader`, which owns one of `max_readers`
+/// slots, and pins the current snapshot with `Reader::pin()` for the duration
+/// of a query. Pinning takes no lock and allocates nothing: it publishes the
+/// snapshot pointer in the reader's slot and re-reads the current snapshot to
+/// confirm it has not been replaced in the meantime, so a reader only retries
+/// if a publication races with it.
+///
+/// `publish()` swaps in a new snapshot with a single atomic exchange and
+/// retires the old one. Retired snapshots are destroyed, and thus unmapped,
+/// only by `publish()`, `reclaim()`, and `synchronize()`, once no slot pins
+/// them, so a query thread never unmaps a file. Publications are serialized by
+/// a mutex that readers never take. Until a retired snapshot is reclaimed, both
+/// snapshots are mapped, but their files are only read through the page cache,
+/// never copied.
+///
+/// Releasing the last pin of a retired snapshot does not reclaim it, so the
+/// publishing thread should call `synchronize()` after `publish()`, which
+/// returns once the queries still using the old snapshot have finished, or
+/// otherwise call `reclaim()` periodically; if neither is called, the old
+/// snapshot stays mapped until the next publication.
+///
+/// If a `Query_Cache` is attached, it is invalidated on each publication. To
+/// never cache scores of an old snapshot, pin the snapshot inside the function
+/// passed to `Query_Cache::get_or_compute`.
+///
+/// All readers must be destroyed before the publisher.
+class Snapshot_Publisher {
+    struct Slot;
+
+public:
+    /// A snapshot pinned by a `Reader`, which stays valid until the pin is
+    /// destroyed.
+    class Pin {
+    public:
+        Pin(Pin const&) = delete;
+        auto operator=(Pin const&) -> Pin& = delete;
+        Pin(Pin&& other) noexcept
+            : m_slot(std::exchange(other.m_slot, nullptr)), m_snapshot(other.m_snapshot)
+        {}
+        auto operator=(Pin&&) -> Pin& = delete;
+        ~Pin()
+        {
+            if (m_slot != nullptr) {
+                m_slot->pinned.store(nullptr, std::memory_order_release);
+            }
+        }
+
+        [[nodiscard]] auto operator*() const -> Stats_Snapshot const& { return *m_snapshot; }
+        [[nodiscard]] auto operator->() const -> Stats_Snapshot const* { return m_snapshot; }
+
+    private:
+        friend class Snapshot_Publisher;
+
+        Pin(Slot* slot, Stats_Snapshot const* snapshot) : m_slot(slot), m_snapshot(snapshot) {}
+
+        Slot* m_slot;
+        Stats_Snapshot const* m_snapshot;
+    };
+
+    /// A reader of snapshots, owning one slot of the publisher. A reader may
+    /// hold only one pin at a time, and must not be shared by threads; create
+    /// one per thread instead.
+    class Reader {
+    public:
+        /// \throws std::runtime_error if all `max_readers` slots are taken
+        explicit Reader(Snapshot_Publisher& publisher) : m_publisher(publisher)
+        {
+            for (std::size_t slot = 0; slot < publisher.m_slot_count; slot++) {
+                bool claimed = false;
+                if (publisher.m_slots[slot].claimed.compare_exchange_strong(
+                        claimed, true, std::memory_order_acquire)) {
+                    m_slot = &publisher.m_slots[slot];
+                    return;
+                }
+            }
+            throw std::runtime_error("all " + std::to_string(publisher.m_slot_count)
+                                     + " snapshot reader slots are taken");
+        }
+        Reader(Reader const&) = delete;
+        auto operator=(Reader const&) -> Reader& = delete;
+        ~Reader() { m_slot->claimed.store(false, std::memory_order_release); }
+
+        /// Pins the current snapshot.
+        [[nodiscard]] auto pin() -> Pin
+        {
+            Stats_Snapshot const* snapshot = m_publisher.m_current.load();
+            while (true) {
+                m_slot->pinned.store(snapshot);
+                // If the snapshot is still current after the slot is visible,
+                // it cannot be reclaimed until the slot is cleared.
+                Stats_Snapshot const* current = m_publisher.m_current.load();
+                if (current == snapshot) {
+                    return Pin(m_slot, snapshot);
+                }
+                snapshot = current;
+            }
+        }
+
+    private:
+        Snapshot_Publisher& m_publisher;
+        Slot* m_slot = nullptr;
+    };
+
+    using snapshot_type = std::unique_ptr<Stats_Snapshot const>;
+
+    explicit Snapshot_Publisher(snapshot_type initial,
+                                Query_Cache* cache = nullptr,
+                                std::size_t max_readers = 64)
+        : m_current(checked(std::move(initial)).release()),
+          m_cache(cache),
+          m_slot_count(max_readers),
+          m_slots(std::make_unique<Slot[]>(max_readers))
+    {}
+
+    Snapshot_Publisher(Snapshot_Publisher const&) = delete;
+    auto operator=(Snapshot_Publisher const&) -> Snapshot_Publisher& = delete;
+    ~Snapshot_Publisher() { delete m_current.load(); }
+
+    /// Replaces the current snapshot with `snapshot`, reclaims replaced
+    /// snapshots that are no longer pinned, and returns the number of
+    /// snapshots published so far.
+    auto publish(snapshot_type snapshot) -> std::uint64_t
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_retired.emplace_back(m_current.exchange(checked(std::move(snapshot)).release()));
+        reclaim_retired();
+        if (m_cache != nullptr) {
+            m_cache->invalidate();
+        }
+        return m_generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+    }
+
+    /// Destroys replaced snapshots that are no longer pinned, and returns the
+    /// number of replaced snapshots that are still pinned.
+    auto reclaim() -> std::size_t
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return reclaim_retired();
+    }
+
+    /// Waits until no replaced snapshot is pinned and destroys them all.
+    ///
+    /// Pins last for a query, so this waits for the queries that started
+    /// before the last publication. It must not be called by a thread
+    /// holding a pin.
+    void synchronize()
+    {
+        while (reclaim() > 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    /// Returns the number of snapshots published after the initial one.
+    [[nodiscard]] auto generation() const -> std::uint64_t
+    {
+        return m_generation.load(std::memory_order_acquire);
+    }
+
+private:
+    /// Slots are aligned to cache lines, so readers do not share them.
+    struct alignas(64) Slot {
+        std::atomic<Stats_Snapshot const*> pinned{nullptr};
+        std::atomic<bool> claimed{false};
+    };
+
+    [[nodiscard]] static auto checked(snapshot_type snapshot) -> snapshot_type
+    {
+        if (snapshot == nullptr) {
+            throw std::invalid_argument("cannot publish a null snapshot");
+        }
+        return snapshot;
+    }
+
+    auto reclaim_retired() -> std::size_t
+    {
+        m_pinned.clear();
+        for (std::size_t slot = 0; slot < m_slot_count; slot++) {
+            if (auto const* snapshot = m_slots[slot].pinned.load(); snapshot != nullptr) {
+                m_pinned.push_back(snapshot);
+            }
+        }
+        auto is_unpinned = [this](snapshot_type const& snapshot) {
+            return std::find(m_pinned.begin(), m_pinned.end(), snapshot.get()) == m_pinned.end();
+        };
+        m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(), is_unpinned),
+                        m_retired.end());
+        return m_retired.size();
+    }
+
+    std::atomic<Stats_Snapshot const*> m_current;
+    Query_Cache* m_cache;
+    std::size_t m_slot_count;
+    std::unique_ptr<Slot[]> m_slots;
+    std::atomic<std::uint64_t> m_generation{0};
+    std::mutex m_mutex{};
+    std::vector<snapshot_type> m_retired{};
+    std::vector<Stats_Snapshot const*> m_pinned{};
+};
+
+}  // namespace taily
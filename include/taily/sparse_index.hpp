@@ -0,0 +1,215 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <taily.hpp>
+#include <taily/stats_store.hpp>
+
+namespace taily {
+
+/// Shard statistics stored sparsely in compressed sparse row format.
+///
+/// For each term, only the shards in which the term occurs are stored, sorted
+/// by shard ID, together with the term statistics in these shards. Memory
+/// is proportional to the number of non-zero (term, shard) pairs.
+class Sparse_Shard_Index {
+public:
+    using shard_type = std::uint32_t;
+
+    /// Constructs an empty index over shards of sizes `shard_sizes`.
+    explicit Sparse_Shard_Index(std::vector<std::int64_t> shard_sizes)
+        : m_shard_sizes(std::move(shard_sizes))
+    {
+        // The largest shard ID is reserved as a sentinel when scoring.
+        if (m_shard_sizes.size() >= std::numeric_limits<shard_type>::max()) {
+            throw std::invalid_argument("too many shards");
+        }
+    }
+
+    /// Builds the index from a dense store.
+    [[nodiscard]] static auto from_store(Sharded_Stats_Store const& store,
+                                         std::vector<std::int64_t> shard_sizes)
+        -> Sparse_Shard_Index
+    {
+        if (shard_sizes.size() != store.shard_count()) {
+            throw std::invalid_argument("expected " + std::to_string(store.shard_count())
+                                        + " shard sizes but got "
+                                        + std::to_string(shard_sizes.size()));
+        }
+        Sparse_Shard_Index index(std::move(shard_sizes));
+        for (std::size_t term = 0; term < store.term_count(); term++) {
+            Feature_Statistics const* shards = store.row(term) + 1;
+            index.add_term(shards, shards + store.shard_count());
+        }
+        return index;
+    }
+
+    /// Appends the next term given its statistics in each consecutive shard.
+    ///
+    /// Shards in which the term does not occur are skipped.
+    ///
+    /// \throws std::invalid_argument if the range does not have exactly one
+    ///                               element per shard; the index is then unchanged
+    template<typename Forward_Iterator>
+    void add_term(Forward_Iterator first, Forward_Iterator last)
+    {
+        std::size_t const rollback = m_shards.size();
+        auto fail = [&](char const* message) {
+            m_shards.resize(rollback);
+            m_stats.resize(rollback);
+            throw std::invalid_argument(message);
+        };
+        shard_type shard = 0;
+        for (; first != last; ++first, ++shard) {
+            if (shard == m_shard_sizes.size()) {
+                fail("too many shard stats for term");
+            }
+            if (first->frequency != 0) {
+                m_shards.push_back(shard);
+                m_stats.push_back(*first);
+            }
+        }
+        if (shard != m_shard_sizes.size()) {
+            fail("too few shard stats for term");
+        }
+        m_offsets.push_back(m_shards.size());
+    }
+
+    [[nodiscard]] auto term_count() const -> std::size_t { return m_offsets.size() - 1; }
+    [[nodiscard]] auto shard_count() const -> std::size_t { return m_shard_sizes.size(); }
+    [[nodiscard]] auto shard_sizes() const -> std::vector<std::int64_t> const&
+    {
+        return m_shard_sizes;
+    }
+
+    /// Returns the number of shards in which `term` occurs.
+    [[nodiscard]] auto posting_count(std::size_t term) const -> std::size_t
+    {
+        return m_offsets[term + 1] - m_offsets[term];
+    }
+
+    /// Returns sorted IDs of the shards in which `term` occurs.
+    [[nodiscard]] auto shards(std::size_t term) const -> shard_type const*
+    {
+        return m_shards.data() + m_offsets[term];
+    }
+
+    /// Returns the statistics of `term` in shards given by `shards(term)`.
+    [[nodiscard]] auto stats(std::size_t term) const -> Feature_Statistics const*
+    {
+        return m_stats.data() + m_offsets[term];
+    }
+
+private:
+    std::vector<std::int64_t> m_shard_sizes;
+    std::vector<std::size_t> m_offsets{0};
+    std::vector<shard_type> m_shards{};
+    std::vector<Feature_Statistics> m_stats{};
+};
+
+/// Scores only the shards of `index` that contain at least one of `terms`.
+///
+/// Returns the scores of these shards sorted by shard ID. The scores are
+/// equal to those returned by the dense `score_shards` in the same domain, up
+/// to rounding in the log domain, and all the shards that are not returned
+/// have a score of zero.
+///
+/// \tparam Gamma Policy evaluating gamma distributions, such as `Exact_Gamma`
+/// \param global_stats Term statistics for the entire collection
+/// \param index Sparse shard statistics
+/// \param terms Query term IDs, in the same order as in `global_stats`
+/// \param ntop The parameter to Taily algorithm saying how many top results we
+/// are shooting for
+/// \param domain Domain of `any` and `all`
+template<typename Gamma = Exact_Gamma, typename Term_Range>
+[[nodiscard]] auto score_shards(Query_Statistics const& global_stats,
+                                Sparse_Shard_Index const& index,
+                                Term_Range const& terms,
+                                int const ntop,
+                                Domain domain = Domain::linear) -> std::vector<Shard_Score>
+{
+    using shard_type = Sparse_Shard_Index::shard_type;
+    struct Cursor {
+        shard_type const* shard;
+        shard_type const* end;
+        Feature_Statistics const* stats;
+    };
+    std::vector<Cursor> cursors;
+    cursors.reserve(std::size(terms));
+    for (auto term : terms) {
+        if (static_cast<std::size_t>(term) >= index.term_count()) {
+            throw std::out_of_range("term ID out of range: " + std::to_string(term));
+        }
+        shard_type const* shards = index.shards(term);
+        cursors.push_back({shards, shards + index.posting_count(term), index.stats(term)});
+    }
+
+    double const global_cutoff = estimate_cutoff<Gamma>(global_stats, ntop, domain);
+    detail::Score_Normalizer normalize(domain, ntop);
+    auto const no_shard = std::numeric_limits<shard_type>::max();
+    Query_Statistics shard_stats{std::vector<Feature_Statistics>(cursors.size()), 0};
+    std::vector<Shard_Score> scores;
+    while (true) {
+        shard_type shard = no_shard;
+        for (auto const& cursor : cursors) {
+            if (cursor.shard != cursor.end) {
+                shard = std::min(shard, *cursor.shard);
+            }
+        }
+        if (shard == no_shard) {
+            break;
+        }
+        for (std::size_t idx = 0; idx < cursors.size(); idx++) {
+            auto& cursor = cursors[idx];
+            if (cursor.shard != cursor.end && *cursor.shard == shard) {
+                shard_stats.term_stats[idx] = *cursor.stats;
+                ++cursor.shard;
+                ++cursor.stats;
+            } else {
+                shard_stats.term_stats[idx] = Feature_Statistics{0, 0, 0};
+            }
+        }
+        shard_stats.collection_size = index.shard_sizes()[shard];
+        double const coef = detail::shard_coefficient<Gamma>(global_cutoff, shard_stats, domain);
+        normalize.add(coef);
+        scores.push_back({shard, coef});
+    }
+
+    for (auto& shard_score : scores) {
+        shard_score.score = normalize(shard_score.score);
+    }
+    return scores;
+}
+
+}  // namespace taily
@@ -0,0 +1,178 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <taily.hpp>
+#include <taily/binary_collection.hpp>
+#include <taily/stats_store.hpp>
+#include <taily/thread_pool.hpp>
+
+namespace taily {
+
+/// Computes statistics of a single term in each shard, as well as its global
+/// statistics, in one pass over its postings.
+///
+/// \param term ID of the term, reported if its postings are invalid
+/// \param documents Document IDs of the term's postings
+/// \param scores Scores of the term's postings
+/// \param document_shards Shard of each document
+/// \param accumulators Working memory of exactly `shard_count` accumulators
+/// \param row Output row: global statistics followed by statistics in each shard
+/// \throws std::runtime_error if a document ID has no shard in `document_shards`,
+///                            or its shard has no accumulator
+template<typename Document_Range, typename Score_Range>
+void compute_term_row(std::size_t term,
+                      Document_Range const& documents,
+                      Score_Range const& scores,
+                      std::vector<std::uint32_t> const& document_shards,
+                      std::vector<Feature_Accumulator>& accumulators,
+                      Feature_Statistics* row)
+{
+    std::fill(accumulators.begin(), accumulators.end(), Feature_Accumulator{});
+    auto score = std::begin(scores);
+    for (auto document : documents) {
+        if (static_cast<std::size_t>(document) >= document_shards.size()) {
+            throw std::runtime_error("document ID " + std::to_string(document) + " of term "
+                                     + std::to_string(term) + " out of range");
+        }
+        auto shard = document_shards[document];
+        if (shard >= accumulators.size()) {
+            throw std::runtime_error("shard ID " + std::to_string(shard) + " of document "
+                                     + std::to_string(document) + " out of range");
+        }
+        accumulators[shard].add(*score);
+        ++score;
+    }
+    Feature_Accumulator global;
+    for (std::size_t shard = 0; shard < accumulators.size(); shard++) {
+        row[shard + 1] = accumulators[shard].stats();
+        global += accumulators[shard];
+    }
+    row[0] = global.stats();
+}
+
+/// Builds a sharded stats file from a scored posting collection.
+///
+/// Terms are processed in blocks of `block_size`, and then written to `os`, so
+/// the memory used is proportional to the block size rather than to the number
+/// of terms. Each block is split into runs of consecutive terms with about the
+/// same number of postings, several per thread of `pool`, which the threads
+/// take in turn, so a few long posting lists do not leave the other threads
+/// idle. The size of each shard, stored in the header, is its number of
+/// documents.
+///
+/// \param collection Posting lists with scores
+/// \param document_shards Shard of each document in the collection
+/// \param shard_count Number of shards
+/// \param os Output stream receiving data in the format of `Sharded_Stats_Writer`
+/// \param pool Thread pool processing terms
+/// \param block_size Number of terms processed at once
+/// \throws std::invalid_argument if `block_size` is zero, or `document_shards`
+///                               does not match the collection or `shard_count`
+inline void build_sharded_stats(Scored_Posting_Collection const& collection,
+                                std::vector<std::uint32_t> const& document_shards,
+                                std::size_t shard_count,
+                                std::ostream& os,
+                                Thread_Pool& pool,
+                                std::size_t block_size = 4096)
+{
+    if (block_size == 0) {
+        throw std::invalid_argument("block size must be positive");
+    }
+    if (document_shards.size() != collection.document_count()) {
+        throw std::invalid_argument("expected shards of "
+                                    + std::to_string(collection.document_count())
+                                    + " documents but got "
+                                    + std::to_string(document_shards.size()));
+    }
+    std::vector<std::int64_t> shard_sizes(shard_count, 0);
+    for (auto shard : document_shards) {
+        if (shard >= shard_count) {
+            throw std::invalid_argument("shard ID out of range: " + std::to_string(shard));
+        }
+        shard_sizes[shard] += 1;
+    }
+    std::size_t const term_count = collection.term_count();
+    std::size_t const row_length = shard_count + 1;
+    Sharded_Stats_Writer writer(os, term_count, shard_sizes);
+    std::vector<Feature_Statistics> rows(std::min(block_size, term_count) * row_length);
+    std::size_t const runs_per_thread = 8;
+    std::vector<std::size_t> run_bounds;
+    for (std::size_t block_first = 0; block_first < term_count; block_first += block_size) {
+        std::size_t const block_terms = std::min(block_size, term_count - block_first);
+        std::size_t block_postings = 0;
+        for (std::size_t idx = 0; idx < block_terms; idx++) {
+            block_postings += collection.documents(block_first + idx).size();
+        }
+        std::size_t const run_postings =
+            std::max<std::size_t>(1, block_postings / (pool.thread_count() * runs_per_thread));
+        run_bounds.assign(1, 0);
+        std::size_t postings = 0;
+        for (std::size_t idx = 0; idx < block_terms; idx++) {
+            postings += collection.documents(block_first + idx).size();
+            if (postings >= run_postings || idx + 1 == block_terms) {
+                run_bounds.push_back(idx + 1);
+                postings = 0;
+            }
+        }
+        std::atomic<std::size_t> next_run{0};
+        std::size_t const run_count = run_bounds.size() - 1;
+        std::size_t const worker_count = std::min(pool.thread_count(), run_count);
+        pool.for_each_chunk(worker_count, [&](std::size_t, std::size_t) {
+            std::vector<Feature_Accumulator> accumulators(shard_count);
+            for (std::size_t run = next_run++; run < run_count; run = next_run++) {
+                for (std::size_t idx = run_bounds[run]; idx < run_bounds[run + 1]; idx++) {
+                    std::size_t const term = block_first + idx;
+                    auto documents = collection.documents(term);
+                    auto scores = collection.scores(term);
+                    if (documents.size() != scores.size()) {
+                        throw std::runtime_error("lengths of documents and scores of term "
+                                                 + std::to_string(term) + " differ");
+                    }
+                    compute_term_row(term,
+                                     documents,
+                                     scores,
+                                     document_shards,
+                                     accumulators,
+                                     rows.data() + idx * row_length);
+                }
+            }
+        });
+        writer.write_rows(rows.data(), block_terms);
+    }
+}
+
+}  // namespace taily
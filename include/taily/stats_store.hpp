@@ -0,0 +1,774 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <taily.hpp>
+
+namespace taily {
+
+static_assert(std::is_standard_layout_v<Feature_Statistics>
+                  && sizeof(Feature_Statistics) == Feature_Statistics::struct_size,
+              "Feature_Statistics must match its on-disk representation");
+
+/// Read-only memory mapping of an entire file.
+class Memory_Mapped_File {
+public:
+    explicit Memory_Mapped_File(std::string const& filename)
+    {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "cannot open " + filename);
+        }
+        struct stat st {};
+        if (::fstat(fd, &st) < 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "cannot stat " + filename);
+        }
+        m_size = static_cast<std::size_t>(st.st_size);
+        if (m_size > 0) {
+            void* addr = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (addr == MAP_FAILED) {
+                int error = errno;
+                ::close(fd);
+                throw std::system_error(error, std::generic_category(), "cannot map " + filename);
+            }
+            m_data = static_cast<char const*>(addr);
+        }
+        ::close(fd);
+    }
+
+    Memory_Mapped_File(Memory_Mapped_File const&) = delete;
+    auto operator=(Memory_Mapped_File const&) -> Memory_Mapped_File& = delete;
+
+    Memory_Mapped_File(Memory_Mapped_File&& other) noexcept
+        : m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0))
+    {}
+
+    auto operator=(Memory_Mapped_File&& other) noexcept -> Memory_Mapped_File&
+    {
+        if (this != &other) {
+            unmap();
+            m_data = std::exchange(other.m_data, nullptr);
+            m_size = std::exchange(other.m_size, 0);
+        }
+        return *this;
+    }
+
+    ~Memory_Mapped_File() { unmap(); }
+
+    [[nodiscard]] auto data() const -> char const* { return m_data; }
+    [[nodiscard]] auto size() const -> std::size_t { return m_size; }
+
+private:
+    void unmap()
+    {
+        if (m_data != nullptr) {
+            ::munmap(const_cast<char*>(m_data), m_size);
+        }
+    }
+
+    char const* m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+/// Memory-mapped collection of term statistics written by subsequent calls
+/// to `Feature_Statistics::to_stream`.
+///
+/// The file is mapped once, and statistics are accessed in place by term ID,
+/// without any copying or system calls at query time.
+class Stats_Store {
+public:
+    explicit Stats_Store(std::string const& filename) : m_file(filename)
+    {
+        if (m_file.size() % Feature_Statistics::struct_size != 0) {
+            throw std::runtime_error(filename + " is not a valid stats file");
+        }
+    }
+
+    /// Returns the number of terms in the store.
+    [[nodiscard]] auto term_count() const -> std::size_t
+    {
+        return m_file.size() / Feature_Statistics::struct_size;
+    }
+
+    /// Returns the statistics of term `term`.
+    [[nodiscard]] auto operator[](std::size_t term) const -> Feature_Statistics const&
+    {
+        return data()[term];
+    }
+
+    /// Returns the statistics of term `term`, or throws `std::out_of_range`.
+    [[nodiscard]] auto at(std::size_t term) const -> Feature_Statistics const&
+    {
+        if (term >= term_count()) {
+            throw std::out_of_range("term ID out of range: " + std::to_string(term));
+        }
+        return data()[term];
+    }
+
+    /// Collects statistics of `terms` for a collection of size `collection_size`.
+    template<typename Term_Range>
+    [[nodiscard]] auto query_stats(Term_Range const& terms, std::int64_t collection_size) const
+        -> Query_Statistics
+    {
+        Query_Statistics stats{{}, collection_size};
+        stats.term_stats.reserve(std::size(terms));
+        for (auto term : terms) {
+            stats.term_stats.push_back(at(term));
+        }
+        return stats;
+    }
+
+private:
+    [[nodiscard]] auto data() const -> Feature_Statistics const*
+    {
+        return reinterpret_cast<Feature_Statistics const*>(m_file.data());
+    }
+
+    Memory_Mapped_File m_file;
+};
+
+/// Header of sharded stats and gamma parameter files, also used by
+/// compressed stats files (see `write_compressed_stats`).
+///
+/// All fields are in the byte order of the machine that wrote the file, which
+/// is identified by `byte_order`. The header is followed by the sizes of all
+/// shards as 64-bit signed integers, then one row per term, and finally a
+/// 64-bit checksum of each block of `block_terms` consecutive rows, so that
+/// a file can be opened in constant time and its rows validated lazily.
+struct Stats_File_Header {
+    static constexpr std::uint32_t current_version = 1;
+    static constexpr std::uint32_t native_byte_order = 0x01020304;
+
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint64_t term_count;
+    std::uint64_t shard_count;
+    /// Sum of shard sizes, or zero if they are unknown.
+    std::int64_t collection_size;
+    std::uint64_t block_terms;
+    /// Checksum of the header, with this field set to zero, and the shard sizes.
+    std::uint64_t header_checksum;
+};
+
+static_assert(std::is_standard_layout_v<Stats_File_Header> && sizeof(Stats_File_Header) == 56,
+              "Stats_File_Header must match its on-disk representation");
+
+/// When checksums of rows are validated.
+enum class Validation {
+    /// Each block of rows is validated when one of its rows is first accessed.
+    lazy,
+    /// All rows are validated when the file is opened.
+    eager,
+    /// Checksums are ignored.
+    none,
+};
+
+namespace detail {
+
+    constexpr std::uint64_t checksum_seed = 0xCBF29CE484222325ULL;
+
+    /// Returns `state` updated with `size` bytes at `data`, 64-bit word by word;
+    /// if `size` is not a multiple of 8, the last word is padded with zeros.
+    /// Each step is a bijection of the state, so any change of a single 64-bit
+    /// word always changes the checksum.
+    [[nodiscard]] inline auto checksum(std::uint64_t state, void const* data, std::size_t size)
+        -> std::uint64_t
+    {
+        auto const* bytes = static_cast<char const*>(data);
+        for (std::size_t pos = 0; pos < size; pos += sizeof(std::uint64_t)) {
+            std::uint64_t word = 0;
+            std::memcpy(&word, bytes + pos, std::min(sizeof(word), size - pos));
+            state = (state ^ word) * 0x9E3779B97F4A7C15ULL;
+            state ^= state >> 29;
+        }
+        return state;
+    }
+
+    [[nodiscard]] inline auto header_checksum(Stats_File_Header header,
+                                              std::int64_t const* shard_sizes) -> std::uint64_t
+    {
+        header.header_checksum = 0;
+        std::uint64_t const state = checksum(checksum_seed, &header, sizeof(header));
+        return checksum(state, shard_sizes, header.shard_count * sizeof(std::int64_t));
+    }
+
+    /// Writes a file in the layout described by `Stats_File_Header` with rows
+    /// of `shard_count + 1` elements of `element_size` bytes.
+    class Row_File_Writer {
+    public:
+        /// Rows in a checksum block are chosen to take about this many bytes.
+        static constexpr std::size_t block_bytes = std::size_t{1} << 20;
+
+        Row_File_Writer(std::ostream& os,
+                        std::array<char, 8> magic,
+                        std::size_t term_count,
+                        std::vector<std::int64_t> const& shard_sizes,
+                        std::size_t element_size)
+            : m_os(os),
+              m_term_count(term_count),
+              m_row_size((shard_sizes.size() + 1) * element_size),
+              m_block_terms(std::max<std::size_t>(1, block_bytes / m_row_size))
+        {
+            Stats_File_Header header{magic,
+                                     Stats_File_Header::current_version,
+                                     Stats_File_Header::native_byte_order,
+                                     term_count,
+                                     shard_sizes.size(),
+                                     std::accumulate(shard_sizes.begin(),
+                                                     shard_sizes.end(),
+                                                     std::int64_t{0}),
+                                     m_block_terms,
+                                     0};
+            header.header_checksum = header_checksum(header, shard_sizes.data());
+            m_os.write(reinterpret_cast<char const*>(&header), sizeof(header));
+            m_os.write(reinterpret_cast<char const*>(shard_sizes.data()),
+                       shard_sizes.size() * sizeof(std::int64_t));
+            m_checksums.reserve((term_count + m_block_terms - 1) / m_block_terms);
+            finish_if_complete();
+        }
+
+        [[nodiscard]] auto written_terms() const -> std::size_t { return m_written_terms; }
+
+        /// Writes `count` consecutive rows, followed by the checksums after the last row.
+        void write_rows(void const* rows, std::size_t count)
+        {
+            if (m_written_terms + count > m_term_count) {
+                throw std::logic_error("writing more terms than declared");
+            }
+            auto const* bytes = static_cast<char const*>(rows);
+            m_os.write(bytes, count * m_row_size);
+            for (std::size_t idx = 0; idx < count; idx++) {
+                m_state = checksum(m_state, bytes + idx * m_row_size, m_row_size);
+                m_written_terms += 1;
+                if (m_written_terms % m_block_terms == 0) {
+                    m_checksums.push_back(std::exchange(m_state, checksum_seed));
+                }
+            }
+            finish_if_complete();
+        }
+
+    private:
+        void finish_if_complete()
+        {
+            if (m_written_terms != m_term_count) {
+                return;
+            }
+            if (m_written_terms % m_block_terms != 0) {
+                m_checksums.push_back(std::exchange(m_state, checksum_seed));
+            }
+            m_os.write(reinterpret_cast<char const*>(m_checksums.data()),
+                       m_checksums.size() * sizeof(std::uint64_t));
+        }
+
+        std::ostream& m_os;
+        std::size_t m_term_count;
+        std::size_t m_row_size;
+        std::size_t m_block_terms;
+        std::size_t m_written_terms = 0;
+        std::uint64_t m_state = checksum_seed;
+        std::vector<std::uint64_t> m_checksums{};
+    };
+
+    /// Memory-mapped file in the layout described by `Stats_File_Header`.
+    ///
+    /// Opening the file validates only the header and the shard sizes, in time
+    /// independent of the number of terms; rows are validated by `check`.
+    class Row_File {
+    public:
+        Row_File(std::string const& filename,
+                 std::array<char, 8> magic,
+                 std::size_t element_size,
+                 Validation validation)
+            : m_filename(filename), m_file(filename), m_validation(validation)
+        {
+            Stats_File_Header header{};
+            if (m_file.size() < sizeof(header)) {
+                fail("is too short");
+            }
+            std::memcpy(&header, m_file.data(), sizeof(header));
+            if (header.magic != magic) {
+                fail("has a wrong magic number");
+            }
+            if (header.byte_order != Stats_File_Header::native_byte_order) {
+                fail("was written on a machine with a different byte order");
+            }
+            if (header.version != Stats_File_Header::current_version) {
+                fail("has unsupported version " + std::to_string(header.version));
+            }
+            // Each count is checked against the file size before it is multiplied.
+            std::size_t const available = m_file.size() - sizeof(header);
+            if (header.block_terms == 0
+                || header.shard_count > available / sizeof(std::int64_t)) {
+                fail("has an invalid header");
+            }
+            m_shard_count = header.shard_count;
+            m_collection_size = header.collection_size;
+            m_block_terms = header.block_terms;
+            m_row_size = (m_shard_count + 1) * element_size;
+            std::size_t const sizes_size = m_shard_count * sizeof(std::int64_t);
+            auto const* shard_sizes =
+                reinterpret_cast<std::int64_t const*>(m_file.data() + sizeof(header));
+            if (detail::header_checksum(header, shard_sizes) != header.header_checksum) {
+                fail("has a corrupt header");
+            }
+            if (header.term_count > (available - sizes_size) / m_row_size) {
+                fail("has a wrong size");
+            }
+            m_term_count = header.term_count;
+            m_shard_sizes.assign(shard_sizes, shard_sizes + m_shard_count);
+            m_block_count =
+                m_term_count / m_block_terms + (m_term_count % m_block_terms != 0 ? 1 : 0);
+            m_rows = m_file.data() + sizeof(header) + sizes_size;
+            if (m_file.size()
+                != sizeof(header) + sizes_size + m_term_count * m_row_size
+                    + m_block_count * sizeof(std::uint64_t)) {
+                fail("has a wrong size");
+            }
+            m_checksums =
+                reinterpret_cast<std::uint64_t const*>(m_rows + m_term_count * m_row_size);
+            m_validated = std::make_unique<std::atomic<bool>[]>(m_block_count);
+            if (m_validation == Validation::eager) {
+                validate();
+            }
+        }
+
+        [[nodiscard]] auto term_count() const -> std::size_t { return m_term_count; }
+        [[nodiscard]] auto shard_count() const -> std::size_t { return m_shard_count; }
+        [[nodiscard]] auto collection_size() const -> std::int64_t { return m_collection_size; }
+        [[nodiscard]] auto shard_sizes() const -> std::vector<std::int64_t> const&
+        {
+            return m_shard_sizes;
+        }
+        [[nodiscard]] auto rows() const -> char const* { return m_rows; }
+
+        /// Validates the block of `term` if validation is lazy and it has not
+        /// been validated yet.
+        void check(std::size_t term) const
+        {
+            if (m_validation == Validation::lazy && term < m_term_count) {
+                std::size_t const block = term / m_block_terms;
+                if (!m_validated[block].load(std::memory_order_acquire)) {
+                    validate_block(block);
+                }
+            }
+        }
+
+        /// Validates all blocks.
+        void validate() const
+        {
+            for (std::size_t block = 0; block < m_block_count; block++) {
+                validate_block(block);
+            }
+        }
+
+    private:
+        [[noreturn]] void fail(std::string const& reason) const
+        {
+            throw std::runtime_error(m_filename + " " + reason);
+        }
+
+        void validate_block(std::size_t block) const
+        {
+            std::size_t const first = block * m_block_terms;
+            std::size_t const count = std::min(m_block_terms, m_term_count - first);
+            std::uint64_t const actual =
+                detail::checksum(checksum_seed, m_rows + first * m_row_size, count * m_row_size);
+            std::uint64_t expected;
+            std::memcpy(&expected, m_checksums + block, sizeof(expected));
+            if (actual != expected) {
+                fail("is corrupt: checksum mismatch in rows " + std::to_string(first) + " to "
+                     + std::to_string(first + count - 1));
+            }
+            m_validated[block].store(true, std::memory_order_release);
+        }
+
+        std::string m_filename;
+        Memory_Mapped_File m_file;
+        Validation m_validation;
+        std::size_t m_term_count = 0;
+        std::size_t m_shard_count = 0;
+        std::int64_t m_collection_size = 0;
+        std::size_t m_block_terms = 0;
+        std::size_t m_block_count = 0;
+        std::size_t m_row_size = 0;
+        std::vector<std::int64_t> m_shard_sizes{};
+        char const* m_rows = nullptr;
+        std::uint64_t const* m_checksums = nullptr;
+        std::unique_ptr<std::atomic<bool>[]> m_validated{};
+    };
+
+    constexpr std::array<char, 8> stats_magic = {'T', 'A', 'I', 'L', 'Y', 'S', 'T', 'S'};
+    constexpr std::array<char, 8> gamma_magic = {'T', 'A', 'I', 'L', 'Y', 'G', 'A', 'M'};
+
+}  // namespace detail
+
+/// Writes statistics of an entire index and all its shards into a single file
+/// in the term-major layout read by `Sharded_Stats_Store`.
+///
+/// The file starts with a `Stats_File_Header` and the shard sizes, followed by
+/// one row per term, and ends with block checksums written after the last row.
+/// Each row consists of the global statistics of the term and then the
+/// statistics of the term in each consecutive shard.
+class Sharded_Stats_Writer {
+public:
+    /// Creates a writer of a file with the given shard sizes, whose sum is
+    /// stored as the collection size.
+    Sharded_Stats_Writer(std::ostream& os,
+                         std::size_t term_count,
+                         std::vector<std::int64_t> const& shard_sizes)
+        : m_writer(os,
+                   detail::stats_magic,
+                   term_count,
+                   shard_sizes,
+                   Feature_Statistics::struct_size),
+          m_term_count(term_count),
+          m_shard_count(shard_sizes.size())
+    {}
+
+    /// Creates a writer of a file with unknown shard sizes, stored as zeros.
+    Sharded_Stats_Writer(std::ostream& os, std::size_t term_count, std::size_t shard_count)
+        : Sharded_Stats_Writer(os, term_count, std::vector<std::int64_t>(shard_count, 0))
+    {}
+
+    /// Writes the next term row.
+    ///
+    /// \param global Statistics of the term in the entire index
+    /// \param shards Statistics of the term in each shard
+    template<typename Stats_Range>
+    void write_term(Feature_Statistics const& global, Stats_Range const& shards)
+    {
+        if (std::size(shards) != m_shard_count) {
+            throw std::invalid_argument("expected stats for " + std::to_string(m_shard_count)
+                                        + " shards but got " + std::to_string(std::size(shards)));
+        }
+        if (m_writer.written_terms() == m_term_count) {
+            throw std::logic_error("all terms have already been written");
+        }
+        m_row.clear();
+        m_row.push_back(global);
+        m_row.insert(m_row.end(), std::begin(shards), std::end(shards));
+        m_writer.write_rows(m_row.data(), 1);
+    }
+
+    /// Writes `count` consecutive term rows stored contiguously in `rows`, each
+    /// consisting of the global statistics and then `shard_count` shard statistics.
+    void write_rows(Feature_Statistics const* rows, std::size_t count)
+    {
+        m_writer.write_rows(rows, count);
+    }
+
+    /// Writes the next term row, deriving the global statistics of the term
+    /// by merging its statistics in all shards with `merge_statistics`.
+    template<typename Stats_Range>
+    void write_term(Stats_Range const& shards)
+    {
+        write_term(merge_statistics(shards), shards);
+    }
+
+private:
+    detail::Row_File_Writer m_writer;
+    std::size_t m_term_count;
+    std::size_t m_shard_count;
+    std::vector<Feature_Statistics> m_row{};
+};
+
+/// Memory-mapped statistics of an entire index and all its shards, written
+/// by `Sharded_Stats_Writer`.
+///
+/// Statistics for all shards of a given term are stored contiguously, right
+/// after the global statistics of that term, so fetching statistics of a query
+/// for every shard requires one sequential read per query term.
+///
+/// Opening a store reads only the header and shard sizes. By default, each
+/// block of rows is validated against its checksum when first accessed, and
+/// a `std::runtime_error` is thrown if it is corrupt.
+class Sharded_Stats_Store {
+public:
+    explicit Sharded_Stats_Store(std::string const& filename,
+                                 Validation validation = Validation::lazy)
+        : m_file(filename, detail::stats_magic, Feature_Statistics::struct_size, validation),
+          m_term_count(m_file.term_count()),
+          m_shard_count(m_file.shard_count())
+    {}
+
+    [[nodiscard]] auto term_count() const -> std::size_t { return m_term_count; }
+    [[nodiscard]] auto shard_count() const -> std::size_t { return m_shard_count; }
+
+    /// Returns the size of the entire collection, or zero if unknown.
+    [[nodiscard]] auto collection_size() const -> std::int64_t
+    {
+        return m_file.collection_size();
+    }
+
+    /// Returns the sizes of all shards, which are zeros if unknown.
+    [[nodiscard]] auto shard_sizes() const -> std::vector<std::int64_t> const&
+    {
+        return m_file.shard_sizes();
+    }
+
+    /// Validates checksums of all rows.
+    ///
+    /// \throws std::runtime_error if any row is corrupt
+    void validate() const { m_file.validate(); }
+
+    /// Returns a pointer to the row of `term`: its global statistics followed by
+    /// the statistics in each of the `shard_count()` shards.
+    [[nodiscard]] auto row(std::size_t term) const -> Feature_Statistics const*
+    {
+        m_file.check(term);
+        return data() + term * (m_shard_count + 1);
+    }
+
+    /// Returns the statistics of `term` in the entire index.
+    [[nodiscard]] auto global(std::size_t term) const -> Feature_Statistics const&
+    {
+        return row(term)[0];
+    }
+
+    /// Returns the statistics of `term` in `shard`.
+    [[nodiscard]] auto shard(std::size_t term, std::size_t shard) const
+        -> Feature_Statistics const&
+    {
+        return row(term)[shard + 1];
+    }
+
+    /// Collects global statistics of `terms` for a collection of size `collection_size`.
+    template<typename Term_Range>
+    [[nodiscard]] auto global_query_stats(Term_Range const& terms,
+                                          std::int64_t collection_size) const -> Query_Statistics
+    {
+        Query_Statistics stats{{}, collection_size};
+        stats.term_stats.reserve(std::size(terms));
+        global_query_stats(terms, collection_size, stats);
+        return stats;
+    }
+
+    /// Collects global statistics of `terms` into `stats`, reusing its memory.
+    template<typename Term_Range>
+    void global_query_stats(Term_Range const& terms,
+                            std::int64_t collection_size,
+                            Query_Statistics& stats) const
+    {
+        stats.collection_size = collection_size;
+        stats.term_stats.clear();
+        for (auto term : terms) {
+            stats.term_stats.push_back(global(checked(term)));
+        }
+    }
+
+    /// Collects statistics of `terms` in each shard, where `shard_sizes` are
+    /// the collection sizes of consecutive shards.
+    template<typename Term_Range>
+    [[nodiscard]] auto shard_query_stats(Term_Range const& terms,
+                                         std::vector<std::int64_t> const& shard_sizes) const
+        -> std::vector<Query_Statistics>
+    {
+        std::vector<Query_Statistics> stats;
+        shard_query_stats(terms, shard_sizes, stats);
+        return stats;
+    }
+
+    /// Collects statistics of `terms` in each shard into `stats`.
+    ///
+    /// The vectors in `stats` are overwritten but their memory is reused, so
+    /// once `stats` is big enough, no memory is allocated. This is useful when
+    /// processing many queries in a row.
+    template<typename Term_Range>
+    void shard_query_stats(Term_Range const& terms,
+                           std::vector<std::int64_t> const& shard_sizes,
+                           std::vector<Query_Statistics>& stats) const
+    {
+        if (shard_sizes.size() != m_shard_count) {
+            throw std::invalid_argument("expected " + std::to_string(m_shard_count)
+                                        + " shard sizes but got "
+                                        + std::to_string(shard_sizes.size()));
+        }
+        stats.resize(m_shard_count);
+        for (std::size_t shard = 0; shard < m_shard_count; shard++) {
+            stats[shard].collection_size = shard_sizes[shard];
+            stats[shard].term_stats.clear();
+        }
+        for (auto term : terms) {
+            Feature_Statistics const* term_row = row(checked(term)) + 1;
+            for (std::size_t shard = 0; shard < m_shard_count; shard++) {
+                stats[shard].term_stats.push_back(term_row[shard]);
+            }
+        }
+    }
+
+private:
+    [[nodiscard]] auto data() const -> Feature_Statistics const*
+    {
+        return reinterpret_cast<Feature_Statistics const*>(m_file.rows());
+    }
+
+    [[nodiscard]] auto checked(std::size_t term) const -> std::size_t
+    {
+        if (term >= m_term_count) {
+            throw std::out_of_range("term ID out of range: " + std::to_string(term));
+        }
+        return term;
+    }
+
+    detail::Row_File m_file;
+    std::size_t m_term_count = 0;
+    std::size_t m_shard_count = 0;
+};
+
+/// Writes gamma distribution parameters fitted to every statistic of `store`
+/// with `fit_gamma`, in the layout read by `Gamma_Parameter_Store`.
+///
+/// The file has the same layout as the stats file, with a different magic
+/// number, and contains a row of `shard_count + 1` parameters for each term,
+/// corresponding to the rows of the stats file.
+inline void write_gamma_parameters(Sharded_Stats_Store const& store, std::ostream& os)
+{
+    static_assert(sizeof(Gamma_Parameters) == 2 * sizeof(double));
+    detail::Row_File_Writer writer(
+        os, detail::gamma_magic, store.term_count(), store.shard_sizes(), sizeof(Gamma_Parameters));
+    std::vector<Gamma_Parameters> row(store.shard_count() + 1);
+    for (std::size_t term = 0; term < store.term_count(); term++) {
+        std::transform(store.row(term),
+                       store.row(term) + row.size(),
+                       row.begin(),
+                       [](auto const& stats) { return fit_gamma(stats); });
+        writer.write_rows(row.data(), 1);
+    }
+}
+
+/// Memory-mapped gamma distribution parameters fitted in advance to each
+/// (term, shard) statistics, written by `write_gamma_parameters`.
+class Gamma_Parameter_Store {
+public:
+    explicit Gamma_Parameter_Store(std::string const& filename,
+                                   Validation validation = Validation::lazy)
+        : m_file(filename, detail::gamma_magic, sizeof(Gamma_Parameters), validation)
+    {}
+
+    [[nodiscard]] auto term_count() const -> std::size_t { return m_file.term_count(); }
+    [[nodiscard]] auto shard_count() const -> std::size_t { return m_file.shard_count(); }
+
+    /// Returns a pointer to the parameters of `term`: global ones followed by
+    /// those of each of the `shard_count()` shards.
+    [[nodiscard]] auto row(std::size_t term) const -> Gamma_Parameters const*
+    {
+        m_file.check(term);
+        return reinterpret_cast<Gamma_Parameters const*>(m_file.rows())
+            + term * (m_file.shard_count() + 1);
+    }
+
+private:
+    detail::Row_File m_file;
+};
+
+/// Scores all shards of `store` for a query.
+///
+/// If `gammas` is given and the query has a single term, the precomputed
+/// distributions are used by `score_single_term` in either domain, since a
+/// single term cannot underflow. Otherwise, statistics are collected and
+/// scored with `score_shards` in `domain`.
+///
+/// \param store Statistics of the index and its shards
+/// \param gammas Optional gamma parameters fitted to `store`, or `nullptr`
+/// \param terms Query term IDs
+/// \param collection_size Size of the entire collection
+/// \param shard_sizes Sizes of the shards
+/// \param ntop The parameter to Taily algorithm saying how many top results we
+/// are shooting for
+/// \param scores Output shard scores, one for each shard
+/// \param domain Domain of `any` and `all`
+template<typename Gamma = Exact_Gamma, typename Term_Range>
+void score_shards(Sharded_Stats_Store const& store,
+                  Gamma_Parameter_Store const* gammas,
+                  Term_Range const& terms,
+                  std::int64_t const collection_size,
+                  std::vector<std::int64_t> const& shard_sizes,
+                  int const ntop,
+                  double* scores,
+                  Domain domain = Domain::linear)
+{
+    if (gammas != nullptr
+        && (gammas->term_count() != store.term_count()
+            || gammas->shard_count() != store.shard_count())) {
+        throw std::invalid_argument("gamma parameters do not match the stats store");
+    }
+    if (gammas != nullptr && std::size(terms) == 1) {
+        auto const term = static_cast<std::size_t>(*std::begin(terms));
+        if (term >= store.term_count()) {
+            throw std::out_of_range("term ID out of range: " + std::to_string(term));
+        }
+        if (shard_sizes.size() != store.shard_count()) {
+            throw std::invalid_argument("expected " + std::to_string(store.shard_count())
+                                        + " shard sizes but got "
+                                        + std::to_string(shard_sizes.size()));
+        }
+        Feature_Statistics const* stats = store.row(term);
+        Gamma_Parameters const* gamma = gammas->row(term);
+        score_single_term<Gamma>(stats[0],
+                                 gamma[0],
+                                 collection_size,
+                                 stats + 1,
+                                 gamma + 1,
+                                 shard_sizes.data(),
+                                 store.shard_count(),
+                                 ntop,
+                                 scores);
+        return;
+    }
+    score_shards<Gamma>(store.global_query_stats(terms, collection_size),
+                        store.shard_query_stats(terms, shard_sizes),
+                        ntop,
+                        scores,
+                        domain);
+}
+
+}  // namespace taily
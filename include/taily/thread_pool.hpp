@@ -0,0 +1,156 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace taily {
+
+/// Fixed-size pool of worker threads executing submitted tasks.
+///
+/// It can be passed as an executor to the scoring functions that take one.
+/// Tasks must not wait for other tasks submitted to the same pool.
+class Thread_Pool {
+public:
+    explicit Thread_Pool(std::size_t thread_count = std::thread::hardware_concurrency())
+    {
+        thread_count = std::max<std::size_t>(thread_count, 1);
+        m_workers.reserve(thread_count);
+        for (std::size_t idx = 0; idx < thread_count; idx++) {
+            m_workers.emplace_back([this] { work(); });
+        }
+    }
+
+    Thread_Pool(Thread_Pool const&) = delete;
+    auto operator=(Thread_Pool const&) -> Thread_Pool& = delete;
+    Thread_Pool(Thread_Pool&&) = delete;
+    auto operator=(Thread_Pool&&) -> Thread_Pool& = delete;
+
+    ~Thread_Pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopped = true;
+        }
+        m_task_available.notify_all();
+        for (auto& worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    [[nodiscard]] auto thread_count() const -> std::size_t { return m_workers.size(); }
+
+    /// Schedules `task` for execution on one of the workers.
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.push_back(std::move(task));
+        }
+        m_task_available.notify_one();
+    }
+
+    /// Splits `[0, size)` into contiguous chunks and calls `fn(first, last)` for
+    /// each of them in parallel. Returns once all chunks are processed.
+    ///
+    /// If any call throws, the first exception is rethrown in the calling thread.
+    template<typename Fn>
+    void for_each_chunk(std::size_t size, Fn&& fn)
+    {
+        if (size == 0) {
+            return;
+        }
+        std::size_t const chunk_count = std::min(size, thread_count());
+        std::size_t const chunk_size = (size + chunk_count - 1) / chunk_count;
+
+        std::mutex mutex;
+        std::condition_variable done;
+        std::size_t remaining = 0;
+        std::exception_ptr error = nullptr;
+        for (std::size_t first = 0; first < size; first += chunk_size) {
+            std::size_t const last = std::min(size, first + chunk_size);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                remaining += 1;
+            }
+            submit([&, first, last] {
+                std::exception_ptr chunk_error = nullptr;
+                try {
+                    fn(first, last);
+                } catch (...) {
+                    chunk_error = std::current_exception();
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                if (chunk_error != nullptr && error == nullptr) {
+                    error = chunk_error;
+                }
+                if (--remaining == 0) {
+                    done.notify_one();
+                }
+            });
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&remaining] { return remaining == 0; });
+        if (error != nullptr) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    void work()
+    {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_task_available.wait(lock, [this] { return m_stopped || !m_tasks.empty(); });
+                if (m_tasks.empty()) {
+                    return;
+                }
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> m_workers{};
+    std::deque<std::function<void()>> m_tasks{};
+    std::mutex m_mutex{};
+    std::condition_variable m_task_available{};
+    bool m_stopped = false;
+};
+
+}  // namespace taily
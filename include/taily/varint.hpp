@@ -0,0 +1,80 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace taily::detail {
+
+/// Appends `value` to `out` in LEB128 format: 7 bits per byte, least
+/// significant first, with the highest bit set on all bytes but the last.
+inline void write_varint(std::uint64_t value, std::vector<char>& out)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+/// Reads a value written by `write_varint` at `pos` and advances `pos` past it.
+[[nodiscard]] inline auto read_varint(char const*& pos) -> std::uint64_t
+{
+    std::uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        auto const byte = static_cast<std::uint8_t>(*pos++);
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            return value;
+        }
+    }
+}
+
+/// Reads a value written by `write_varint` at `pos` like the overload above,
+/// but without reading at or past `end`.
+///
+/// \throws std::runtime_error if the value does not end before `end` or does
+/// not fit in 64 bits
+[[nodiscard]] inline auto read_varint(char const*& pos, char const* end) -> std::uint64_t
+{
+    std::uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos == end) {
+            throw std::runtime_error("truncated varint");
+        }
+        auto const byte = static_cast<std::uint8_t>(*pos++);
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            return value;
+        }
+    }
+    throw std::runtime_error("varint longer than 64 bits");
+}
+
+}  // namespace taily::detail
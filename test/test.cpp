@@ -28,6 +28,7 @@
 #include <gtest/gtest.h>
 
 #include <taily.hpp>
+#include <taily/thread_pool.hpp>
 
 namespace {
 
@@ -78,6 +79,54 @@ TEST(Feature_Statistics, from_pointers)
     ASSERT_EQ(stats.frequency, 6);
 }
 
+TEST(Feature_Accumulator, single_pass)
+{
+    std::vector<double> features = {2, 3, 1, 4, 5, 3};
+    Feature_Accumulator accumulator;
+    accumulator.add(features.begin(), features.end());
+    auto stats = accumulator.stats();
+    ASSERT_THAT(stats.expected_value, ::testing::DoubleEq(3));
+    ASSERT_THAT(stats.variance, ::testing::DoubleEq(1.6666666666666667));
+    ASSERT_EQ(stats.frequency, 6);
+    ASSERT_EQ(Feature_Accumulator{}.stats().frequency, 0);
+}
+
+TEST(Feature_Accumulator, merge)
+{
+    std::vector<double> features = {2, 3, 1, 4, 5, 3, 11.5, 0.25, 7};
+    Feature_Accumulator left;
+    Feature_Accumulator right;
+    left.add(features.begin(), features.begin() + 4);
+    right.add(features.begin() + 4, features.end());
+    auto stats = (left + right).stats();
+    auto expected = Feature_Statistics::from_features(features);
+    ASSERT_THAT(stats.expected_value, ::testing::DoubleEq(expected.expected_value));
+    ASSERT_THAT(stats.variance, ::testing::DoubleEq(expected.variance));
+    ASSERT_EQ(stats.frequency, expected.frequency);
+
+    Feature_Accumulator empty;
+    empty += left;
+    ASSERT_THAT(empty.mean(), ::testing::DoubleEq(left.mean()));
+    left += Feature_Accumulator{};
+    ASSERT_EQ(left.count(), 4);
+}
+
+TEST(Feature_Statistics, merge_statistics)
+{
+    std::vector<std::vector<double>> shards = {{7, 2, 6}, {11, 1, 1, 1}, {}, {3, 8, 15}};
+    std::vector<Feature_Statistics> shard_stats;
+    std::vector<double> all_features;
+    for (auto const& features : shards) {
+        shard_stats.push_back(Feature_Statistics::from_features(features));
+        all_features.insert(all_features.end(), features.begin(), features.end());
+    }
+    auto merged = merge_statistics(shard_stats);
+    auto expected = Feature_Statistics::from_features(all_features);
+    ASSERT_THAT(merged.expected_value, ::testing::DoubleEq(expected.expected_value));
+    ASSERT_THAT(merged.variance, ::testing::DoubleEq(expected.variance));
+    ASSERT_EQ(merged.frequency, expected.frequency);
+}
+
 TEST_F(Taily, any)
 {
     ASSERT_THAT(any(global_stats), ::testing::DoubleEq(8092785.817906557));
@@ -94,6 +143,93 @@ TEST_F(Taily, all)
     ASSERT_THAT(all(shard3_stats), ::testing::DoubleEq(0.0));
 }
 
+TEST_F(Taily, log_domain)
+{
+    double const infinity = std::numeric_limits<double>::infinity();
+    ASSERT_THAT(any(global_stats, Domain::log), ::testing::DoubleNear(8092785.817906557, 1e-6));
+    ASSERT_THAT(any(shard1_stats, Domain::log), ::testing::DoubleNear(5035122.399034779, 1e-6));
+    ASSERT_THAT(all(global_stats, Domain::log), ::testing::DoubleNear(110253.9116689363, 1e-6));
+    ASSERT_THAT(all(shard1_stats, Domain::log), ::testing::DoubleNear(72026.835974918, 1e-6));
+    ASSERT_EQ(log_all(shard2_stats), -infinity);
+    ASSERT_EQ(log_any(shard3_stats), -infinity);
+    ASSERT_EQ(all(shard3_stats, Domain::log), 0.0);
+    ASSERT_THAT(estimate_cutoff(global_stats, 50, Domain::log),
+                ::testing::DoubleNear(estimate_cutoff(global_stats, 50), 1e-9));
+    auto shard_stats = std::vector<Query_Statistics>{shard1_stats, shard2_stats, shard1_stats};
+    auto linear = score_shards(global_stats, shard_stats, 50);
+    auto log = score_shards(global_stats, shard_stats, 50, Domain::log);
+    for (std::size_t shard = 0; shard < shard_stats.size(); shard++) {
+        ASSERT_THAT(log[shard], ::testing::DoubleNear(linear[shard], 1e-9));
+    }
+}
+
+TEST(Log_Domain, long_queries_do_not_underflow)
+{
+    // A common term and 59 rare terms: each rare term contributes a factor
+    // of about 1e-7 to `all`, which underflows in the linear domain.
+    std::int64_t const shard_size = 1'000'000'000;
+    std::vector<Query_Statistics> shard_stats;
+    for (std::int64_t frequency : {10, 20, 40}) {
+        Query_Statistics stats{std::vector<Feature_Statistics>(60, {5.0, 2.0, frequency}),
+                               shard_size};
+        stats.term_stats[0].frequency = 100'000'000;
+        shard_stats.push_back(stats);
+    }
+    Query_Statistics global_stats{std::vector<Feature_Statistics>(60, {5.0, 2.0, 70}),
+                                  3 * shard_size};
+    global_stats.term_stats[0].frequency = 300'000'000;
+    ASSERT_EQ(all(shard_stats[0]), 0.0);
+    ASSERT_THAT(score_shards(global_stats, shard_stats, 10), ::testing::ElementsAre(0, 0, 0));
+    auto scores = score_shards(global_stats, shard_stats, 10, Domain::log);
+    ASSERT_THAT(std::accumulate(scores.begin(), scores.end(), 0.0), ::testing::DoubleEq(10.0));
+    ASSERT_GT(scores[2], scores[1]);
+    ASSERT_GT(scores[1], scores[0]);
+    ASSERT_GT(scores[0], 0.0);
+}
+
+TEST(Log_Domain, selection_and_batches_forward_domain)
+{
+    std::int64_t const shard_size = 1'000'000'000;
+    std::vector<Query_Statistics> shard_stats;
+    for (std::int64_t frequency : {10, 20, 40, 0, 30}) {
+        Query_Statistics stats{std::vector<Feature_Statistics>(60, {5.0, 2.0, frequency}),
+                               shard_size};
+        stats.term_stats[0].frequency = 100'000'000;
+        shard_stats.push_back(stats);
+    }
+    Query_Statistics global_stats{std::vector<Feature_Statistics>(60, {5.0, 2.0, 100}),
+                                  5 * shard_size};
+    global_stats.term_stats[0].frequency = 500'000'000;
+    auto scores = score_shards(global_stats, shard_stats, 10, Domain::log);
+    ASSERT_EQ(scores[3], 0.0);
+    ASSERT_TRUE(select_shards(global_stats, shard_stats, 10, 3).empty());
+
+    auto top = select_shards(global_stats, shard_stats, 10, 3, Domain::log);
+    ASSERT_EQ(top.size(), 3);
+    std::vector<std::size_t> order = {2, 4, 1};
+    for (std::size_t idx = 0; idx < top.size(); idx++) {
+        ASSERT_EQ(top[idx].shard, order[idx]);
+        ASSERT_THAT(top[idx].score, ::testing::DoubleNear(scores[order[idx]], 1e-9));
+    }
+    auto above = select_shards_above(global_stats, shard_stats, 10, 0.0, Domain::log);
+    ASSERT_EQ(above.size(), 4);
+    for (auto const& shard_score : above) {
+        ASSERT_THAT(shard_score.score, ::testing::DoubleNear(scores[shard_score.shard], 1e-9));
+    }
+
+    std::vector<double> batch(10);
+    score_shards(std::vector<Query_Statistics>{global_stats, global_stats},
+                 std::vector<std::vector<Query_Statistics>>{shard_stats, shard_stats},
+                 5,
+                 10,
+                 batch.data(),
+                 Domain::log);
+    ASSERT_THAT(std::vector<double>(batch.begin(), batch.begin() + 5),
+                ::testing::ElementsAreArray(scores));
+    ASSERT_THAT(std::vector<double>(batch.begin() + 5, batch.end()),
+                ::testing::ElementsAreArray(scores));
+}
+
 TEST_F(Taily, fit_distribution)
 {
     auto glob_dist = fit_distribution(global_stats.term_stats);
@@ -148,6 +284,91 @@ TEST_F(Taily, score_shards)
     ASSERT_THAT(scores[2], ::testing::DoubleNear(16.666666666666664, 0.00001));
 }
 
+TEST_F(Taily, score_shards_batch)
+{
+    std::vector<Query_Statistics> global_batch = {global_stats, global_stats};
+    std::vector<std::vector<Query_Statistics>> shard_batch = {
+        {shard1_stats, shard2_stats, shard3_stats}, {shard1_stats, shard1_stats, shard1_stats}};
+    std::vector<double> scores(6);
+    score_shards(global_batch, shard_batch, 3, 50, scores.data());
+    ASSERT_THAT(std::vector<double>(scores.begin(), scores.begin() + 3),
+                ::testing::ElementsAreArray(score_shards(global_stats, shard_batch[0], 50)));
+    ASSERT_THAT(std::vector<double>(scores.begin() + 3, scores.end()),
+                ::testing::ElementsAreArray(score_shards(global_stats, shard_batch[1], 50)));
+    ASSERT_THROW(score_shards(global_batch, shard_batch, 2, 50, scores.data()),
+                 std::invalid_argument);
+}
+
+TEST_F(Taily, select_shards)
+{
+    std::vector<Query_Statistics> shard_stats;
+    for (int shard = 0; shard < 20; shard++) {
+        auto stats = shard % 4 == 0 ? shard2_stats : shard1_stats;
+        stats.term_stats[1].frequency += (shard * 7919) % 13 * 10'000;
+        stats.term_stats[2].expected_value += shard % 5;
+        shard_stats.push_back(stats);
+    }
+    auto scores = score_shards(global_stats, shard_stats, 50);
+
+    std::vector<Shard_Score> expected;
+    for (std::size_t shard = 0; shard < scores.size(); shard++) {
+        if (scores[shard] > 0.0) {
+            expected.push_back({shard, scores[shard]});
+        }
+    }
+    std::sort(expected.begin(), expected.end(), selected_before);
+
+    auto top = select_shards(global_stats, shard_stats, 50, 5);
+    ASSERT_EQ(top.size(), 5);
+    for (std::size_t idx = 0; idx < top.size(); idx++) {
+        ASSERT_EQ(top[idx].shard, expected[idx].shard);
+        ASSERT_EQ(top[idx].score, expected[idx].score);
+    }
+    ASSERT_EQ(select_shards(global_stats, shard_stats, 50, 100).size(), expected.size());
+    ASSERT_TRUE(select_shards(global_stats, shard_stats, 50, 0).empty());
+
+    double const threshold = expected[7].score;
+    auto above = select_shards_above(global_stats, shard_stats, 50, threshold);
+    ASSERT_EQ(above.size(), 7);
+    for (std::size_t idx = 0; idx < above.size(); idx++) {
+        ASSERT_EQ(above[idx].shard, expected[idx].shard);
+        ASSERT_EQ(above[idx].score, expected[idx].score);
+    }
+}
+
+TEST_F(Taily, score_shards_parallel)
+{
+    std::vector<Query_Statistics> shard_stats;
+    for (int shard = 0; shard < 100; shard++) {
+        auto stats = shard % 3 == 0 ? shard1_stats : shard % 3 == 1 ? shard2_stats : shard3_stats;
+        stats.term_stats[1].frequency += shard * 1000;
+        stats.term_stats[2].expected_value += shard / 10.0;
+        shard_stats.push_back(stats);
+    }
+    auto expected = score_shards(global_stats, shard_stats, 50);
+    for (std::size_t thread_count : {1, 3, 8}) {
+        Thread_Pool pool(thread_count);
+        std::vector<double> scores(shard_stats.size());
+        score_shards(pool, global_stats, shard_stats, 50, scores.data());
+        ASSERT_THAT(scores, ::testing::ElementsAreArray(expected));
+    }
+}
+
+TEST(Thread_Pool, for_each_chunk_rethrows)
+{
+    Thread_Pool pool(2);
+    std::vector<int> visited(10, 0);
+    pool.for_each_chunk(visited.size(), [&](std::size_t first, std::size_t last) {
+        for (; first < last; first++) {
+            visited[first] += 1;
+        }
+    });
+    ASSERT_THAT(visited, ::testing::Each(1));
+    ASSERT_THROW(pool.for_each_chunk(
+                     10, [](std::size_t, std::size_t) { throw std::runtime_error("error"); }),
+                 std::runtime_error);
+}
+
 };  // namespace
 
 int main(int argc, char** argv)
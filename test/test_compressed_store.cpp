@@ -0,0 +1,216 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <taily/compressed_store.hpp>
+
+namespace {
+
+using namespace taily;
+
+class Compressed_Stats_Store_Test : public ::testing::TestWithParam<Moment_Encoding> {
+protected:
+    void SetUp() override
+    {
+        std::mt19937 gen(3);
+        std::uniform_real_distribution<double> moment(0.5, 20.0);
+        std::uniform_int_distribution<std::int64_t> frequency(0, 3'000);
+        std::ofstream ofs("compressed_test.stats");
+        Sharded_Stats_Writer writer(ofs, term_count, shard_count);
+        for (std::size_t term = 0; term < term_count; term++) {
+            std::vector<Feature_Statistics> row;
+            for (std::size_t shard = 0; shard < shard_count; shard++) {
+                // Most shards do not contain the term.
+                auto freq = frequency(gen) - 2'000;
+                row.push_back(freq <= 0 ? Feature_Statistics{0.0, 0.0, 0}
+                                        : Feature_Statistics{moment(gen), moment(gen), freq});
+            }
+            writer.write_term(row);
+        }
+    }
+
+    void TearDown() override
+    {
+        std::remove("compressed_test.stats");
+        std::remove("compressed_test.cstats");
+    }
+
+    [[nodiscard]] static auto tolerance() -> double
+    {
+        return GetParam() == Moment_Encoding::float32 ? 6e-8 : 3.4e-4;
+    }
+
+    static constexpr std::size_t term_count = 20;
+    static constexpr std::size_t shard_count = 40;
+};
+
+TEST_P(Compressed_Stats_Store_Test, round_trip)
+{
+    Sharded_Stats_Store exact("compressed_test.stats");
+    {
+        std::ofstream ofs("compressed_test.cstats");
+        write_compressed_stats(exact, ofs, GetParam());
+    }
+    Compressed_Stats_Store compressed("compressed_test.cstats");
+    ASSERT_EQ(compressed.term_count(), term_count);
+    ASSERT_EQ(compressed.shard_count(), shard_count);
+    ASSERT_EQ(compressed.encoding(), GetParam());
+    ASSERT_LT(std::ifstream("compressed_test.cstats", std::ios::ate).tellg(),
+              std::ifstream("compressed_test.stats", std::ios::ate).tellg() / 4);
+
+    std::vector<Feature_Statistics> row(shard_count + 1);
+    for (std::size_t term = 0; term < term_count; term++) {
+        compressed.decode_row(term, row.data());
+        for (std::size_t column = 0; column <= shard_count; column++) {
+            auto const& expected = exact.row(term)[column];
+            ASSERT_EQ(row[column].frequency, expected.frequency);
+            ASSERT_THAT(row[column].expected_value,
+                        ::testing::DoubleNear(expected.expected_value,
+                                              expected.expected_value * tolerance()));
+            ASSERT_THAT(row[column].variance,
+                        ::testing::DoubleNear(expected.variance, expected.variance * tolerance()));
+        }
+        ASSERT_EQ(compressed.global(term).frequency, exact.global(term).frequency);
+    }
+    ASSERT_THROW(void(compressed.global(term_count)), std::out_of_range);
+}
+
+TEST_P(Compressed_Stats_Store_Test, scores_close_to_exact)
+{
+    Sharded_Stats_Store exact("compressed_test.stats");
+    {
+        std::ofstream ofs("compressed_test.cstats");
+        write_compressed_stats(exact, ofs, GetParam());
+    }
+    Compressed_Stats_Store compressed("compressed_test.cstats");
+    std::vector<std::int64_t> shard_sizes(shard_count, 10'000);
+    Scoring_Workspace workspace;
+    std::vector<double> scores(shard_count);
+    std::vector<double> expected(shard_count);
+    for (auto terms : {std::vector<int>{0}, std::vector<int>{1, 3}, std::vector<int>{4, 2, 0}}) {
+        score_shards(compressed, terms, 400'000, shard_sizes, 100, scores.data(), workspace);
+        score_shards(exact, nullptr, terms, 400'000, shard_sizes, 100, expected.data());
+        for (std::size_t shard = 0; shard < shard_count; shard++) {
+            // Errors of moments are amplified in the tails of the distributions.
+            double const score_tolerance =
+                GetParam() == Moment_Encoding::float32 ? 1e-5 : 1e-2;
+            double const max_error = expected[shard] * score_tolerance + 1e-9;
+            ASSERT_THAT(scores[shard], ::testing::DoubleNear(expected[shard], max_error));
+        }
+    }
+}
+
+TEST_P(Compressed_Stats_Store_Test, detects_corruption)
+{
+    {
+        Sharded_Stats_Store exact("compressed_test.stats");
+        std::ofstream ofs("compressed_test.cstats");
+        write_compressed_stats(exact, ofs, GetParam());
+    }
+    std::string contents;
+    {
+        std::ifstream ifs("compressed_test.cstats", std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+    auto write = [](std::string const& data) {
+        std::ofstream ofs("compressed_test.cstats", std::ios::binary);
+        ofs.write(data.data(), data.size());
+    };
+    std::size_t const offsets_pos = sizeof(Stats_File_Header) + (shard_count + 1) * 8;
+    std::size_t const rows_pos = offsets_pos + (term_count + 1) * 8;
+
+    auto corrupt = contents;
+    corrupt[0] = 'X';
+    write(corrupt);
+    ASSERT_THROW(Compressed_Stats_Store("compressed_test.cstats"), std::runtime_error);
+
+    write(contents.substr(0, rows_pos));
+    ASSERT_THROW(Compressed_Stats_Store("compressed_test.cstats"), std::runtime_error);
+
+    corrupt = contents;
+    std::uint64_t const huge_offset = std::uint64_t{1} << 62;
+    std::memcpy(&corrupt[offsets_pos + 8], &huge_offset, sizeof(huge_offset));
+    write(corrupt);
+    ASSERT_THROW(Compressed_Stats_Store("compressed_test.cstats"), std::runtime_error);
+
+    // Every byte of the first row has its continuation bit set.
+    std::uint64_t first_row_size;
+    std::memcpy(&first_row_size, &contents[offsets_pos + 8], sizeof(first_row_size));
+    corrupt = contents;
+    std::fill_n(corrupt.begin() + rows_pos, first_row_size, '\xFF');
+    write(corrupt);
+    ASSERT_THROW(Compressed_Stats_Store("compressed_test.cstats", Validation::eager),
+                 std::runtime_error);
+    Compressed_Stats_Store lazy("compressed_test.cstats");
+    ASSERT_THROW(void(lazy.global(0)), std::runtime_error);
+    Compressed_Stats_Store unchecked("compressed_test.cstats", Validation::none);
+    std::vector<Feature_Statistics> row(shard_count + 1);
+    ASSERT_THROW(unchecked.decode_row(0, row.data()), std::runtime_error);
+}
+
+INSTANTIATE_TEST_SUITE_P(Encodings,
+                         Compressed_Stats_Store_Test,
+                         ::testing::Values(Moment_Encoding::float32, Moment_Encoding::log16));
+
+TEST(Compressed_Stats_Store, rejects_negative_stats)
+{
+    std::vector<char> out;
+    ASSERT_THROW(detail::encode_stats({-1.0, 1.0, 1}, Moment_Encoding::float32, out),
+                 std::invalid_argument);
+}
+
+TEST(Compressed_Stats_Store, varint)
+{
+    std::vector<char> out;
+    for (std::uint64_t value : {0UL, 127UL, 128UL, 300UL, 1UL << 62}) {
+        out.clear();
+        detail::write_varint(value, out);
+        char const* pos = out.data();
+        ASSERT_EQ(detail::read_varint(pos), value);
+        ASSERT_EQ(pos, out.data() + out.size());
+        pos = out.data();
+        ASSERT_EQ(detail::read_varint(pos, out.data() + out.size()), value);
+        pos = out.data();
+        ASSERT_THROW(void(detail::read_varint(pos, out.data() + out.size() - 1)),
+                     std::runtime_error);
+    }
+    std::vector<char> overlong(11, '\xFF');
+    char const* pos = overlong.data();
+    ASSERT_THROW(void(detail::read_varint(pos, overlong.data() + overlong.size())),
+                 std::runtime_error);
+}
+
+}  // namespace
@@ -0,0 +1,215 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#include <taily/delta_log.hpp>
+
+namespace {
+
+using namespace taily;
+
+class Delta_Log_Test : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        std::mt19937 gen(11);
+        std::uniform_real_distribution<double> feature(0.1, 30.0);
+        std::uniform_int_distribution<int> posting_count(0, 20);
+        all.assign(term_count + 1, std::vector<Feature_Accumulator>(shard_count));
+        std::vector<std::vector<Feature_Statistics>> rows;
+        {
+            std::remove("delta_test.log");
+            Delta_Log_Writer log("delta_test.log", shard_count);
+            for (std::size_t term = 0; term <= term_count; term++) {
+                std::vector<Feature_Statistics> row;
+                for (std::size_t shard = 0; shard < shard_count; shard++) {
+                    Feature_Accumulator base;
+                    Feature_Accumulator added;
+                    for (int posting = posting_count(gen); posting > 0; posting--) {
+                        base.add(feature(gen));
+                    }
+                    for (int posting = posting_count(gen) / 4; posting > 0; posting--) {
+                        added.add(feature(gen));
+                    }
+                    row.push_back(term < term_count ? base.stats() : Feature_Statistics{0, 0, 0});
+                    all[term][shard] = term < term_count ? base + added : added;
+                    log.add(term, shard, added);
+                }
+                rows.push_back(row);
+            }
+            log.add_documents(0, 7);
+            log.add_documents(2, 5);
+        }
+        std::ofstream ofs("delta_test.stats");
+        Sharded_Stats_Writer writer(ofs, term_count, shard_sizes);
+        for (std::size_t term = 0; term < term_count; term++) {
+            writer.write_term(rows[term]);
+        }
+    }
+
+    void TearDown() override
+    {
+        std::remove("delta_test.stats");
+        std::remove("delta_test.log");
+        std::remove("delta_test_compacted.stats");
+    }
+
+    static void expect_near(Feature_Statistics const& actual, Feature_Statistics const& expected)
+    {
+        EXPECT_EQ(actual.frequency, expected.frequency);
+        EXPECT_NEAR(actual.expected_value, expected.expected_value, 1e-9);
+        EXPECT_NEAR(actual.variance, expected.variance, 1e-9);
+    }
+
+    static constexpr std::size_t term_count = 20;
+    static constexpr std::size_t shard_count = 5;
+    std::vector<std::int64_t> shard_sizes = {100, 200, 300, 400, 500};
+    /// Accumulated base and added features; the last term is new.
+    std::vector<std::vector<Feature_Accumulator>> all;
+};
+
+TEST_F(Delta_Log_Test, overlay_matches_rebuilt_statistics)
+{
+    Sharded_Stats_Store base("delta_test.stats");
+    Stats_Delta delta("delta_test.log");
+    ASSERT_EQ(delta.shard_count(), shard_count);
+    ASSERT_THAT(delta.documents(), ::testing::ElementsAre(7, 0, 5, 0, 0));
+    Overlaid_Stats_Store store(base, delta);
+    ASSERT_EQ(store.term_count(), term_count + 1);
+    ASSERT_THAT(store.shard_sizes(), ::testing::ElementsAre(107, 200, 305, 400, 500));
+    ASSERT_EQ(store.collection_size(), 1'512);
+    for (std::size_t term = 0; term <= term_count; term++) {
+        Feature_Accumulator global;
+        for (std::size_t shard = 0; shard < shard_count; shard++) {
+            expect_near(store.row(term)[shard + 1], all[term][shard].stats());
+            global += all[term][shard];
+        }
+        expect_near(store.global(term), global.stats());
+    }
+    ASSERT_THROW((void)store.row(term_count + 1), std::out_of_range);
+}
+
+TEST_F(Delta_Log_Test, compaction_preserves_scores)
+{
+    Sharded_Stats_Store base("delta_test.stats");
+    Stats_Delta delta("delta_test.log");
+    Overlaid_Stats_Store store(base, delta);
+    {
+        std::ofstream ofs("delta_test_compacted.stats");
+        write_compacted_stats(store, ofs);
+    }
+    Sharded_Stats_Store compacted("delta_test_compacted.stats", Validation::eager);
+    ASSERT_EQ(compacted.term_count(), store.term_count());
+    ASSERT_EQ(compacted.shard_sizes(), store.shard_sizes());
+    Scoring_Workspace workspace;
+    std::vector<double> expected(shard_count);
+    std::vector<double> actual(shard_count);
+    for (auto const& terms : std::vector<std::vector<int>>{{0, 3}, {20}, {5, 20, 11}}) {
+        score_shards(compacted,
+                     nullptr,
+                     terms,
+                     compacted.collection_size(),
+                     compacted.shard_sizes(),
+                     50,
+                     expected.data(),
+                     workspace);
+        score_shards(store,
+                     terms,
+                     store.collection_size(),
+                     store.shard_sizes(),
+                     50,
+                     actual.data(),
+                     workspace);
+        ASSERT_EQ(actual, expected);
+    }
+}
+
+TEST_F(Delta_Log_Test, recovers_from_torn_records)
+{
+    std::size_t const record_count = Stats_Delta("delta_test.log").record_count();
+    {
+        std::ofstream ofs("delta_test.log", std::ios::binary | std::ios::app);
+        ofs.write("torn", 4);
+    }
+    ASSERT_EQ(Stats_Delta("delta_test.log").record_count(), record_count);
+    {
+        Delta_Log_Writer log("delta_test.log", shard_count);
+        log.add_documents(1, 3);
+    }
+    Stats_Delta delta("delta_test.log");
+    ASSERT_EQ(delta.record_count(), record_count + 1);
+    ASSERT_THAT(delta.documents(), ::testing::ElementsAre(7, 3, 5, 0, 0));
+    ASSERT_THROW(Delta_Log_Writer("delta_test.log", shard_count + 1), std::runtime_error);
+    {
+        std::ofstream ofs("delta_test.log", std::ios::binary | std::ios::trunc);
+        ofs.write("torn", 4);
+    }
+    ASSERT_THROW(Stats_Delta("delta_test.log"), std::runtime_error);
+    {
+        Delta_Log_Writer log("delta_test.log", shard_count);
+        log.add_documents(2, 4);
+    }
+    Stats_Delta fresh("delta_test.log");
+    ASSERT_EQ(fresh.record_count(), 1);
+    ASSERT_THAT(fresh.documents(), ::testing::ElementsAre(0, 0, 4, 0, 0));
+}
+
+TEST_F(Delta_Log_Test, recovers_from_corrupt_trailing_record)
+{
+    std::size_t const record_count = Stats_Delta("delta_test.log").record_count();
+    {
+        std::ofstream ofs("delta_test.log", std::ios::binary | std::ios::app);
+        std::vector<char> garbage(sizeof(Delta_Record), '\x5a');
+        ofs.write(garbage.data(), garbage.size());
+    }
+    ASSERT_EQ(Stats_Delta("delta_test.log").record_count(), record_count);
+    {
+        Delta_Log_Writer log("delta_test.log", shard_count);
+        log.add_documents(4, 2);
+    }
+    Stats_Delta delta("delta_test.log");
+    ASSERT_EQ(delta.record_count(), record_count + 1);
+    ASSERT_THAT(delta.documents(), ::testing::ElementsAre(7, 0, 5, 0, 2));
+}
+
+TEST_F(Delta_Log_Test, detects_corrupt_records)
+{
+    {
+        std::fstream fs("delta_test.log", std::ios::binary | std::ios::in | std::ios::out);
+        fs.seekp(sizeof(Delta_Log_Header) + sizeof(Delta_Record) + 20);
+        fs.put('\x7f');
+    }
+    ASSERT_THROW(Stats_Delta("delta_test.log"), std::runtime_error);
+}
+
+}  // namespace
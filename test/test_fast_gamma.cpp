@@ -0,0 +1,131 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <taily/fast_gamma.hpp>
+
+namespace {
+
+using namespace taily;
+
+TEST(Fast_Gamma, matches_exact)
+{
+    for (double shape : {0.1, 0.5, 1.0, 3.0, 19.4, 250.0, 5000.0, 1e6}) {
+        Gamma_Parameters const dist{shape, 3.0};
+        for (double p : {0.99, 0.5, 0.01, 1e-4, 1e-8}) {
+            double const exact_x = Exact_Gamma::complement_quantile(dist, p);
+            ASSERT_THAT(Fast_Gamma::complement_quantile(dist, p),
+                        ::testing::DoubleNear(exact_x, exact_x * 1e-6));
+            double const exact_p = Exact_Gamma::complement_cdf(dist, exact_x);
+            ASSERT_THAT(Fast_Gamma::complement_cdf(dist, exact_x),
+                        ::testing::DoubleNear(exact_p, exact_p * 1e-6));
+        }
+    }
+}
+
+TEST(Fast_Gamma, edge_cases)
+{
+    Gamma_Parameters const dist{2.0, 3.0};
+    ASSERT_EQ(Fast_Gamma::complement_cdf(dist, 0.0), 1.0);
+    ASSERT_EQ(Fast_Gamma::complement_cdf(dist, std::numeric_limits<double>::infinity()), 0.0);
+    ASSERT_EQ(Fast_Gamma::complement_quantile(dist, 1.0), 0.0);
+    ASSERT_TRUE(std::isinf(Fast_Gamma::complement_quantile(dist, 0.0)));
+    ASSERT_TRUE(std::isnan(Fast_Gamma::complement_cdf(Gamma_Parameters{0.0, 1.0}, 1.0)));
+    ASSERT_TRUE(std::isnan(Fast_Gamma::complement_quantile(Gamma_Parameters{-1.0, 1.0}, 0.5)));
+}
+
+TEST(Fast_Gamma, batch_matches_scalar)
+{
+    std::vector<Gamma_Parameters> dists;
+    for (double shape : {0.1, 0.5, 1.0, 3.0, 19.4, 250.0, 999.0, 5000.0, 1e6, 0.0, -1.0}) {
+        for (double scale : {0.01, 0.3, 3.0, 100.0}) {
+            dists.push_back({shape, scale});
+        }
+    }
+    for (double x : {0.0, 0.5, 20.0, 3000.0, std::numeric_limits<double>::infinity()}) {
+        // Odd counts leave the last block partially filled.
+        for (std::size_t count : {dists.size(), dists.size() - 1, std::size_t{3}}) {
+            std::vector<double> batch(count);
+            complement_cdf<Fast_Gamma>(dists.data(), count, x, batch.data());
+            for (std::size_t idx = 0; idx < count; idx++) {
+                double const scalar = Fast_Gamma::complement_cdf(dists[idx], x);
+                if (std::isnan(scalar)) {
+                    ASSERT_TRUE(std::isnan(batch[idx]));
+                } else {
+                    ASSERT_THAT(batch[idx], ::testing::DoubleNear(scalar, scalar * 1e-12));
+                }
+            }
+        }
+    }
+}
+
+TEST(Fast_Gamma, pointwise_batch_matches_single_points)
+{
+    std::vector<Gamma_Parameters> dists;
+    std::vector<double> points;
+    for (double shape : {0.1, 1.0, 19.4, 999.0, 1e6, 0.0}) {
+        for (double x : {0.0, 0.5, 20.0, 3000.0, std::numeric_limits<double>::infinity()}) {
+            dists.push_back({shape, 3.0});
+            points.push_back(x);
+        }
+    }
+    std::vector<double> batch(dists.size());
+    complement_cdf<Fast_Gamma>(dists.data(), dists.size(), points.data(), batch.data());
+    for (std::size_t idx = 0; idx < dists.size(); idx++) {
+        double single = 0.0;
+        complement_cdf<Fast_Gamma>(&dists[idx], 1, points[idx], &single);
+        if (std::isnan(single)) {
+            ASSERT_TRUE(std::isnan(batch[idx]));
+        } else {
+            ASSERT_EQ(batch[idx], single);
+        }
+    }
+}
+
+TEST(Fast_Gamma, score_shards)
+{
+    Query_Statistics global_stats = {
+        {{30.57, 102.64, 732'226}, {12.64, 16.02, 6'172'261}, {21.84, 66.17, 1'597'720}},
+        37'512'555};
+    Query_Statistics shard1_stats = {
+        {{30.57, 102.64, 732'226}, {14.0, 10.0, 4'172'261}, {15.0, 70.0, 597'720}}, 12'504'185};
+    Query_Statistics shard2_stats = {
+        {{25.0, 80.0, 100'000}, {11.00, 20.0, 2'000'000}, {25.0, 50.0, 1'000'000}}, 12'504'185};
+    std::vector<Query_Statistics> shard_stats = {shard1_stats, shard2_stats};
+
+    ASSERT_THAT(estimate_cutoff<Fast_Gamma>(global_stats, 50),
+                ::testing::DoubleNear(estimate_cutoff(global_stats, 50), 1e-4));
+    ASSERT_THAT(calculate_cdf<Fast_Gamma>(80, shard1_stats),
+                ::testing::DoubleNear(calculate_cdf(80, shard1_stats), 1e-7));
+    auto exact = score_shards(global_stats, shard_stats, 50);
+    auto fast = score_shards<Fast_Gamma>(global_stats, shard_stats, 50);
+    ASSERT_THAT(fast[0], ::testing::DoubleNear(exact[0], 1e-4));
+    ASSERT_THAT(fast[1], ::testing::DoubleNear(exact[1], 1e-4));
+}
+
+}  // namespace
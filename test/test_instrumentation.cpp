@@ -0,0 +1,149 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <taily/instrumentation.hpp>
+#include <taily/shard_block.hpp>
+
+namespace {
+
+using namespace taily;
+
+TEST(Log2_Histogram, buckets_and_quantiles)
+{
+    ASSERT_EQ(Log2_Histogram::bucket_of(0), 0);
+    ASSERT_EQ(Log2_Histogram::bucket_of(1), 1);
+    ASSERT_EQ(Log2_Histogram::bucket_of(7), 3);
+    ASSERT_EQ(Log2_Histogram::bucket_of(8), 4);
+    ASSERT_EQ(Log2_Histogram::bucket_of(~std::uint64_t{0}), 64);
+    ASSERT_EQ(Log2_Histogram::lower_bound(4), 8);
+    Log2_Histogram histogram;
+    for (std::uint64_t value : {0, 3, 5, 6, 7, 100}) {
+        histogram.record(value);
+    }
+    ASSERT_EQ(histogram.count(), 6);
+    ASSERT_EQ(histogram.sum(), 121);
+    ASSERT_EQ(histogram.bucket(3), 3);
+    ASSERT_EQ(histogram.quantile(0.0), 0);
+    ASSERT_EQ(histogram.quantile(0.5), 7);
+    ASSERT_EQ(histogram.quantile(1.0), 127);
+    Log2_Histogram other;
+    other.record(5);
+    histogram += other;
+    ASSERT_EQ(histogram.count(), 7);
+    ASSERT_EQ(histogram.bucket(3), 4);
+}
+
+/// Records the order of calls to check that phases are properly nested.
+struct Tracing_Instrumentation {
+    void start(Phase phase) { events.push_back(std::string("start ") + to_string(phase)); }
+    void stop(Phase phase) { events.push_back(std::string("stop ") + to_string(phase)); }
+    void count(Counter counter, std::size_t value)
+    {
+        events.push_back(std::string(to_string(counter)) + " " + std::to_string(value));
+    }
+
+    std::vector<std::string> events;
+};
+
+class Instrumentation_Test : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        // Shards 1 and 3 do not contain the second term.
+        shard_stats = {
+            {{{10.0, 4.0, 100}, {8.0, 2.0, 50}}, 1'000},
+            {{{12.0, 3.0, 200}, {0.0, 0.0, 0}}, 2'000},
+            {{{11.0, 5.0, 150}, {9.0, 1.0, 70}}, 1'500},
+            {{{0.0, 0.0, 0}, {0.0, 0.0, 0}}, 500},
+        };
+        global_stats = {{{11.0, 4.0, 450}, {8.5, 1.5, 120}}, 5'000};
+        block.assign(shard_stats);
+    }
+
+    std::vector<Query_Statistics> shard_stats;
+    Query_Statistics global_stats{{}, 0};
+    Shard_Block block;
+};
+
+TEST_F(Instrumentation_Test, records_phases_and_counts)
+{
+    Arena arena;
+    std::vector<double> scores(block.shard_count());
+    Tracing_Instrumentation tracing;
+    score_shards(global_stats, block, 10, scores.data(), arena, Domain::linear, tracing);
+    ASSERT_EQ(scores, score_shards(global_stats, shard_stats, 10));
+    ASSERT_THAT(tracing.events,
+                ::testing::ElementsAre("start candidates",
+                                       "stop candidates",
+                                       "start all",
+                                       "stop all",
+                                       "start cutoff",
+                                       "stop cutoff",
+                                       "start cdf",
+                                       "stop cdf",
+                                       "start normalization",
+                                       "stop normalization",
+                                       "shards_evaluated 2",
+                                       "shards_skipped 2",
+                                       "gamma_evaluations 3"));
+}
+
+TEST_F(Instrumentation_Test, exports_histograms)
+{
+    Arena arena;
+    std::vector<double> scores(block.shard_count());
+    Latency_Recorder recorder;
+    for (int query = 0; query < 5; query++) {
+        arena.reset();
+        score_shards(global_stats, block, 10, scores.data(), arena, Domain::linear, recorder);
+    }
+    ASSERT_EQ(recorder.phase(Phase::cdf).count(), 5);
+    ASSERT_EQ(recorder.phase(Phase::lookup).count(), 0);
+    ASSERT_EQ(recorder.counter(Counter::shards_evaluated).sum(), 10);
+    Latency_Recorder total;
+    total += recorder;
+    total += recorder;
+    ASSERT_EQ(total.counter(Counter::gamma_evaluations).sum(), 30);
+
+    std::ostringstream os;
+    recorder.write_histograms(os);
+    auto csv = os.str();
+    ASSERT_EQ(csv.rfind("name,lower_bound,count\n", 0), 0);
+    ASSERT_NE(csv.find("\nshards_evaluated,2,5\n"), std::string::npos);
+    ASSERT_NE(csv.find("\nshards_skipped,2,5\n"), std::string::npos);
+    ASSERT_NE(csv.find("\ncdf_ns,"), std::string::npos);
+    ASSERT_EQ(csv.find("lookup_ns"), std::string::npos);
+}
+
+}  // namespace
@@ -0,0 +1,230 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <random>
+
+#include <taily/lexicon.hpp>
+
+namespace {
+
+using namespace taily;
+
+auto random_term(std::mt19937& gen) -> std::string
+{
+    // A small alphabet with a high-bit character makes shared prefixes common.
+    std::string const alphabet = "abc\xe9";
+    std::uniform_int_distribution<std::size_t> length(0, 6);
+    std::uniform_int_distribution<std::size_t> letter(0, alphabet.size() - 1);
+    std::string term(length(gen), ' ');
+    for (auto& c : term) {
+        c = alphabet[letter(gen)];
+    }
+    return term;
+}
+
+TEST(Term_Lexicon, finds_all_terms)
+{
+    std::mt19937 gen(11);
+    std::map<std::string, std::size_t> ids;
+    std::vector<std::string> terms;
+    while (terms.size() < 500) {
+        auto term = random_term(gen);
+        if (ids.emplace(term, terms.size()).second) {
+            terms.push_back(term);
+        }
+    }
+    for (std::size_t bucket_size : {1, 3, 16}) {
+        {
+            std::ofstream ofs("lexicon_test.lex");
+            write_lexicon(terms, ofs, bucket_size);
+        }
+        Term_Lexicon lexicon("lexicon_test.lex");
+        ASSERT_EQ(lexicon.term_count(), terms.size());
+        for (std::size_t id = 0; id < terms.size(); id++) {
+            ASSERT_EQ(lexicon.find(terms[id]), id) << terms[id];
+        }
+        for (int query = 0; query < 2000; query++) {
+            auto term = random_term(gen) + random_term(gen);
+            auto expected = ids.find(term);
+            ASSERT_EQ(lexicon.find(term),
+                      expected == ids.end() ? std::nullopt : std::optional(expected->second));
+        }
+    }
+    std::remove("lexicon_test.lex");
+}
+
+TEST(Term_Lexicon, batch_find)
+{
+    std::vector<std::string> terms = {"zebra", "apple", "applet", "bar", "app"};
+    {
+        std::ofstream ofs("lexicon_test.lex");
+        write_lexicon(terms, ofs, 2);
+    }
+    Term_Lexicon lexicon("lexicon_test.lex");
+    std::vector<std::string_view> query = {"app", "zebra", "ap", "applets", "bar", "zz", ""};
+    std::vector<std::size_t> ids(query.size());
+    lexicon.find(query, ids.data());
+    auto none = Term_Lexicon::not_found;
+    ASSERT_THAT(ids, ::testing::ElementsAre(4, 0, none, none, 3, none, none));
+    std::remove("lexicon_test.lex");
+}
+
+TEST(Term_Lexicon, sorted_and_empty)
+{
+    {
+        std::ofstream ofs("lexicon_test.lex");
+        write_lexicon(std::vector<std::string>{"a", "b", "c"}, ofs);
+    }
+    ASSERT_EQ(Term_Lexicon("lexicon_test.lex").find("c"), 2);
+    {
+        std::ofstream ofs("lexicon_test.lex");
+        write_lexicon(std::vector<std::string>{}, ofs);
+    }
+    ASSERT_EQ(Term_Lexicon("lexicon_test.lex").find("a"), std::nullopt);
+    std::ofstream ofs("lexicon_test.lex");
+    ASSERT_THROW(write_lexicon(std::vector<std::string>{"a", "b", "a"}, ofs),
+                 std::invalid_argument);
+    std::remove("lexicon_test.lex");
+}
+
+TEST(Term_Lexicon, detects_corruption)
+{
+    std::vector<std::string> terms = {"zebra", "apple", "applet", "bar", "app"};
+    {
+        std::ofstream ofs("lexicon_test.lex");
+        write_lexicon(terms, ofs, 2);
+    }
+    std::string contents;
+    {
+        std::ifstream ifs("lexicon_test.lex", std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+    auto write = [](std::string const& data) {
+        std::ofstream ofs("lexicon_test.lex", std::ios::binary);
+        ofs.write(data.data(), data.size());
+    };
+    // Checksums of blocks are skipped with `Validation::none`, so that only
+    // structural checks can fail.
+    auto open = [](Validation validation) { return Term_Lexicon("lexicon_test.lex", validation); };
+    std::size_t const offsets_pos = sizeof(Lexicon_File_Header);
+    std::size_t const buckets_pos = offsets_pos + 4 * 8 + 6 * 4;
+    std::size_t const checksums_pos = contents.size() - 8;
+
+    write(contents);
+    ASSERT_EQ(open(Validation::eager).find("bar"), 3);
+
+    auto corrupt = contents;
+    corrupt[0] = 'X';
+    write(corrupt);
+    ASSERT_THROW(open(Validation::none), std::runtime_error);
+
+    corrupt = contents;
+    corrupt[offsetof(Lexicon_File_Header, term_count)] ^= 1;
+    write(corrupt);
+    ASSERT_THROW(open(Validation::none), std::runtime_error);
+
+    corrupt = contents;
+    corrupt[checksums_pos - 1] ^= 1;
+    write(corrupt);
+    ASSERT_THROW(open(Validation::eager), std::runtime_error);
+    ASSERT_THROW(void(open(Validation::lazy).find("bar")), std::runtime_error);
+    ASSERT_NO_THROW(void(open(Validation::none).find("bar")));
+
+    write(contents.substr(0, buckets_pos));
+    ASSERT_THROW(open(Validation::none), std::runtime_error);
+
+    // The second bucket starts before the first one.
+    corrupt = contents;
+    std::uint64_t const offset = std::uint64_t{1} << 40;
+    std::memcpy(&corrupt[offsets_pos + 8], &offset, sizeof(offset));
+    write(corrupt);
+    ASSERT_THROW(void(open(Validation::none).find("bar")), std::runtime_error);
+
+    // The suffix length of the first term exceeds its bucket.
+    corrupt = contents;
+    corrupt[buckets_pos + 1] = 0x7F;
+    write(corrupt);
+    ASSERT_THROW(void(open(Validation::none).find("bar")), std::runtime_error);
+
+    // The first term of a bucket shares a prefix with no previous term.
+    corrupt = contents;
+    corrupt[buckets_pos] = 1;
+    write(corrupt);
+    ASSERT_THROW(void(open(Validation::none).find("bar")), std::runtime_error);
+
+    // A term ID is out of range.
+    corrupt = contents;
+    corrupt[buckets_pos - 8] = 9;
+    write(corrupt);
+    ASSERT_THROW(void(open(Validation::none).find("bar")), std::runtime_error);
+    std::remove("lexicon_test.lex");
+}
+
+TEST(Term_Lexicon, validates_blocks_lazily)
+{
+    std::vector<std::string> terms;
+    for (char first = 'a'; first <= 'z'; first++) {
+        for (char second = 'a'; second <= 'z'; second++) {
+            terms.push_back({first, second});
+        }
+    }
+    {
+        // Blocks of 4 buckets of 4 terms cover 16 terms each.
+        std::ofstream ofs("lexicon_test.lex");
+        write_lexicon(terms, ofs, 4, 4);
+    }
+    std::string contents;
+    {
+        std::ifstream ifs("lexicon_test.lex", std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+    // Flip the last character of "zz", just before the checksums of the blocks.
+    std::size_t const bucket_count = terms.size() / 4 + 1;
+    std::size_t const block_count = bucket_count / 4 + 1;
+    contents[contents.size() - block_count * 8 - 1] ^= 1;
+    {
+        std::ofstream ofs("lexicon_test.lex", std::ios::binary);
+        ofs.write(contents.data(), contents.size());
+    }
+    ASSERT_THROW(Term_Lexicon("lexicon_test.lex", Validation::eager), std::runtime_error);
+    Term_Lexicon lexicon("lexicon_test.lex");
+    ASSERT_EQ(lexicon.find("aa"), 0);
+    ASSERT_EQ(lexicon.find("mq"), 12 * 26 + 16);
+    ASSERT_THROW(void(lexicon.find("zz")), std::runtime_error);
+    ASSERT_THROW(lexicon.validate(), std::runtime_error);
+    std::remove("lexicon_test.lex");
+}
+
+}  // namespace
@@ -0,0 +1,140 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include <taily/fast_gamma.hpp>
+#include <taily/query_cache.hpp>
+
+namespace {
+
+using namespace taily;
+
+TEST(Query_Cache, hits_and_misses)
+{
+    Query_Cache cache(10);
+    ASSERT_EQ(cache.find(std::vector<int>{1, 2}, 50), nullptr);
+    cache.insert(std::vector<int>{2, 1}, 50, {1.0, 2.0}, cache.generation());
+    auto cached = cache.find(std::vector<int>{1, 2}, 50);
+    ASSERT_NE(cached, nullptr);
+    ASSERT_THAT(*cached, ::testing::ElementsAre(1.0, 2.0));
+    ASSERT_EQ(cache.find(std::vector<int>{1, 2}, 100), nullptr);
+    ASSERT_EQ(cache.find(std::vector<int>{1, 2, 2}, 50), nullptr);
+    ASSERT_EQ(cache.hits(), 1);
+    ASSERT_EQ(cache.misses(), 3);
+    ASSERT_DOUBLE_EQ(cache.hit_rate(), 0.25);
+}
+
+TEST(Query_Cache, evicts_least_recently_used)
+{
+    Query_Cache cache(2, 1);
+    cache.insert(std::vector<int>{1}, 50, {1.0}, cache.generation());
+    cache.insert(std::vector<int>{2}, 50, {2.0}, cache.generation());
+    ASSERT_NE(cache.find(std::vector<int>{1}, 50), nullptr);
+    cache.insert(std::vector<int>{3}, 50, {3.0}, cache.generation());
+    ASSERT_EQ(cache.size(), 2);
+    ASSERT_NE(cache.find(std::vector<int>{1}, 50), nullptr);
+    ASSERT_EQ(cache.find(std::vector<int>{2}, 50), nullptr);
+    ASSERT_NE(cache.find(std::vector<int>{3}, 50), nullptr);
+}
+
+TEST(Query_Cache, keyed_by_domain_and_gamma)
+{
+    Query_Cache cache(10);
+    cache.insert(std::vector<int>{1}, 50, {1.0}, cache.generation());
+    cache.insert(std::vector<int>{1}, 50, {2.0}, cache.generation(), Domain::log);
+    cache.insert<Fast_Gamma>(std::vector<int>{1}, 50, {3.0}, cache.generation());
+    ASSERT_EQ(cache.size(), 3);
+    ASSERT_THAT(*cache.find(std::vector<int>{1}, 50), ::testing::ElementsAre(1.0));
+    ASSERT_THAT(*cache.find(std::vector<int>{1}, 50, Domain::log), ::testing::ElementsAre(2.0));
+    ASSERT_THAT(*cache.find<Fast_Gamma>(std::vector<int>{1}, 50), ::testing::ElementsAre(3.0));
+    ASSERT_EQ(cache.find<Fast_Gamma>(std::vector<int>{1}, 50, Domain::log), nullptr);
+    int computed = 0;
+    auto compute = [&computed] {
+        computed += 1;
+        return std::vector<double>{4.0};
+    };
+    ASSERT_THAT(*cache.get_or_compute(std::vector<int>{1}, 50, compute, Domain::log),
+                ::testing::ElementsAre(2.0));
+    ASSERT_THAT(*cache.get_or_compute<Fast_Gamma>(std::vector<int>{1}, 50, compute, Domain::log),
+                ::testing::ElementsAre(4.0));
+    ASSERT_EQ(computed, 1);
+}
+
+TEST(Query_Cache, insert_after_invalidation_is_dropped)
+{
+    Query_Cache cache(10);
+    auto const started_generation = cache.generation();
+    cache.invalidate();
+    cache.insert(std::vector<int>{1}, 50, {1.0}, started_generation);
+    ASSERT_EQ(cache.size(), 0);
+    ASSERT_EQ(cache.find(std::vector<int>{1}, 50), nullptr);
+}
+
+TEST(Query_Cache, get_or_compute_and_invalidate)
+{
+    Query_Cache cache(10);
+    int computed = 0;
+    auto compute = [&computed] {
+        computed += 1;
+        return std::vector<double>{double(computed)};
+    };
+    ASSERT_THAT(*cache.get_or_compute(std::vector<int>{4, 3}, 10, compute),
+                ::testing::ElementsAre(1.0));
+    ASSERT_THAT(*cache.get_or_compute(std::vector<int>{3, 4}, 10, compute),
+                ::testing::ElementsAre(1.0));
+    cache.invalidate();
+    ASSERT_EQ(cache.size(), 0);
+    ASSERT_THAT(*cache.get_or_compute(std::vector<int>{3, 4}, 10, compute),
+                ::testing::ElementsAre(2.0));
+    ASSERT_EQ(computed, 2);
+}
+
+TEST(Query_Cache, concurrent_access)
+{
+    Query_Cache cache(64);
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < 4; thread++) {
+        threads.emplace_back([&cache] {
+            for (int query = 0; query < 1000; query++) {
+                int term = query % 100;
+                auto compute = [term] { return std::vector<double>{double(term)}; };
+                auto scores = cache.get_or_compute(std::vector<int>{term}, 10, compute);
+                ASSERT_EQ(scores->front(), term);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQ(cache.hits() + cache.misses(), 4000);
+    ASSERT_LE(cache.size(), 64);
+}
+
+}  // namespace
@@ -0,0 +1,397 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <random>
+
+#include <taily/fast_gamma.hpp>
+#include <taily/scoring_workspace.hpp>
+
+namespace {
+
+std::atomic<std::size_t> allocation_count{0};
+
+}  // namespace
+
+// Counts all heap allocations of the test binary. The replacements are not
+// inlined, which would make the compiler see `free` of a `new` pointer.
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void* operator new(std::size_t size)
+{
+    allocation_count++;
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+namespace {
+
+using namespace taily;
+
+TEST(Arena, reset_merges_blocks)
+{
+    Arena arena;
+    auto* small = arena.allocate<double>(10);
+    auto* large = arena.allocate<double>(10'000);
+    small[9] = 1.0;
+    large[9'999] = 2.0;
+    ASSERT_GE(arena.capacity(), 10'010 * sizeof(double));
+    auto capacity = arena.capacity();
+    arena.reset();
+    ASSERT_EQ(arena.capacity(), capacity);
+
+    auto before = allocation_count.load();
+    (void)arena.allocate<double>(10);
+    (void)arena.allocate<double>(10'000);
+    ASSERT_EQ(allocation_count.load(), before);
+}
+
+class Scoring_Workspace_Test : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        std::mt19937 gen(7);
+        std::uniform_real_distribution<double> moment(0.5, 20.0);
+        std::uniform_int_distribution<std::int64_t> frequency(0, 1'000);
+        std::ofstream ofs("workspace_test.stats");
+        Sharded_Stats_Writer writer(ofs, term_count, shard_count);
+        for (std::size_t term = 0; term < term_count; term++) {
+            std::vector<Feature_Statistics> row;
+            for (std::size_t shard = 0; shard < shard_count; shard++) {
+                auto freq = frequency(gen);
+                row.push_back(freq == 0 ? Feature_Statistics{0.0, 0.0, 0}
+                                        : Feature_Statistics{moment(gen), moment(gen), freq});
+            }
+            writer.write_term(row);
+        }
+    }
+
+    void TearDown() override { std::remove("workspace_test.stats"); }
+
+    static constexpr std::size_t term_count = 6;
+    static constexpr std::size_t shard_count = 13;
+    std::vector<std::int64_t> shard_sizes = std::vector<std::int64_t>(shard_count, 10'000);
+    std::vector<std::vector<int>> queries = {{0, 1, 2, 3, 4, 5}, {1}, {4, 2}, {5, 0, 3}};
+};
+
+TEST_F(Scoring_Workspace_Test, matches_store_scores)
+{
+    Sharded_Stats_Store store("workspace_test.stats");
+    Scoring_Workspace workspace;
+    std::vector<double> scores(shard_count);
+    for (auto const& terms : queries) {
+        score_shards(store, nullptr, terms, 130'000, shard_sizes, 100, scores.data(), workspace);
+        std::vector<double> expected(shard_count);
+        score_shards(store, nullptr, terms, 130'000, shard_sizes, 100, expected.data());
+        ASSERT_EQ(scores, expected);
+    }
+}
+
+TEST_F(Scoring_Workspace_Test, records_lookup)
+{
+    Sharded_Stats_Store store("workspace_test.stats");
+    Scoring_Workspace workspace;
+    Latency_Recorder recorder;
+    std::vector<double> scores(shard_count);
+    for (auto const& terms : queries) {
+        score_shards(store,
+                     nullptr,
+                     terms,
+                     130'000,
+                     shard_sizes,
+                     100,
+                     scores.data(),
+                     workspace,
+                     Domain::linear,
+                     recorder);
+    }
+    ASSERT_EQ(recorder.phase(Phase::lookup).count(), queries.size());
+    ASSERT_EQ(recorder.phase(Phase::normalization).count(), queries.size());
+}
+
+TEST_F(Scoring_Workspace_Test, batch_matches_single_queries)
+{
+    Sharded_Stats_Store store("workspace_test.stats");
+    Scoring_Workspace workspace;
+    std::vector<double> scores(queries.size() * shard_count);
+    score_batch(store, nullptr, queries, 130'000, shard_sizes, 100, scores.data(), workspace);
+    for (std::size_t query = 0; query < queries.size(); query++) {
+        std::vector<double> expected(shard_count);
+        score_shards(
+            store, nullptr, queries[query], 130'000, shard_sizes, 100, expected.data());
+        ASSERT_EQ(std::vector<double>(scores.begin() + query * shard_count,
+                                      scores.begin() + (query + 1) * shard_count),
+                  expected);
+    }
+    std::vector<std::int64_t> wrong_sizes(shard_count - 1, 10'000);
+    ASSERT_THROW(
+        score_batch(store, nullptr, queries, 130'000, wrong_sizes, 100, scores.data(), workspace),
+        std::invalid_argument);
+}
+
+TEST_F(Scoring_Workspace_Test, batch_shares_terms_between_queries)
+{
+    Sharded_Stats_Store store("workspace_test.stats");
+    {
+        std::ofstream ofs("workspace_test.gamma");
+        write_gamma_parameters(store, ofs);
+    }
+    Gamma_Parameter_Store gammas("workspace_test.gamma");
+    Shard_Occurrences occurrences(store);
+    // Enough queries for the gamma distributions to be evaluated in several groups.
+    std::mt19937 gen(11);
+    std::uniform_int_distribution<int> length(0, 4);
+    std::uniform_int_distribution<int> term(0, term_count - 1);
+    std::vector<std::vector<int>> batch_queries = {{2, 2}, {}, {3}};
+    for (int query = 0; query < 500; query++) {
+        batch_queries.emplace_back(length(gen));
+        std::generate(batch_queries.back().begin(), batch_queries.back().end(), [&] {
+            return term(gen);
+        });
+    }
+    Scoring_Workspace workspace;
+    std::vector<double> scores(batch_queries.size() * shard_count);
+    std::vector<double> expected(shard_count);
+    auto check = [&](auto gamma, Domain domain, bool use_occurrences, bool use_gammas) {
+        using Gamma = decltype(gamma);
+        Latency_Recorder recorder;
+        if (use_occurrences) {
+            score_batch<Gamma>(store,
+                               occurrences,
+                               use_gammas ? &gammas : nullptr,
+                               batch_queries,
+                               130'000,
+                               shard_sizes,
+                               100,
+                               scores.data(),
+                               workspace,
+                               domain,
+                               recorder);
+        } else {
+            score_batch<Gamma>(store,
+                               use_gammas ? &gammas : nullptr,
+                               batch_queries,
+                               130'000,
+                               shard_sizes,
+                               100,
+                               scores.data(),
+                               workspace,
+                               domain,
+                               recorder);
+        }
+        ASSERT_EQ(recorder.phase(Phase::lookup).count(), 1);
+        for (std::size_t query = 0; query < batch_queries.size(); query++) {
+            Scoring_Workspace query_workspace;
+            score_shards<Gamma>(store,
+                                use_gammas ? &gammas : nullptr,
+                                batch_queries[query],
+                                130'000,
+                                shard_sizes,
+                                100,
+                                expected.data(),
+                                query_workspace,
+                                domain);
+            ASSERT_EQ(std::vector<double>(scores.begin() + query * shard_count,
+                                          scores.begin() + (query + 1) * shard_count),
+                      expected);
+        }
+    };
+    for (Domain domain : {Domain::linear, Domain::log}) {
+        for (bool use_occurrences : {false, true}) {
+            for (bool use_gammas : {false, true}) {
+                check(Exact_Gamma{}, domain, use_occurrences, use_gammas);
+                check(Fast_Gamma{}, domain, use_occurrences, use_gammas);
+            }
+        }
+    }
+
+    batch_queries.push_back({0, static_cast<int>(term_count)});
+    std::fill(scores.begin(), scores.end(), -1.0);
+    ASSERT_THROW(score_batch(store,
+                             nullptr,
+                             batch_queries,
+                             130'000,
+                             shard_sizes,
+                             100,
+                             scores.data(),
+                             workspace),
+                 std::out_of_range);
+    ASSERT_EQ(scores.front(), -1.0);
+    std::remove("workspace_test.gamma");
+}
+
+TEST_F(Scoring_Workspace_Test, occurrences_restrict_lookup_to_candidates)
+{
+    std::size_t const sparse_term_count = 8;
+    std::size_t const sparse_shard_count = 150;
+    std::mt19937 gen(23);
+    std::uniform_real_distribution<double> moment(0.5, 20.0);
+    std::uniform_int_distribution<std::int64_t> frequency(-400, 1'000);
+    {
+        std::ofstream ofs("occurrences_test.stats");
+        Sharded_Stats_Writer writer(ofs, sparse_term_count, sparse_shard_count);
+        for (std::size_t term = 0; term < sparse_term_count; term++) {
+            std::vector<Feature_Statistics> row;
+            for (std::size_t shard = 0; shard < sparse_shard_count; shard++) {
+                auto freq = std::max(frequency(gen), std::int64_t{0});
+                row.push_back(freq == 0 ? Feature_Statistics{0.0, 0.0, 0}
+                                        : Feature_Statistics{moment(gen), moment(gen), freq});
+            }
+            writer.write_term(row);
+        }
+    }
+    Sharded_Stats_Store store("occurrences_test.stats");
+    Shard_Occurrences occurrences(store);
+    ASSERT_EQ(occurrences.word_count(), 3);
+    for (std::size_t shard = 0; shard < sparse_shard_count; shard++) {
+        bool const occurs = ((occurrences.occurrences(5)[shard / 64] >> (shard % 64)) & 1U) != 0;
+        ASSERT_EQ(occurs, store.shard(5, shard).frequency != 0);
+    }
+
+    std::vector<std::int64_t> sparse_sizes(sparse_shard_count, 10'000);
+    std::vector<std::vector<int>> sparse_queries = {
+        {0, 1, 2, 3, 4, 5, 6, 7}, {1}, {4, 2}, {5, 0, 3}, {6, 7}, {}};
+    Scoring_Workspace workspace;
+    for (Domain domain : {Domain::linear, Domain::log}) {
+        for (auto const& terms : sparse_queries) {
+            std::vector<double> expected(sparse_shard_count);
+            std::vector<double> scores(sparse_shard_count);
+            score_shards(store,
+                         nullptr,
+                         terms,
+                         1'500'000,
+                         sparse_sizes,
+                         100,
+                         expected.data(),
+                         workspace,
+                         domain);
+            score_shards(store,
+                         occurrences,
+                         nullptr,
+                         terms,
+                         1'500'000,
+                         sparse_sizes,
+                         100,
+                         scores.data(),
+                         workspace,
+                         domain);
+            ASSERT_EQ(scores, expected);
+        }
+    }
+
+    std::vector<double> batch(sparse_queries.size() * sparse_shard_count);
+    std::vector<double> expected(sparse_queries.size() * sparse_shard_count);
+    score_batch(store,
+                nullptr,
+                sparse_queries,
+                1'500'000,
+                sparse_sizes,
+                100,
+                expected.data(),
+                workspace);
+    score_batch(store,
+                occurrences,
+                nullptr,
+                sparse_queries,
+                1'500'000,
+                sparse_sizes,
+                100,
+                batch.data(),
+                workspace);
+    ASSERT_EQ(batch, expected);
+
+    // Shards that are not candidates hold no statistics of a previous query.
+    auto& block = workspace.block();
+    load_shard_block(store, std::vector<int>{1}, sparse_sizes, block);
+    load_shard_block(store, occurrences, std::vector<int>{1, 4}, sparse_sizes, block);
+    std::vector<double> all_scores(sparse_shard_count);
+    all(block, all_scores.data());
+    for (std::size_t shard = 0; shard < sparse_shard_count; shard++) {
+        bool const candidate =
+            store.shard(1, shard).frequency != 0 && store.shard(4, shard).frequency != 0;
+        ASSERT_EQ(block.frequencies(0)[shard],
+                  candidate ? static_cast<double>(store.shard(1, shard).frequency) : 0.0);
+        if (!candidate) {
+            ASSERT_EQ(all_scores[shard], 0.0);
+        }
+    }
+
+    Sharded_Stats_Store other("workspace_test.stats");
+    ASSERT_THROW(load_shard_block(other, occurrences, queries[2], shard_sizes, workspace.block()),
+                 std::invalid_argument);
+    std::remove("occurrences_test.stats");
+}
+
+TEST_F(Scoring_Workspace_Test, no_allocations_in_steady_state)
+{
+    Sharded_Stats_Store store("workspace_test.stats");
+    Scoring_Workspace workspace;
+    std::vector<double> scores(queries.size() * shard_count);
+    for (auto const& terms : queries) {
+        score_shards(store, nullptr, terms, 130'000, shard_sizes, 100, scores.data(), workspace);
+    }
+    // The first reset of the batch arena merges its blocks into one.
+    for (int round = 0; round < 2; round++) {
+        score_batch(store, nullptr, queries, 130'000, shard_sizes, 100, scores.data(), workspace);
+    }
+    auto before = allocation_count.load();
+    for (int round = 0; round < 3; round++) {
+        score_batch(store, nullptr, queries, 130'000, shard_sizes, 100, scores.data(), workspace);
+        for (auto const& terms : queries) {
+            score_shards(
+                store, nullptr, terms, 130'000, shard_sizes, 100, scores.data(), workspace);
+            score_shards<Fast_Gamma>(
+                store, nullptr, terms, 130'000, shard_sizes, 100, scores.data(), workspace);
+        }
+    }
+    ASSERT_EQ(allocation_count.load(), before);
+}
+
+}  // namespace
@@ -0,0 +1,179 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+#include <taily/fast_gamma.hpp>
+#include <taily/shard_block.hpp>
+
+namespace {
+
+using namespace taily;
+
+/// Random statistics for `shard_count` shards, some of which miss a term.
+auto random_shard_stats(std::size_t term_count, std::size_t shard_count, std::mt19937& gen)
+    -> std::vector<Query_Statistics>
+{
+    std::uniform_real_distribution<double> moment(0.5, 20.0);
+    std::uniform_int_distribution<std::int64_t> size(1'000, 1'000'000);
+    std::bernoulli_distribution missing(0.2);
+    std::vector<Query_Statistics> shard_stats;
+    for (std::size_t shard = 0; shard < shard_count; shard++) {
+        Query_Statistics stats{{}, size(gen)};
+        for (std::size_t term = 0; term < term_count; term++) {
+            if (missing(gen)) {
+                stats.term_stats.push_back({0.0, 0.0, 0});
+            } else {
+                std::uniform_int_distribution<std::int64_t> frequency(1, stats.collection_size);
+                stats.term_stats.push_back({moment(gen), moment(gen), frequency(gen)});
+            }
+        }
+        shard_stats.push_back(std::move(stats));
+    }
+    return shard_stats;
+}
+
+TEST(Shard_Block, kernels_match_scalar)
+{
+    std::mt19937 gen(17);
+    Shard_Block block;
+    for (std::size_t term_count = 1; term_count <= 4; term_count++) {
+        for (std::size_t shard_count = 1; shard_count <= 21; shard_count++) {
+            auto shard_stats = random_shard_stats(term_count, shard_count, gen);
+            block.assign(shard_stats);
+            ASSERT_EQ(block.term_count(), term_count);
+            ASSERT_EQ(block.shard_count(), shard_count);
+            std::vector<double> all(shard_count);
+            std::vector<double> expected_values(shard_count);
+            std::vector<double> variances(shard_count);
+            taily::all(block, all.data());
+            sum_moments(block, expected_values.data(), variances.data());
+            for (std::size_t shard = 0; shard < shard_count; shard++) {
+                auto sum = std::accumulate(shard_stats[shard].term_stats.begin(),
+                                           shard_stats[shard].term_stats.end(),
+                                           Feature_Statistics{0, 0, 0});
+                EXPECT_EQ(all[shard], taily::all(shard_stats[shard]));
+                EXPECT_EQ(expected_values[shard], sum.expected_value);
+                EXPECT_EQ(variances[shard], sum.variance);
+            }
+        }
+    }
+}
+
+TEST(Shard_Block, log_all_matches_scalar)
+{
+    std::mt19937 gen(23);
+    Shard_Block block;
+    for (std::size_t term_count : {1, 2, 5, 30}) {
+        for (std::size_t shard_count = 1; shard_count <= 21; shard_count++) {
+            auto shard_stats = random_shard_stats(term_count, shard_count, gen);
+            block.assign(shard_stats);
+            std::vector<double> log_all(shard_count);
+            taily::log_all(block, log_all.data());
+            for (std::size_t shard = 0; shard < shard_count; shard++) {
+                double const expected = taily::log_all(shard_stats[shard]);
+                if (expected == -std::numeric_limits<double>::infinity()) {
+                    EXPECT_EQ(log_all[shard], expected);
+                } else {
+                    EXPECT_NEAR(log_all[shard], expected, 1e-12 * std::abs(expected) + 1e-12);
+                }
+            }
+        }
+    }
+}
+
+TEST(Shard_Block, candidate_shards)
+{
+    std::mt19937 gen(31);
+    Shard_Block block;
+    for (std::size_t term_count : {0, 1, 3}) {
+        for (std::size_t shard_count : {1, 63, 64, 65, 130}) {
+            auto shard_stats = random_shard_stats(term_count, shard_count, gen);
+            block.assign(shard_stats);
+            std::vector<std::size_t> expected;
+            for (std::size_t shard = 0; shard < shard_count; shard++) {
+                auto const& terms = shard_stats[shard].term_stats;
+                if (std::all_of(terms.begin(), terms.end(), [](auto const& stats) {
+                        return stats.frequency != 0;
+                    })) {
+                    expected.push_back(shard);
+                }
+            }
+            std::vector<std::size_t> candidates(shard_count);
+            candidates.resize(candidate_shards(block, candidates.data()));
+            ASSERT_EQ(candidates, expected);
+        }
+    }
+    block.assign(random_shard_stats(1, 3, gen));
+    block.set(0, 0, {1.0, 1.0, 5});
+    block.set(0, 1, {0.0, 0.0, 0});
+    block.set(0, 2, {1.0, 1.0, 5});
+    std::vector<std::size_t> candidates(3);
+    ASSERT_EQ(candidate_shards(block, candidates.data()), 2);
+    ASSERT_THAT(candidates, ::testing::ElementsAre(0, 2, 0));
+}
+
+TEST(Shard_Block, score_shards_matches_scalar)
+{
+    std::mt19937 gen(29);
+    Shard_Block block;
+    for (std::size_t shard_count : {3, 8, 13, 64, 200}) {
+        auto shard_stats = random_shard_stats(3, shard_count, gen);
+        auto global_stats = Query_Statistics{{}, 0};
+        for (std::size_t term = 0; term < 3; term++) {
+            std::vector<Feature_Statistics> column;
+            for (auto const& stats : shard_stats) {
+                column.push_back(stats.term_stats[term]);
+                global_stats.collection_size += term == 0 ? stats.collection_size : 0;
+            }
+            global_stats.term_stats.push_back(merge_statistics(column));
+        }
+        block.assign(shard_stats);
+        std::vector<double> scores(shard_count);
+        score_shards(global_stats, block, 100, scores.data());
+        EXPECT_EQ(scores, score_shards(global_stats, shard_stats, 100));
+
+        score_shards<Fast_Gamma>(global_stats, block, 100, scores.data());
+        auto expected = score_shards<Fast_Gamma>(global_stats, shard_stats, 100);
+        for (std::size_t shard = 0; shard < shard_count; shard++) {
+            EXPECT_THAT(scores[shard], ::testing::DoubleNear(expected[shard], 1e-9));
+        }
+
+        score_shards(global_stats, block, 100, scores.data(), Domain::log);
+        expected = score_shards(global_stats, shard_stats, 100, Domain::log);
+        for (std::size_t shard = 0; shard < shard_count; shard++) {
+            EXPECT_THAT(scores[shard], ::testing::DoubleNear(expected[shard], 1e-9));
+        }
+    }
+}
+
+}  // namespace
@@ -0,0 +1,227 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+
+#include <taily/shard_groups.hpp>
+
+namespace {
+
+using namespace taily;
+
+TEST(Shard_Groups, partition)
+{
+    Shard_Groups groups(std::vector<std::size_t>{1, 0, 1, 2, 0});
+    ASSERT_EQ(groups.group_count(), 3);
+    ASSERT_EQ(groups.shard_count(), 5);
+    auto [first, last] = groups.shards(1);
+    ASSERT_THAT(std::vector<std::size_t>(first, last), ::testing::ElementsAre(0, 2));
+    auto consecutive = Shard_Groups::consecutive(5, 2);
+    ASSERT_EQ(consecutive.group_count(), 3);
+    std::tie(first, last) = consecutive.shards(2);
+    ASSERT_THAT(std::vector<std::size_t>(first, last), ::testing::ElementsAre(4));
+}
+
+class Hierarchical_Selection : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        // Terms are rows; shards 4 and 5 contain term 0 rarely, and shard 7 lacks term 1.
+        std::vector<std::vector<Feature_Statistics>> rows = {
+            {{30.0, 100.0, 700'000},
+             {31.0, 90.0, 650'000},
+             {29.0, 110.0, 720'000},
+             {25.0, 80.0, 500'000},
+             {30.0, 100.0, 1},
+             {30.0, 100.0, 2},
+             {30.0, 100.0, 650'000},
+             {30.0, 100.0, 650'000}},
+            {{14.0, 10.0, 4'000'000},
+             {14.5, 11.0, 3'900'000},
+             {13.0, 10.0, 4'200'000},
+             {12.0, 12.0, 3'000'000},
+             {14.0, 10.0, 4'000'000},
+             {14.0, 10.0, 4'000'000},
+             {14.0, 10.0, 4'000'000},
+             {0.0, 0.0, 0}}};
+        {
+            std::ofstream ofs("groups_test_shards.stats");
+            Sharded_Stats_Writer writer(ofs, rows.size(), 8);
+            for (auto const& row : rows) {
+                writer.write_term(row);
+            }
+        }
+        shard_store = std::make_unique<Sharded_Stats_Store>("groups_test_shards.stats");
+        {
+            std::ofstream ofs("groups_test_groups.stats");
+            write_group_stats(*shard_store, groups, ofs);
+        }
+        group_store = std::make_unique<Sharded_Stats_Store>("groups_test_groups.stats");
+        for (std::size_t shard = 0; shard < 8; shard++) {
+            shard_stats.push_back(
+                Query_Statistics{{shard_store->shard(0, shard), shard_store->shard(1, shard)},
+                                 shard_size});
+        }
+    }
+
+    void TearDown() override
+    {
+        std::remove("groups_test_shards.stats");
+        std::remove("groups_test_groups.stats");
+    }
+
+    std::int64_t shard_size = 12'000'000;
+    std::vector<std::int64_t> shard_sizes = std::vector<std::int64_t>(8, shard_size);
+    Shard_Groups groups = Shard_Groups::consecutive(8, 2);
+    std::unique_ptr<Sharded_Stats_Store> shard_store;
+    std::unique_ptr<Sharded_Stats_Store> group_store;
+    std::vector<Query_Statistics> shard_stats;
+};
+
+TEST_F(Hierarchical_Selection, group_stats)
+{
+    ASSERT_EQ(group_store->shard_count(), 4);
+    auto expected = merge_statistics(
+        std::vector<Feature_Statistics>{shard_store->shard(0, 2), shard_store->shard(0, 3)});
+    ASSERT_EQ(group_store->shard(0, 1).frequency, expected.frequency);
+    ASSERT_DOUBLE_EQ(group_store->shard(0, 1).expected_value, expected.expected_value);
+    ASSERT_DOUBLE_EQ(group_store->shard(0, 1).variance, expected.variance);
+}
+
+TEST_F(Hierarchical_Selection, no_pruning_matches_score_shards)
+{
+    auto global_stats = shard_store->global_query_stats(std::vector<int>{0, 1}, 8 * shard_size);
+    auto expected = score_shards(global_stats, shard_stats, 50);
+    auto selected = select_shards(*shard_store,
+                                  *group_store,
+                                  groups,
+                                  std::vector<int>{0, 1},
+                                  8 * shard_size,
+                                  shard_sizes,
+                                  50,
+                                  0.0);
+    std::size_t nonzero = std::count_if(
+        expected.begin(), expected.end(), [](double score) { return score > 0.0; });
+    ASSERT_EQ(selected.size(), nonzero);
+    for (auto const& [shard, score] : selected) {
+        ASSERT_THAT(score, ::testing::DoubleNear(expected[shard], 1e-9));
+    }
+}
+
+TEST_F(Hierarchical_Selection, prunes_groups)
+{
+    auto global_stats = shard_store->global_query_stats(std::vector<int>{0, 1}, 8 * shard_size);
+    auto expected = score_shards(global_stats, shard_stats, 50);
+    // Group 2 is bounded by a coefficient of 3, i.e., a score of about 4, and is skipped.
+    double const threshold = 5.0;
+    auto selected = select_shards(*shard_store,
+                                  *group_store,
+                                  groups,
+                                  std::vector<int>{0, 1},
+                                  8 * shard_size,
+                                  shard_sizes,
+                                  50,
+                                  threshold);
+    auto expected_selected = select_shards_above(global_stats, shard_stats, 50, threshold);
+    ASSERT_EQ(selected.size(), expected_selected.size());
+    for (std::size_t idx = 0; idx < selected.size(); idx++) {
+        ASSERT_EQ(selected[idx].shard, expected_selected[idx].shard);
+        // The bound of group 2 is normalized over, so scores are lower by less than 10%.
+        ASSERT_LE(selected[idx].score, expected[selected[idx].shard]);
+        ASSERT_GT(selected[idx].score, expected[selected[idx].shard] * 0.9);
+    }
+}
+
+TEST(Hierarchical_Selection_Random, matches_select_shards_above)
+{
+    std::size_t const term_count = 3;
+    std::size_t const shard_count = 60;
+    std::int64_t const shard_size = 100'000;
+    std::mt19937 gen(23);
+    std::uniform_real_distribution<double> moment(1.0, 20.0);
+    std::uniform_real_distribution<double> log_frequency(std::log(1'000.0), std::log(50'000.0));
+    {
+        std::ofstream ofs("groups_test_random.stats");
+        Sharded_Stats_Writer writer(
+            ofs, term_count, std::vector<std::int64_t>(shard_count, shard_size));
+        for (std::size_t term = 0; term < term_count; term++) {
+            std::vector<Feature_Statistics> row;
+            for (std::size_t shard = 0; shard < shard_count; shard++) {
+                // Frequencies fall off quickly with the shard ID, so that groups of
+                // later shards have low bounds and are skipped.
+                double const log_scale = -0.3 * static_cast<double>(shard);
+                row.push_back(
+                    {moment(gen),
+                     moment(gen),
+                     static_cast<std::int64_t>(std::exp(log_frequency(gen) + log_scale)) + 1});
+            }
+            writer.write_term(row);
+        }
+    }
+    Sharded_Stats_Store shard_store("groups_test_random.stats");
+    std::vector<std::int64_t> shard_sizes(shard_count, shard_size);
+    std::vector<int> terms = {0, 1, 2};
+    auto global_stats = shard_store.global_query_stats(terms, shard_count * shard_size);
+    auto shard_stats = shard_store.shard_query_stats(terms, shard_sizes);
+    for (std::size_t group_size : {1, 3, 7}) {
+        auto groups = Shard_Groups::consecutive(shard_count, group_size);
+        {
+            std::ofstream ofs("groups_test_random_groups.stats");
+            write_group_stats(shard_store, groups, ofs);
+        }
+        Sharded_Stats_Store group_store("groups_test_random_groups.stats");
+        for (Domain domain : {Domain::linear, Domain::log}) {
+            for (double threshold : {0.01, 0.1, 0.5, 1.0, 2.0, 5.0}) {
+                auto selected = select_shards(shard_store,
+                                              group_store,
+                                              groups,
+                                              terms,
+                                              shard_count * shard_size,
+                                              shard_sizes,
+                                              50,
+                                              threshold,
+                                              domain);
+                auto expected =
+                    select_shards_above(global_stats, shard_stats, 50, threshold, domain);
+                ASSERT_EQ(selected.size(), expected.size());
+                for (std::size_t idx = 0; idx < selected.size(); idx++) {
+                    ASSERT_EQ(selected[idx].shard, expected[idx].shard);
+                    ASSERT_LE(selected[idx].score, expected[idx].score * (1 + 1e-12));
+                }
+            }
+        }
+    }
+    std::remove("groups_test_random.stats");
+    std::remove("groups_test_random_groups.stats");
+}
+
+}  // namespace
@@ -0,0 +1,189 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include <taily/snapshot.hpp>
+
+namespace {
+
+using namespace taily;
+
+void write_snapshot(std::string const& stats_file, std::string const& gamma_file, double frequency)
+{
+    {
+        std::ofstream ofs(stats_file);
+        Sharded_Stats_Writer writer(ofs, 2, std::vector<std::int64_t>{100, 200});
+        auto freq = static_cast<std::int64_t>(frequency);
+        writer.write_term(std::vector<Feature_Statistics>{{1.0, 2.0, freq}, {3.0, 4.0, freq}});
+        writer.write_term(std::vector<Feature_Statistics>{{5.0, 6.0, freq}, {7.0, 8.0, freq}});
+    }
+    std::ofstream ofs(gamma_file);
+    write_gamma_parameters(Sharded_Stats_Store(stats_file), ofs);
+}
+
+class Snapshot_Test : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        write_snapshot("snapshot_test_1.stats", "snapshot_test_1.gamma", 10);
+        write_snapshot("snapshot_test_2.stats", "snapshot_test_2.gamma", 20);
+    }
+
+    void TearDown() override
+    {
+        for (auto file : {"snapshot_test_1.stats",
+                          "snapshot_test_1.gamma",
+                          "snapshot_test_2.stats",
+                          "snapshot_test_2.gamma"}) {
+            std::remove(file);
+        }
+    }
+};
+
+TEST_F(Snapshot_Test, loads_store_and_gammas)
+{
+    Stats_Snapshot without_gammas("snapshot_test_1.stats");
+    ASSERT_EQ(without_gammas.gammas(), nullptr);
+    ASSERT_EQ(without_gammas.store().collection_size(), 300);
+    Stats_Snapshot with_gammas("snapshot_test_1.stats", "snapshot_test_1.gamma");
+    ASSERT_NE(with_gammas.gammas(), nullptr);
+    ASSERT_EQ(with_gammas.gammas()->term_count(), 2);
+}
+
+TEST_F(Snapshot_Test, pinned_snapshot_outlives_publication)
+{
+    Snapshot_Publisher publisher(std::make_unique<Stats_Snapshot>("snapshot_test_1.stats"));
+    Snapshot_Publisher::Reader old_reader(publisher);
+    Snapshot_Publisher::Reader new_reader(publisher);
+    {
+        auto pinned = old_reader.pin();
+        ASSERT_EQ(publisher.publish(std::make_unique<Stats_Snapshot>("snapshot_test_2.stats")), 1);
+        ASSERT_EQ(publisher.generation(), 1);
+        ASSERT_EQ(pinned->store().row(1)[1].frequency, 10);
+        ASSERT_EQ(new_reader.pin()->store().row(1)[1].frequency, 20);
+        ASSERT_EQ(publisher.reclaim(), 1);
+    }
+    ASSERT_EQ(publisher.reclaim(), 0);
+}
+
+TEST_F(Snapshot_Test, synchronize_reclaims_once_pins_are_released)
+{
+    Snapshot_Publisher publisher(std::make_unique<Stats_Snapshot>("snapshot_test_1.stats"));
+    std::atomic<bool> pinned{false};
+    std::atomic<bool> published{false};
+    std::thread query([&] {
+        Snapshot_Publisher::Reader reader(publisher);
+        auto pin = reader.pin();
+        pinned.store(true);
+        while (!published.load()) {
+            std::this_thread::yield();
+        }
+        ASSERT_EQ(pin->store().row(1)[1].frequency, 10);
+    });
+    while (!pinned.load()) {
+        std::this_thread::yield();
+    }
+    publisher.publish(std::make_unique<Stats_Snapshot>("snapshot_test_2.stats"));
+    ASSERT_EQ(publisher.reclaim(), 1);
+    published.store(true);
+    publisher.synchronize();
+    ASSERT_EQ(publisher.reclaim(), 0);
+    query.join();
+}
+
+TEST_F(Snapshot_Test, readers_are_limited_by_slots)
+{
+    Snapshot_Publisher publisher(
+        std::make_unique<Stats_Snapshot>("snapshot_test_1.stats"), nullptr, 2);
+    Snapshot_Publisher::Reader first(publisher);
+    {
+        Snapshot_Publisher::Reader second(publisher);
+        ASSERT_THROW(Snapshot_Publisher::Reader{publisher}, std::runtime_error);
+    }
+    Snapshot_Publisher::Reader third(publisher);
+    ASSERT_THROW(publisher.publish(nullptr), std::invalid_argument);
+}
+
+TEST_F(Snapshot_Test, publication_invalidates_cache)
+{
+    Query_Cache cache(10);
+    Snapshot_Publisher publisher(std::make_unique<Stats_Snapshot>("snapshot_test_1.stats"), &cache);
+    Snapshot_Publisher::Reader reader(publisher);
+    auto compute = [&reader] {
+        auto snapshot = reader.pin();
+        return std::vector<double>{double(snapshot->store().row(0)[1].frequency)};
+    };
+    ASSERT_THAT(*cache.get_or_compute(std::vector<int>{0}, 1, compute),
+                ::testing::ElementsAre(10.0));
+    publisher.publish(std::make_unique<Stats_Snapshot>("snapshot_test_2.stats"));
+    ASSERT_EQ(cache.size(), 0);
+    ASSERT_THAT(*cache.get_or_compute(std::vector<int>{0}, 1, compute),
+                ::testing::ElementsAre(20.0));
+}
+
+TEST_F(Snapshot_Test, concurrent_readers_see_consistent_snapshots)
+{
+    Snapshot_Publisher publisher(
+        std::make_unique<Stats_Snapshot>("snapshot_test_1.stats", "snapshot_test_1.gamma"));
+    std::atomic<bool> done{false};
+    std::atomic<int> inconsistent{0};
+    std::vector<std::thread> readers;
+    for (int thread = 0; thread < 4; thread++) {
+        readers.emplace_back([&] {
+            Snapshot_Publisher::Reader reader(publisher);
+            while (!done.load()) {
+                auto snapshot = reader.pin();
+                auto const* row = snapshot->store().row(1);
+                if (row[1].frequency != row[2].frequency
+                    || snapshot->gammas()->term_count() != 2) {
+                    inconsistent += 1;
+                }
+            }
+        });
+    }
+    for (int publication = 0; publication < 200; publication++) {
+        auto const* name = publication % 2 == 0 ? "snapshot_test_2" : "snapshot_test_1";
+        publisher.publish(std::make_unique<Stats_Snapshot>(std::string(name) + ".stats",
+                                                           std::string(name) + ".gamma"));
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    ASSERT_EQ(inconsistent.load(), 0);
+    ASSERT_EQ(publisher.generation(), 200);
+    ASSERT_EQ(publisher.reclaim(), 0);
+}
+
+}  // namespace
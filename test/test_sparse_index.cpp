@@ -0,0 +1,102 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <taily/sparse_index.hpp>
+
+namespace {
+
+using namespace taily;
+
+TEST(Sparse_Shard_Index, score_shards_matches_dense)
+{
+    Query_Statistics global_stats = {
+        {{30.57, 102.64, 732'226}, {12.64, 16.02, 6'172'261}, {21.84, 66.17, 1'597'720}},
+        37'512'555};
+    std::vector<Query_Statistics> shard_stats = {
+        {{{30.57, 102.64, 732'226}, {14.0, 10.0, 4'172'261}, {15.0, 70.0, 597'720}}, 12'504'185},
+        {{{0.0, 0.0, 0}, {0.0, 0.0, 0}, {0.0, 0.0, 0}}, 12'504'185},
+        {{{0.0, 0.0, 0}, {11.00, 20.0, 2'000'000}, {25.0, 50.0, 1'000'000}}, 12'504'185},
+        {{{30.57, 102.64, 732'226}, {14.0, 10.0, 4'172'261}, {15.0, 70.0, 597'720}}, 12'504'185}};
+
+    Sparse_Shard_Index index({12'504'185, 12'504'185, 12'504'185, 12'504'185});
+    for (std::size_t term = 0; term < 3; term++) {
+        std::vector<Feature_Statistics> term_stats;
+        for (auto const& shard : shard_stats) {
+            term_stats.push_back(shard.term_stats[term]);
+        }
+        index.add_term(term_stats.begin(), term_stats.end());
+    }
+    ASSERT_EQ(index.term_count(), 3);
+    ASSERT_EQ(index.posting_count(0), 2);
+    ASSERT_EQ(index.posting_count(1), 3);
+    ASSERT_EQ(index.shards(0)[1], 3);
+
+    auto dense = score_shards(global_stats, shard_stats, 50);
+    auto sparse = score_shards(global_stats, index, std::vector<int>{0, 1, 2}, 50);
+    ASSERT_EQ(sparse.size(), 3);
+    ASSERT_EQ(sparse[0].shard, 0);
+    ASSERT_EQ(sparse[1].shard, 2);
+    ASSERT_EQ(sparse[2].shard, 3);
+    for (auto const& shard_score : sparse) {
+        ASSERT_EQ(shard_score.score, dense[shard_score.shard]);
+    }
+    ASSERT_EQ(dense[1], 0.0);
+
+    auto dense_log = score_shards(global_stats, shard_stats, 50, Domain::log);
+    auto sparse_log = score_shards(global_stats, index, std::vector<int>{0, 1, 2}, 50, Domain::log);
+    ASSERT_EQ(sparse_log.size(), 3);
+    for (auto const& shard_score : sparse_log) {
+        ASSERT_THAT(shard_score.score, ::testing::DoubleNear(dense_log[shard_score.shard], 1e-9));
+    }
+}
+
+TEST(Sparse_Shard_Index, no_matching_shards)
+{
+    Sparse_Shard_Index index({10, 10});
+    std::vector<Feature_Statistics> term_stats = {{0.0, 0.0, 0}, {0.0, 0.0, 0}};
+    index.add_term(term_stats.begin(), term_stats.end());
+    Query_Statistics global_stats = {{{2.0, 1.0, 5}}, 20};
+    ASSERT_TRUE(score_shards(global_stats, index, std::vector<int>{0}, 50).empty());
+}
+
+TEST(Sparse_Shard_Index, rejects_rows_of_wrong_length)
+{
+    Sparse_Shard_Index index({10, 10, 10});
+    std::vector<Feature_Statistics> short_row = {{1.0, 1.0, 2}, {1.0, 1.0, 3}};
+    ASSERT_THROW(index.add_term(short_row.begin(), short_row.end()), std::invalid_argument);
+    std::vector<Feature_Statistics> long_row(4, Feature_Statistics{1.0, 1.0, 1});
+    ASSERT_THROW(index.add_term(long_row.begin(), long_row.end()), std::invalid_argument);
+    std::vector<Feature_Statistics> row = {{0.0, 0.0, 0}, {2.0, 1.0, 5}, {0.0, 0.0, 0}};
+    index.add_term(row.begin(), row.end());
+    ASSERT_EQ(index.term_count(), 1);
+    ASSERT_EQ(index.posting_count(0), 1);
+    ASSERT_EQ(index.shards(0)[0], 1);
+}
+
+}  // namespace
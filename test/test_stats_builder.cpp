@@ -0,0 +1,202 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <taily/stats_builder.hpp>
+
+namespace {
+
+using namespace taily;
+
+template<typename T>
+void write_sequence(std::ofstream& os, std::vector<T> const& values)
+{
+    auto length = static_cast<std::uint32_t>(values.size());
+    os.write(reinterpret_cast<char const*>(&length), sizeof(length));
+    os.write(reinterpret_cast<char const*>(values.data()), values.size() * sizeof(T));
+}
+
+TEST(Stats_Builder, build_sharded_stats)
+{
+    std::vector<std::vector<std::uint32_t>> documents = {
+        {0, 1, 2, 5, 7}, {3}, {}, {0, 1, 2, 3, 4, 5, 6, 7}};
+    std::vector<std::vector<float>> scores = {
+        {7, 2, 6, 11, 1}, {9}, {}, {1, 12, 15, 9, 8, 8, 2, 0.5}};
+    std::vector<std::uint32_t> document_shards = {0, 0, 1, 1, 1, 2, 2, 0};
+    {
+        std::ofstream docs("builder_test.docs");
+        std::ofstream freqs("builder_test.scores");
+        write_sequence(docs, std::vector<std::uint32_t>{8});
+        for (std::size_t term = 0; term < documents.size(); term++) {
+            write_sequence(docs, documents[term]);
+            write_sequence(freqs, scores[term]);
+        }
+    }
+    Scored_Posting_Collection collection("builder_test.docs", "builder_test.scores");
+    ASSERT_EQ(collection.term_count(), 4);
+    ASSERT_EQ(collection.document_count(), 8);
+
+    for (std::size_t block_size : {1, 3, 100}) {
+        Thread_Pool pool(3);
+        {
+            std::ofstream ofs("builder_test.stats");
+            build_sharded_stats(collection, document_shards, 3, ofs, pool, block_size);
+        }
+        Sharded_Stats_Store store("builder_test.stats");
+        ASSERT_EQ(store.term_count(), 4);
+        ASSERT_EQ(store.shard_count(), 3);
+        for (std::size_t term = 0; term < documents.size(); term++) {
+            std::vector<std::vector<double>> shard_scores(3);
+            for (std::size_t idx = 0; idx < documents[term].size(); idx++) {
+                shard_scores[document_shards[documents[term][idx]]].push_back(scores[term][idx]);
+            }
+            auto global = Feature_Statistics::from_features(scores[term]);
+            ASSERT_THAT(store.global(term).expected_value,
+                        ::testing::DoubleEq(global.expected_value));
+            ASSERT_THAT(store.global(term).variance, ::testing::DoubleEq(global.variance));
+            ASSERT_EQ(store.global(term).frequency, global.frequency);
+            for (std::size_t shard = 0; shard < 3; shard++) {
+                auto expected = Feature_Statistics::from_features(shard_scores[shard]);
+                ASSERT_THAT(store.shard(term, shard).expected_value,
+                            ::testing::DoubleEq(expected.expected_value));
+                ASSERT_THAT(store.shard(term, shard).variance,
+                            ::testing::DoubleNear(expected.variance, 1e-12));
+                ASSERT_EQ(store.shard(term, shard).frequency, expected.frequency);
+            }
+        }
+    }
+    std::remove("builder_test.docs");
+    std::remove("builder_test.scores");
+    std::remove("builder_test.stats");
+}
+
+TEST(Stats_Builder, skewed_posting_lists)
+{
+    // One long list among many short ones, as in a Zipfian collection.
+    std::size_t const document_count = 1000;
+    std::vector<std::uint32_t> document_shards(document_count);
+    for (std::size_t document = 0; document < document_count; document++) {
+        document_shards[document] = document % 4;
+    }
+    {
+        std::ofstream docs("builder_test.docs");
+        std::ofstream freqs("builder_test.scores");
+        write_sequence(docs, std::vector<std::uint32_t>{document_count});
+        for (std::uint32_t term = 0; term < 50; term++) {
+            std::uint32_t const length = term == 3 ? document_count : 2;
+            std::vector<std::uint32_t> documents;
+            std::vector<float> scores;
+            for (std::uint32_t idx = 0; idx < length; idx++) {
+                documents.push_back(idx * document_count / length + (length == 2 ? term % 2 : 0));
+                scores.push_back(static_cast<float>(term + idx % 7));
+            }
+            write_sequence(docs, documents);
+            write_sequence(freqs, scores);
+        }
+    }
+    Scored_Posting_Collection collection("builder_test.docs", "builder_test.scores");
+    Thread_Pool pool(4);
+    {
+        std::ofstream ofs("builder_test.stats");
+        build_sharded_stats(collection, document_shards, 4, ofs, pool, 16);
+    }
+    Sharded_Stats_Store store("builder_test.stats");
+    ASSERT_EQ(store.term_count(), 50);
+    for (std::size_t term = 0; term < 50; term++) {
+        auto documents = collection.documents(term);
+        ASSERT_EQ(store.global(term).frequency, documents.size());
+        std::int64_t frequency = 0;
+        for (std::size_t shard = 0; shard < 4; shard++) {
+            frequency += store.shard(term, shard).frequency;
+        }
+        ASSERT_EQ(frequency, documents.size());
+    }
+    ASSERT_EQ(store.shard(3, 0).frequency, 250);
+    std::remove("builder_test.docs");
+    std::remove("builder_test.scores");
+    std::remove("builder_test.stats");
+}
+
+TEST(Stats_Builder, document_out_of_range)
+{
+    {
+        std::ofstream docs("builder_test.docs");
+        std::ofstream freqs("builder_test.scores");
+        write_sequence(docs, std::vector<std::uint32_t>{2});
+        write_sequence(docs, std::vector<std::uint32_t>{0, 1});
+        write_sequence(freqs, std::vector<float>{1, 2});
+        write_sequence(docs, std::vector<std::uint32_t>{1, 2});
+        write_sequence(freqs, std::vector<float>{3, 4});
+    }
+    Scored_Posting_Collection collection("builder_test.docs", "builder_test.scores");
+    Thread_Pool pool(2);
+    std::ostringstream os;
+    try {
+        build_sharded_stats(collection, {0, 1}, 2, os, pool);
+        FAIL() << "expected std::runtime_error";
+    } catch (std::runtime_error const& error) {
+        ASSERT_THAT(error.what(), ::testing::HasSubstr("term 1"));
+    }
+    std::remove("builder_test.docs");
+    std::remove("builder_test.scores");
+}
+
+TEST(Stats_Builder, zero_block_size)
+{
+    {
+        std::ofstream docs("builder_test.docs");
+        std::ofstream freqs("builder_test.scores");
+        write_sequence(docs, std::vector<std::uint32_t>{2});
+        write_sequence(docs, std::vector<std::uint32_t>{0, 1});
+        write_sequence(freqs, std::vector<float>{1, 2});
+    }
+    Scored_Posting_Collection collection("builder_test.docs", "builder_test.scores");
+    Thread_Pool pool(2);
+    std::ostringstream os;
+    ASSERT_THROW(build_sharded_stats(collection, {0, 1}, 2, os, pool, 0), std::invalid_argument);
+    std::remove("builder_test.docs");
+    std::remove("builder_test.scores");
+}
+
+TEST(Stats_Builder, compute_term_row_shard_out_of_range)
+{
+    std::vector<std::uint32_t> documents = {0, 1};
+    std::vector<float> scores = {1, 2};
+    std::vector<std::uint32_t> document_shards = {0, 2};
+    std::vector<Feature_Accumulator> accumulators(2);
+    std::vector<Feature_Statistics> row(3);
+    ASSERT_THROW(
+        compute_term_row(0, documents, scores, document_shards, accumulators, row.data()),
+        std::runtime_error);
+}
+
+}  // namespace
@@ -0,0 +1,298 @@
+// MIT License
+//
+// Copyright (c) 2018 Michal Siedlaczek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/// \file
+/// \author Michal Siedlaczek
+/// \copyright MIT License
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+
+#include <taily/stats_store.hpp>
+
+namespace {
+
+using namespace taily;
+
+TEST(Stats_Store, read_mapped_stats)
+{
+    std::vector<Feature_Statistics> written = {
+        {30.57, 102.64, 732'226}, {12.64, 16.02, 6'172'261}, {21.84, 66.17, 1'597'720}};
+    {
+        std::ofstream ofs("stats_store_test.stats");
+        for (auto const& stats : written) {
+            stats.to_stream(ofs);
+        }
+    }
+
+    Stats_Store store("stats_store_test.stats");
+    ASSERT_EQ(store.term_count(), 3);
+    for (std::size_t term = 0; term < written.size(); term++) {
+        ASSERT_EQ(store[term].expected_value, written[term].expected_value);
+        ASSERT_EQ(store[term].variance, written[term].variance);
+        ASSERT_EQ(store[term].frequency, written[term].frequency);
+    }
+    ASSERT_THROW(void(store.at(3)), std::out_of_range);
+
+    auto query = store.query_stats(std::vector<int>{2, 0}, 37'512'555);
+    ASSERT_EQ(query.collection_size, 37'512'555);
+    ASSERT_EQ(query.term_stats.size(), 2);
+    ASSERT_EQ(query.term_stats[0].frequency, 1'597'720);
+    ASSERT_EQ(query.term_stats[1].frequency, 732'226);
+    std::remove("stats_store_test.stats");
+}
+
+TEST(Stats_Store, missing_file)
+{
+    ASSERT_THROW(Stats_Store("nonexistent_file.stats"), std::system_error);
+}
+
+TEST(Sharded_Stats_Store, write_and_read)
+{
+    std::vector<Feature_Statistics> global = {{30.57, 102.64, 732'226}, {12.64, 16.02, 6'172'261}};
+    std::vector<std::vector<Feature_Statistics>> shards = {
+        {{30.57, 102.64, 732'226}, {0.0, 0.0, 0}},
+        {{14.0, 10.0, 4'172'261}, {11.00, 20.0, 2'000'000}}};
+    {
+        std::ofstream ofs("sharded_store_test.stats");
+        Sharded_Stats_Writer writer(ofs, 2, 2);
+        writer.write_term(global[0], shards[0]);
+        writer.write_term(global[1], shards[1]);
+        ASSERT_THROW(writer.write_term(global[1], shards[1]), std::logic_error);
+    }
+
+    Sharded_Stats_Store store("sharded_store_test.stats");
+    ASSERT_EQ(store.term_count(), 2);
+    ASSERT_EQ(store.shard_count(), 2);
+    ASSERT_EQ(store.global(1).frequency, 6'172'261);
+    ASSERT_EQ(store.shard(1, 0).frequency, 4'172'261);
+    ASSERT_EQ(store.shard(1, 1).expected_value, 11.0);
+
+    auto global_query = store.global_query_stats(std::vector<int>{1, 0}, 100);
+    ASSERT_EQ(global_query.collection_size, 100);
+    ASSERT_EQ(global_query.term_stats[0].frequency, 6'172'261);
+    ASSERT_EQ(global_query.term_stats[1].frequency, 732'226);
+
+    auto shard_query = store.shard_query_stats(std::vector<int>{1, 0}, {40, 60});
+    ASSERT_EQ(shard_query.size(), 2);
+    ASSERT_EQ(shard_query[0].collection_size, 40);
+    ASSERT_EQ(shard_query[0].term_stats[0].frequency, 4'172'261);
+    ASSERT_EQ(shard_query[0].term_stats[1].frequency, 732'226);
+    ASSERT_EQ(shard_query[1].collection_size, 60);
+    ASSERT_EQ(shard_query[1].term_stats[0].frequency, 2'000'000);
+    ASSERT_EQ(shard_query[1].term_stats[1].frequency, 0);
+    ASSERT_THROW(void(store.global_query_stats(std::vector<int>{2}, 100)), std::out_of_range);
+    std::remove("sharded_store_test.stats");
+}
+
+class Stats_File_Header_Test : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        std::ofstream ofs("header_test.stats");
+        Sharded_Stats_Writer writer(ofs, term_count, shard_sizes);
+        std::vector<Feature_Statistics> row(shard_count, {2.0, 1.0, 5});
+        for (std::size_t term = 0; term < term_count; term++) {
+            writer.write_term(row);
+        }
+    }
+
+    void TearDown() override { std::remove("header_test.stats"); }
+
+    /// Overwrites a byte at `offset` of the file.
+    static void corrupt(std::streamoff offset)
+    {
+        std::fstream file("header_test.stats", std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(offset);
+        char byte = static_cast<char>(file.get());
+        file.seekp(offset);
+        file.put(static_cast<char>(byte ^ 1));
+    }
+
+    /// Returns the offset of the row of `term`.
+    static auto row_offset(std::size_t term) -> std::streamoff
+    {
+        return sizeof(Stats_File_Header) + shard_count * sizeof(std::int64_t)
+            + term * (shard_count + 1) * Feature_Statistics::struct_size;
+    }
+
+    // About 43 rows of 1000 shards fit in a block of 1 MiB.
+    static constexpr std::size_t term_count = 100;
+    static constexpr std::size_t shard_count = 1000;
+    std::vector<std::int64_t> shard_sizes = std::vector<std::int64_t>(shard_count, 7);
+};
+
+TEST_F(Stats_File_Header_Test, stores_sizes)
+{
+    Sharded_Stats_Store store("header_test.stats", Validation::eager);
+    ASSERT_EQ(store.term_count(), term_count);
+    ASSERT_EQ(store.shard_count(), shard_count);
+    ASSERT_EQ(store.collection_size(), 7'000);
+    ASSERT_EQ(store.shard_sizes(), shard_sizes);
+}
+
+TEST_F(Stats_File_Header_Test, detects_corrupt_rows)
+{
+    corrupt(row_offset(50) + 3);
+    Sharded_Stats_Store lazy("header_test.stats");
+    ASSERT_EQ(lazy.global(10).frequency, 5'000);
+    ASSERT_THROW(void(lazy.global(50)), std::runtime_error);
+    ASSERT_THROW(void(lazy.global(60)), std::runtime_error);
+    ASSERT_EQ(lazy.global(99).frequency, 5'000);
+    ASSERT_THROW(lazy.validate(), std::runtime_error);
+    ASSERT_THROW(Sharded_Stats_Store("header_test.stats", Validation::eager), std::runtime_error);
+    Sharded_Stats_Store unchecked("header_test.stats", Validation::none);
+    ASSERT_NO_THROW(void(unchecked.global(50)));
+}
+
+TEST_F(Stats_File_Header_Test, detects_corrupt_header)
+{
+    corrupt(sizeof(Stats_File_Header) + 8);
+    ASSERT_THROW(Sharded_Stats_Store("header_test.stats"), std::runtime_error);
+}
+
+TEST_F(Stats_File_Header_Test, rejects_forged_counts)
+{
+    Stats_File_Header original{};
+    {
+        std::ifstream file("header_test.stats", std::ios::binary);
+        file.read(reinterpret_cast<char*>(&original), sizeof(original));
+    }
+    auto forge = [this](Stats_File_Header header) {
+        header.header_checksum = detail::header_checksum(header, shard_sizes.data());
+        std::fstream file("header_test.stats", std::ios::in | std::ios::out | std::ios::binary);
+        file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    };
+
+    // Sizes of the shard sizes and of the rows wrap around to their actual
+    // values, so only the counts themselves reveal the forgery.
+    auto header = original;
+    header.shard_count = (std::uint64_t{1} << 61) + shard_count;
+    forge(header);
+    ASSERT_THROW(Sharded_Stats_Store("header_test.stats"), std::runtime_error);
+
+    header = original;
+    header.term_count = (std::uint64_t{1} << 61) + term_count;
+    header.block_terms = (header.term_count + 2) / 3;
+    forge(header);
+    ASSERT_THROW(Sharded_Stats_Store("header_test.stats"), std::runtime_error);
+
+    forge(original);
+    ASSERT_NO_THROW(Sharded_Stats_Store("header_test.stats", Validation::eager));
+}
+
+TEST_F(Stats_File_Header_Test, rejects_other_files)
+{
+    corrupt(0);
+    ASSERT_THROW(Sharded_Stats_Store("header_test.stats"), std::runtime_error);
+    {
+        std::ofstream ofs("header_test.stats");
+        ofs << "short";
+    }
+    ASSERT_THROW(Sharded_Stats_Store("header_test.stats"), std::runtime_error);
+}
+
+TEST(Sharded_Stats_Writer, merges_global_stats)
+{
+    std::vector<std::vector<double>> shard_features = {{7, 2, 6}, {11, 1, 1, 1}, {3, 8, 15}};
+    std::vector<Feature_Statistics> shard_stats;
+    for (auto const& features : shard_features) {
+        shard_stats.push_back(Feature_Statistics::from_features(features));
+    }
+    {
+        std::ofstream ofs("merged_store_test.stats");
+        Sharded_Stats_Writer writer(ofs, 1, 3);
+        writer.write_term(shard_stats);
+    }
+    Sharded_Stats_Store store("merged_store_test.stats");
+    auto expected = Feature_Statistics::from_features(
+        std::vector<double>{7, 2, 6, 11, 1, 1, 1, 3, 8, 15});
+    ASSERT_THAT(store.global(0).expected_value, ::testing::DoubleEq(expected.expected_value));
+    ASSERT_THAT(store.global(0).variance, ::testing::DoubleEq(expected.variance));
+    ASSERT_EQ(store.global(0).frequency, 10);
+    std::remove("merged_store_test.stats");
+}
+
+TEST(Gamma_Parameter_Store, single_term_fast_path)
+{
+    std::vector<std::vector<Feature_Statistics>> shards = {
+        {{30.57, 102.64, 732'226}, {0.0, 0.0, 0}, {20.0, 80.0, 100'000}},
+        {{14.0, 10.0, 4'172'261}, {11.00, 20.0, 2'000'000}, {11.00, 0.0, 1}}};
+    {
+        std::ofstream ofs("gamma_store_test.stats");
+        Sharded_Stats_Writer writer(ofs, 2, 3);
+        writer.write_term(shards[0]);
+        writer.write_term(shards[1]);
+    }
+    Sharded_Stats_Store store("gamma_store_test.stats");
+    {
+        std::ofstream ofs("gamma_store_test.gamma");
+        write_gamma_parameters(store, ofs);
+    }
+    Gamma_Parameter_Store gammas("gamma_store_test.gamma");
+    ASSERT_EQ(gammas.term_count(), 2);
+    ASSERT_EQ(gammas.shard_count(), 3);
+    auto expected_gamma = fit_gamma(store.shard(1, 0));
+    ASSERT_EQ(gammas.row(1)[1].shape, expected_gamma.shape);
+    ASSERT_EQ(gammas.row(1)[1].scale, expected_gamma.scale);
+
+    std::vector<std::int64_t> shard_sizes = {12'504'185, 12'504'185, 12'504'185};
+    for (int term : {0, 1}) {
+        for (int ntop : {50, 1000, 10'000'000}) {
+            std::vector<double> fast(3);
+            std::vector<double> regular(3);
+            score_shards(store,
+                         &gammas,
+                         std::vector<int>{term},
+                         37'512'555,
+                         shard_sizes,
+                         ntop,
+                         fast.data());
+            score_shards(store,
+                         nullptr,
+                         std::vector<int>{term},
+                         37'512'555,
+                         shard_sizes,
+                         ntop,
+                         regular.data());
+            ASSERT_THAT(fast, ::testing::ElementsAreArray(regular));
+        }
+    }
+    std::vector<int> terms = {0, 1};
+    std::vector<double> log_scores(3);
+    score_shards(
+        store, &gammas, terms, 37'512'555, shard_sizes, 50, log_scores.data(), Domain::log);
+    ASSERT_THAT(log_scores,
+                ::testing::ElementsAreArray(
+                    score_shards(store.global_query_stats(terms, 37'512'555),
+                                 store.shard_query_stats(terms, shard_sizes),
+                                 50,
+                                 Domain::log)));
+    std::remove("gamma_store_test.stats");
+    std::remove("gamma_store_test.gamma");
+}
+
+}  // namespace